@@ -0,0 +1,638 @@
+/* Shares one converter among several programs over a local TCP socket,
+   Prologix GPIB-ETHERNET style: a line is data for the selected instrument,
+   a line starting with ++ is a controller command. CR or LF ends a line,
+   ESC takes the next byte literally (binary data, leading '+').
+
+     ++addr [n]  select instrument (per connection), without n print it
+     ++auto [0|1] read reply after each data line (per connection)
+     ++read [eoi] read until EOI
+     ++clr ++trg selected device clear (SDC), trigger (GET)
+     ++loc ++ifc REN false, IFC pulse
+     ++ver       print version
+   Other ++ commands (eos, eoi, mode, read_tmo_ms, ...) are ignored, data
+   end with EOI and the converter's message end sequence (Q).
+
+   Lines of all connections are queued and given to the converter in turn,
+   one per connection with something waiting, and pipelined up to a depth.
+   Replies go back to their connection in the order of its requests. A read
+   that fails (TIMEOUT) returns nothing, as with Prologix.
+
+   usage: gpibbridge [-d device] [-p port] [-v]
+     -p  TCP port on 127.0.0.1, default 1234
+     -v  log connections and failed requests to stderr
+
+   Device defaults to $GPIBCONV or /dev/ttyUSB0. */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "gpibconv.h"
+
+#define BR_MAX_CLIENTS 16
+#define BR_DEPTH 8           // requests in converter pipeline
+#define BR_CLIENT_QUEUE 32   // lines of a connection waiting or in converter
+#define BR_LINE_MAX 2048
+#define BR_OUT_MAX 65536     // unsent replies, connection is not read beyond
+#define BR_SWEEP_MS 100      // GC_Process() of quiet link, for link timeout
+
+#define BR_TAG_LISTEN 0      // epoll data, clients are BR_TAG_CLIENT + index
+#define BR_TAG_CONV 1
+#define BR_TAG_CLIENT 2
+
+typedef enum {BR_WRITE, BR_READ, BR_QUERY, BR_COMMAND, BR_LOCAL} brKind_t;
+
+typedef struct brClient brClient_t;
+
+typedef struct brRequest {
+  struct brRequest * next;
+  brClient_t * client;
+  brKind_t kind;
+  int addr;
+  int done;
+  unsigned char * reply;
+  size_t replyLen;
+  size_t len;
+  unsigned char data[];
+} brRequest_t;
+
+struct brClient {
+  int used;
+  int fd;          // -1 after disconnect, slot is free when nothing in flight
+  int eof;         // peer has shut down sending, close when all is answered
+  int events;
+  int addr;
+  int autoRead;
+  unsigned char line[BR_LINE_MAX];
+  size_t lineLen;
+  int escaped;
+  int literal;     // line started with escaped byte, not a command
+  int overflow;
+  brRequest_t * waiting;
+  brRequest_t ** waitingTail;
+  brRequest_t * inflight;
+  brRequest_t ** inflightTail;
+  int queued;
+  unsigned char * out;
+  size_t outLen;
+  size_t outSize;
+};
+
+static brClient_t clients[BR_MAX_CLIENTS];
+static gpibConv_t * gc;
+static int ep;
+static int outstanding = 0;
+static int nextClient = 0;
+static int verbose = 0;
+static volatile sig_atomic_t stop = 0;
+
+
+static void OnSignal(int sig)
+{
+  stop = 1;
+}
+
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static const char * StatusName(int status)
+{
+  if (GC_TIMEOUT == status)
+    return "TIMEOUT";
+  if (GC_ERROR == status)
+    return "ERROR";
+  return "I/O ERROR";
+}
+
+
+static int Append(brClient_t * c, const unsigned char * data, size_t len)
+{
+  unsigned char * p;
+  size_t size = c->outSize?c->outSize:4096;
+
+  while (c->outLen + len > size)
+    size *= 2;
+  if (size != c->outSize)
+  {
+    p = realloc(c->out, size);
+    if (!p)
+      return -1;
+    c->out = p;
+    c->outSize = size;
+  }
+  memcpy(c->out + c->outLen, data, len);
+  c->outLen += len;
+  return 0;
+}
+
+
+static void FreeList(brRequest_t * r)
+{
+  brRequest_t * next;
+
+  for (; r; r = next)
+  {
+    next = r->next;
+    free(r->reply);
+    free(r);
+  }
+}
+
+
+static void Disconnect(brClient_t * c)
+{
+  brRequest_t * r;
+
+  if (verbose)
+    fprintf(stderr, "client %d disconnected\n", (int)(c - clients));
+  close(c->fd);
+  c->fd = -1;
+  c->events = 0;
+  for (r = c->waiting; r; r = r->next)
+    c->queued--;
+  FreeList(c->waiting);
+  c->waiting = NULL;
+  c->waitingTail = &c->waiting;
+  free(c->out);
+  c->out = NULL;
+  c->outLen = c->outSize = 0;
+  if (!c->inflight)
+    c->used = 0;
+}
+
+
+/* replies of completed requests, in order of the requests */
+static void Deliver(brClient_t * c)
+{
+  brRequest_t * r;
+
+  while (c->inflight && c->inflight->done)
+  {
+    r = c->inflight;
+    c->inflight = r->next;
+    if (!c->inflight)
+      c->inflightTail = &c->inflight;
+    c->queued--;
+    if ((c->fd >= 0) && r->replyLen && (Append(c, r->reply, r->replyLen) < 0))
+    {
+      fprintf(stderr, "out of memory\n");
+      Disconnect(c);
+    }
+    r->next = NULL;
+    FreeList(r);
+  }
+  if ((c->fd < 0) && !c->inflight)
+    c->used = 0;
+}
+
+
+static void Done(void * ctx, int status, const unsigned char * data, size_t len)
+{
+  brRequest_t * r = ctx;
+
+  outstanding--;
+  r->done = 1;
+  if ((GC_OK != status) && verbose)
+    fprintf(stderr, "client %d: %s\n", (int)(r->client - clients), StatusName(status));
+  if ((GC_OK != status) || !len || ((BR_READ != r->kind) && (BR_QUERY != r->kind)))
+    return;
+  r->reply = malloc(len);
+  if (r->reply)
+  {
+    memcpy(r->reply, data, len);
+    r->replyLen = len;
+  }
+}
+
+
+static brRequest_t * Request(brClient_t * c, brKind_t kind, const void * data, size_t len)
+{
+  brRequest_t * r = calloc(1, sizeof(brRequest_t) + len + 1);
+
+  if (!r)
+    return NULL;
+  r->client = c;
+  r->kind = kind;
+  r->addr = c->addr;
+  memcpy(r->data, data, len);
+  r->len = len;
+  *c->waitingTail = r;
+  c->waitingTail = &r->next;
+  c->queued++;
+  return r;
+}
+
+
+static void Local(brClient_t * c, const char * text)
+{
+  brRequest_t * r = Request(c, BR_LOCAL, "", 0);
+
+  if (!r)
+    return;
+  r->reply = (unsigned char *)strdup(text);
+  if (r->reply)
+    r->replyLen = strlen(text);
+}
+
+
+static void Command(brClient_t * c, char * line)
+{
+  char * name = line + 2;
+  char * arg = name + strcspn(name, " \t");
+  char text[32];
+
+  if (*arg)
+    *arg++ = 0;
+  arg += strspn(arg, " \t");
+
+  if (!strcmp(name, "addr"))
+  {
+    if (!*arg)
+    {
+      snprintf(text, sizeof(text), "%d\r\n", c->addr);
+      Local(c, text);
+    }
+    else if ((atoi(arg) >= 0) && (atoi(arg) <= 30))
+      c->addr = atoi(arg);
+  }
+  else if (!strcmp(name, "auto"))
+  {
+    if (!*arg)
+      Local(c, c->autoRead?"1\r\n":"0\r\n");
+    else
+      c->autoRead = (0 != atoi(arg));
+  }
+  else if (!strcmp(name, "read"))
+    Request(c, BR_READ, "", 0);
+  else if (!strcmp(name, "clr") || !strcmp(name, "trg"))
+  {
+    // UNL, listen, SDC or GET
+    snprintf(text, sizeof(text), "T0C3F%02X%02X", 0x20 + c->addr, strcmp(name, "clr")?0x08:0x04);
+    Request(c, BR_COMMAND, text, strlen(text));
+  }
+  else if (!strcmp(name, "loc"))
+    Request(c, BR_COMMAND, "L", 1);
+  else if (!strcmp(name, "ifc"))
+    Request(c, BR_COMMAND, "I", 1);
+  else if (!strcmp(name, "ver"))
+    Local(c, "GPIB to USB converter bridge\r\n");
+}
+
+
+static void Line(brClient_t * c)
+{
+  if (!c->literal && (c->lineLen >= 2) && ('+' == c->line[0]) && ('+' == c->line[1]))
+  {
+    c->line[c->lineLen] = 0;
+    Command(c, (char *)c->line);
+  }
+  else
+    Request(c, c->autoRead?BR_QUERY:BR_WRITE, c->line, c->lineLen);
+}
+
+
+static void Input(brClient_t * c, const unsigned char * data, size_t len)
+{
+  size_t i;
+
+  for (i=0; i<len; i++)
+  {
+    if (!c->escaped && (0x1b == data[i]))
+    {
+      c->escaped = 1;
+      if (!c->lineLen)
+        c->literal = 1;
+      continue;
+    }
+    if (!c->escaped && (('\r' == data[i]) || ('\n' == data[i])))
+    {
+      if (c->overflow)
+        fprintf(stderr, "client %d: line longer than %d bytes dropped\n",
+                (int)(c - clients), BR_LINE_MAX-1);
+      else if (c->lineLen)
+        Line(c);
+      c->lineLen = 0;
+      c->literal = 0;
+      c->overflow = 0;
+      continue;
+    }
+    c->escaped = 0;
+    if (c->lineLen < BR_LINE_MAX-1)
+      c->line[c->lineLen++] = data[i];
+    else
+      c->overflow = 1;
+  }
+}
+
+
+static int Submit(brRequest_t * r)
+{
+  if (BR_WRITE == r->kind)
+    return GC_WriteAsync(gc, r->addr, r->data, r->len, Done, r);
+  if (BR_QUERY == r->kind)
+    return GC_QueryAsync(gc, r->addr, r->data, r->len, Done, r);
+  if (BR_READ == r->kind)
+    return GC_ReadAsync(gc, r->addr, Done, r);
+  return GC_Submit(gc, (const char *)r->data, GC_REPLY_STATUS, Done, r);
+}
+
+
+/* one request of each connection with something waiting per round, local
+   replies don't need a converter slot */
+static void Schedule()
+{
+  brClient_t * c;
+  brRequest_t * r;
+  int progress = 1;
+  int served = 0;
+  int i, k;
+
+  while (progress)
+  {
+    progress = 0;
+    for (k=0; k<BR_MAX_CLIENTS; k++)
+    {
+      i = (nextClient + k) % BR_MAX_CLIENTS;
+      c = &clients[i];
+      r = c->waiting;
+      if (!r || ((BR_LOCAL != r->kind) && (outstanding >= BR_DEPTH)))
+        continue;
+
+      c->waiting = r->next;
+      if (!c->waiting)
+        c->waitingTail = &c->waiting;
+      r->next = NULL;
+      *c->inflightTail = r;
+      c->inflightTail = &r->next;
+      progress = 1;
+      served = i;
+
+      if (BR_LOCAL == r->kind)
+        r->done = 1;
+      else if (GC_OK == Submit(r))
+        outstanding++;
+      else
+      {
+        if (verbose)
+          fprintf(stderr, "client %d: request rejected\n", i);
+        r->done = 1;
+      }
+    }
+    if (progress)
+      nextClient = (served + 1) % BR_MAX_CLIENTS;
+  }
+}
+
+
+static void Flush(brClient_t * c)
+{
+  ssize_t n;
+
+  if (!c->outLen)
+    return;
+  n = send(c->fd, c->out, c->outLen, MSG_NOSIGNAL);
+  if ((n < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+    return;
+  if (n < 0)
+  {
+    Disconnect(c);
+    return;
+  }
+  memmove(c->out, c->out + n, c->outLen - n);
+  c->outLen -= n;
+}
+
+
+static int Watch(int fd, int * registered, int events, uint64_t tag)
+{
+  struct epoll_event ev;
+
+  if (events == *registered)
+    return 0;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.u64 = tag;
+  if (epoll_ctl(ep, *registered?EPOLL_CTL_MOD:EPOLL_CTL_ADD, fd, &ev) < 0)
+    return -1;
+  *registered = events;
+  return 0;
+}
+
+
+static void Accept(int listenFd)
+{
+  brClient_t * c = NULL;
+  int fd, i;
+
+  fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK);
+  if (fd < 0)
+    return;
+  for (i=0; (i < BR_MAX_CLIENTS) && !c; i++)
+    if (!clients[i].used)
+      c = &clients[i];
+  if (!c)
+  {
+    fprintf(stderr, "more than %d connections, refused\n", BR_MAX_CLIENTS);
+    close(fd);
+    return;
+  }
+
+  memset(c, 0, sizeof(brClient_t));
+  c->used = 1;
+  c->fd = fd;
+  c->waitingTail = &c->waiting;
+  c->inflightTail = &c->inflight;
+  if (Watch(fd, &c->events, EPOLLIN | EPOLLERR, BR_TAG_CLIENT + (c - clients)) < 0)
+  {
+    Disconnect(c);
+    return;
+  }
+  if (verbose)
+    fprintf(stderr, "client %d connected\n", (int)(c - clients));
+}
+
+
+static void Receive(brClient_t * c)
+{
+  unsigned char buf[4096];
+  ssize_t n;
+
+  n = read(c->fd, buf, sizeof(buf));
+  if ((n < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+    return;
+  if (n < 0)
+    Disconnect(c);
+  else if (0 == n)
+    c->eof = 1;
+  else
+    Input(c, buf, n);
+}
+
+
+int main(int argc, char * argv[])
+{
+  const char * device = getenv("GPIBCONV");
+  struct epoll_event ev[BR_MAX_CLIENTS + 2];
+  struct sockaddr_in sa;
+  int port = 1234;
+  int listenFd, listenEvents = 0, convEvents = 0;
+  int one = 1;
+  int status = 0;
+  double lastSweep;
+  brClient_t * c;
+  int n, i, events;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:p:v")) != -1)
+  {
+    if ('d' == opt)
+      device = optarg;
+    else if ('p' == opt)
+      port = atoi(optarg);
+    else if ('v' == opt)
+      verbose = 1;
+    else
+      optind = argc+1;
+  }
+  if ((optind != argc) || (port < 1) || (port > 65535))
+  {
+    fprintf(stderr, "usage: %s [-d device] [-p port] [-v]\n", argv[0]);
+    return 1;
+  }
+
+  if (!device)
+    device = "/dev/ttyUSB0";
+  gc = GC_Open(device);
+  if (!gc)
+  {
+    perror(device);
+    return 1;
+  }
+
+  listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((listenFd < 0) || (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) ||
+      (bind(listenFd, (struct sockaddr *)&sa, sizeof(sa)) < 0) || (listen(listenFd, 8) < 0))
+  {
+    perror("socket");
+    GC_Close(gc);
+    return 1;
+  }
+
+  ep = epoll_create1(0);
+  if ((ep < 0) || (Watch(listenFd, &listenEvents, EPOLLIN, BR_TAG_LISTEN) < 0))
+  {
+    perror("epoll");
+    GC_Close(gc);
+    return 1;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  lastSweep = Now();
+  while (!stop)
+  {
+    Schedule();
+    for (i=0; i<BR_MAX_CLIENTS; i++)
+    {
+      c = &clients[i];
+      if (!c->used)
+        continue;
+      Deliver(c);
+      if (c->fd < 0)
+        continue;
+      Flush(c);
+      if ((c->fd >= 0) && c->eof && !c->queued && !c->outLen)
+        Disconnect(c);
+      if (c->fd < 0)
+        continue;
+
+      // EPOLLERR is reported anyway, keeps mask of a waiting client nonzero
+      events = EPOLLERR | (c->outLen?EPOLLOUT:0);
+      if (!c->eof && (c->queued < BR_CLIENT_QUEUE) && (c->outLen < BR_OUT_MAX))
+        events |= EPOLLIN;
+      if (Watch(c->fd, &c->events, events, BR_TAG_CLIENT + i) < 0)
+        Disconnect(c);
+    }
+    if (Watch(GC_Fd(gc), &convEvents, EPOLLIN | (GC_WantWrite(gc)?EPOLLOUT:0), BR_TAG_CONV) < 0)
+    {
+      perror("epoll");
+      status = 1;
+      break;
+    }
+
+    n = epoll_wait(ep, ev, BR_MAX_CLIENTS + 2, BR_SWEEP_MS);
+    if ((n < 0) && (EINTR != errno))
+    {
+      perror("epoll");
+      status = 1;
+      break;
+    }
+
+    for (i=0; i<n; i++)
+    {
+      if (BR_TAG_LISTEN == ev[i].data.u64)
+        Accept(listenFd);
+      else if (BR_TAG_CONV == ev[i].data.u64)
+      {
+        if (GC_Process(gc, 0) < 0)
+          stop = 2;
+        lastSweep = Now();
+      }
+      else
+      {
+        c = &clients[ev[i].data.u64 - BR_TAG_CLIENT];
+        if ((c->fd >= 0) && (ev[i].events & EPOLLIN))
+          Receive(c);
+        if ((c->fd >= 0) && (ev[i].events & EPOLLOUT))
+          Flush(c);
+        if ((c->fd >= 0) && (ev[i].events & (EPOLLERR | EPOLLHUP)))
+          Disconnect(c);
+      }
+    }
+
+    // quiet link still needs GC_Process() to notice silence
+    if (outstanding && (Now() - lastSweep >= BR_SWEEP_MS/1000.0))
+    {
+      if (GC_Process(gc, 0) < 0)
+        stop = 2;
+      lastSweep = Now();
+    }
+  }
+
+  if (2 == stop)
+  {
+    fprintf(stderr, "%s: converter not responding\n", device);
+    status = 2;
+  }
+  for (i=0; i<BR_MAX_CLIENTS; i++)
+    if (clients[i].used && (clients[i].fd >= 0))
+      Disconnect(&clients[i]);
+  GC_Close(gc);
+  for (i=0; i<BR_MAX_CLIENTS; i++)
+  {
+    FreeList(clients[i].inflight);
+    clients[i].inflight = NULL;
+  }
+  close(listenFd);
+  close(ep);
+  return status;
+}
@@ -0,0 +1,235 @@
+/* Printer mode capture, writes one file per plot.
+
+   Data are read from serial port straight into memory mapped output files,
+   which are grown in large preallocated steps, so nothing is copied and a
+   slow disk does not stall the reader. A plot ends when the stream is idle
+   for the gap time or, with run length coded stream (converter setting K1),
+   when the converter reports EOI. Files are ready for HP7470 emulator.
+
+   usage: gpibcap [-d device] [-o pattern] [-g gap_ms] [-p] [-z]
+     -o  output file name pattern, default plot%04d.plt
+     -g  idle time ending a plot, default 2000 ms
+     -p  put converter into printer mode (P command) first, ESC on exit
+     -z  stream is run length coded (K1)
+
+   Device defaults to $GPIBCONV or /dev/ttyUSB0. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "gpibconv.h"
+#include "gpibrle.h"
+
+#define CAP_FILE_STEP (16*1024*1024) // preallocation step of output file
+#define CAP_READ_MIN 65536           // free mapped space wanted before read
+#define CAP_CODED_BUF 4096
+
+typedef struct {
+  const char * pattern;
+  int index;
+  int fd;
+  unsigned char * map;
+  size_t size;
+  size_t len;
+  char name[512];
+} capFile_t;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void OnSignal(int sig)
+{
+  stop = 1;
+}
+
+
+static int Grow(capFile_t * f, size_t need)
+{
+  size_t size = f->size;
+
+  if (f->len + need <= f->size)
+    return 0;
+  while (f->len + need > size)
+    size += CAP_FILE_STEP;
+
+  if (f->map && (munmap(f->map, f->size) < 0))
+    return -1;
+  f->map = NULL;
+  if (ftruncate(f->fd, size) < 0)
+    return -1;
+  f->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+  if (MAP_FAILED == f->map)
+  {
+    f->map = NULL;
+    return -1;
+  }
+  f->size = size;
+  return 0;
+}
+
+
+static int OpenFile(capFile_t * f)
+{
+  snprintf(f->name, sizeof(f->name), f->pattern, f->index);
+  f->fd = open(f->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (f->fd < 0)
+    return -1;
+  f->map = NULL;
+  f->size = 0;
+  f->len = 0;
+  return Grow(f, CAP_READ_MIN);
+}
+
+
+/* empty files are removed and their number is used again */
+static void CloseFile(capFile_t * f)
+{
+  if (f->fd < 0)
+    return;
+  if (f->map)
+    munmap(f->map, f->size);
+  if (ftruncate(f->fd, f->len) < 0)
+    perror(f->name);
+  close(f->fd);
+  f->fd = -1;
+
+  if (f->len)
+  {
+    fprintf(stderr, "%s: %zu bytes\n", f->name, f->len);
+    f->index++;
+  }
+  else
+    unlink(f->name);
+}
+
+
+int main(int argc, char * argv[])
+{
+  const char * device = getenv("GPIBCONV");
+  capFile_t f = {"plot%04d.plt", 0, -1, NULL, 0, 0, ""};
+  unsigned char in[CAP_CODED_BUF];
+  rleDecoder_t d;
+  struct pollfd p;
+  size_t pos, used;
+  ssize_t n;
+  int gap = 2000;
+  int printerMode = 0;
+  int coded = 0;
+  int line, opt;
+
+  while ((opt = getopt(argc, argv, "d:o:g:pz")) != -1)
+  {
+    if ('d' == opt)
+      device = optarg;
+    else if ('o' == opt)
+      f.pattern = optarg;
+    else if ('g' == opt)
+      gap = atoi(optarg);
+    else if ('p' == opt)
+      printerMode = 1;
+    else if ('z' == opt)
+      coded = 1;
+    else
+    {
+      fprintf(stderr, "usage: %s [-d device] [-o pattern] [-g gap_ms] [-p] [-z]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (!device)
+    device = "/dev/ttyUSB0";
+  line = GC_OpenLine(device);
+  if (line < 0)
+  {
+    perror(device);
+    return 1;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  if (printerMode && (write(line, "\x1b\r\rP\r", 5) != 5))
+  {
+    perror(device);
+    return 1;
+  }
+
+  RLE_DecoderInit(&d);
+  p.fd = line;
+  p.events = POLLIN;
+
+  while (!stop)
+  {
+    n = poll(&p, 1, gap);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    if (0 == n) // idle gap ends plot
+    {
+      CloseFile(&f);
+      continue;
+    }
+
+    if ((f.fd < 0) && (OpenFile(&f) < 0))
+    {
+      perror(f.name);
+      break;
+    }
+    if (Grow(&f, coded?CAP_CODED_BUF*255:CAP_READ_MIN) < 0)
+    {
+      perror(f.name);
+      break;
+    }
+
+    if (!coded) // read straight into the file
+    {
+      n = read(line, f.map + f.len, f.size - f.len);
+      if (n > 0)
+        f.len += n;
+    }
+    else
+    {
+      n = read(line, in, sizeof(in));
+      for (pos=0; (n > 0) && (pos < (size_t)n); pos += used)
+      {
+        f.len += RLE_Decode(&d, in+pos, n-pos, f.map + f.len, f.size - f.len, &used);
+        if (RLE_CTRL_EOI == d.control)
+        {
+          CloseFile(&f);
+          if (OpenFile(&f) < 0)
+          {
+            perror(f.name);
+            stop = 1;
+            break;
+          }
+          Grow(&f, CAP_CODED_BUF*255);
+        }
+      }
+    }
+
+    if ((n < 0) && (EAGAIN != errno) && (EINTR != errno))
+    {
+      perror(device);
+      break;
+    }
+    if (0 == n) // port gone
+      break;
+  }
+
+  CloseFile(&f);
+  if (printerMode && (write(line, "\x1b", 1) != 1))
+    perror(device);
+  close(line);
+  return 0;
+}
@@ -0,0 +1,364 @@
+/* Command line client for GPIB to USB converter.
+
+   usage: gpibcli [-d device] [-a addr] [-n count] command [text]
+     write <text>   send text to device at addr
+     read           read device output until EOI
+     query <text>   write and read back
+     cmd <line>     converter command line, print reply line
+     burst <text>   query repeated by converter, replies collected in its
+                    RAM, print time offset (us) and reply of each
+     drain          data converter captured in listen mode (no address),
+                    everything waiting, message ends shown by newline
+     scan [idn]     addresses of instruments on bus (no address), with
+                    idn also their *IDN? replies
+     events         wait for SRQ, print address, status byte and message
+                    the converter read from the requester, count times
+     values [dec]   read numeric reply converted to binary by converter,
+                    floats or integers with dec decimals (0..9)
+     -n count       repeat write/read/query count times with requests
+                    pipelined, print rate to stderr, burst count (1..255),
+                    SRQ messages to wait for
+
+   Device defaults to $GPIBCONV or /dev/ttyUSB0. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpibconv.h"
+
+#define MAX_OUTSTANDING 32
+
+typedef struct {
+  int outstanding;
+  int completed;
+  int failed;
+  int print;
+} cliState_t;
+
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static const char * StatusName(int status)
+{
+  if (GC_OK == status)
+    return "OK";
+  if (GC_TIMEOUT == status)
+    return "TIMEOUT";
+  if (GC_ERROR == status)
+    return "ERROR";
+  return "I/O ERROR";
+}
+
+
+static void Done(void * ctx, int status, const unsigned char * data, size_t len)
+{
+  cliState_t * st = ctx;
+
+  st->outstanding--;
+  st->completed++;
+  if (GC_OK != status)
+    st->failed++;
+  if (st->print)
+    fwrite(data, 1, len, stdout);
+}
+
+
+static int Submit(gpibConv_t * gc, const char * command, int addr, const char * text, cliState_t * st)
+{
+  if (!strcmp(command, "write"))
+    return GC_WriteAsync(gc, addr, text, strlen(text), Done, st);
+  if (!strcmp(command, "read"))
+    return GC_ReadAsync(gc, addr, Done, st);
+  return GC_QueryAsync(gc, addr, text, strlen(text), Done, st);
+}
+
+
+static int Drain(gpibConv_t * gc)
+{
+  unsigned char buf[GC_READ_CHUNK];
+  size_t len;
+  int flags = GC_LISTEN_MORE;
+  int status = GC_OK;
+
+  while ((GC_OK == status) && (flags & GC_LISTEN_MORE))
+  {
+    status = GC_Drain(gc, buf, sizeof(buf), &len, &flags);
+    fwrite(buf, 1, len, stdout);
+    if ((flags & GC_LISTEN_EOI) && (!len || ('\n' != buf[len-1])))
+      printf("\n");
+  }
+  if (GC_OK != status)
+    fprintf(stderr, "%s\n", StatusName(status));
+  return (GC_OK == status)?0:2;
+}
+
+
+typedef struct {
+  int decimals;
+  int status;
+  int done;
+} valuesState_t;
+
+
+static void PrintValues(void * ctx, int status, const unsigned char * data, size_t len)
+{
+  valuesState_t * v = ctx;
+  int32_t fixed;
+  float value;
+  size_t i;
+
+  for (i=0; i+4 <= len; i+=4)
+  {
+    if (v->decimals < 0)
+    {
+      memcpy(&value, data+i, 4);
+      printf("%g\n", value);
+    }
+    else
+    {
+      memcpy(&fixed, data+i, 4);
+      if (GC_VALUE_INVALID == fixed)
+        printf("invalid\n");
+      else
+        printf("%d\n", fixed);
+    }
+  }
+  v->status = status;
+  v->done = 1;
+}
+
+
+/* whole reply, however long, the blocking calls need a buffer for it */
+static int Values(gpibConv_t * gc, int addr, const char * text)
+{
+  valuesState_t v = {*text?atoi(text):-1, GC_OK, 0};
+  int status;
+
+  status = GC_ReadValuesAsync(gc, addr, v.decimals, PrintValues, &v);
+  if (GC_OK == status)
+  {
+    while (!v.done)
+      GC_Process(gc, 100);
+    status = v.status;
+  }
+  if (GC_OK != status)
+    fprintf(stderr, "%s\n", StatusName(status));
+  return (GC_OK == status)?0:2;
+}
+
+
+static int Burst(gpibConv_t * gc, int addr, const char * text, int count)
+{
+  unsigned char buf[2048];
+  size_t len, pos;
+  double us = 0;
+  int status;
+
+  status = GC_Burst(gc, addr, text, strlen(text), count, buf, sizeof(buf), &len);
+  for (pos=0; pos+3 <= len; pos += 3+buf[pos+2])
+  {
+    if (pos)
+      us += (buf[pos] | (buf[pos+1] << 8)) * GC_BURST_TICK_US;
+    printf("%10.1f ", us);
+    fwrite(buf+pos+3, 1, buf[pos+2], stdout);
+    if ((0 == buf[pos+2]) || ('\n' != buf[pos+2+buf[pos+2]]))
+      printf("\n");
+  }
+  if (GC_OK != status)
+    fprintf(stderr, "%s\n", StatusName(status));
+  return (GC_OK == status)?0:2;
+}
+
+
+static int Scan(gpibConv_t * gc, const char * text)
+{
+  char idn[31*(GC_IDN_MAX+4) + 1];
+  uint32_t map;
+  int status, addr;
+
+  status = GC_Scan(gc, &map, strcmp(text, "idn")?NULL:idn, sizeof(idn));
+  if (GC_OK != status)
+  {
+    fprintf(stderr, "%s\n", StatusName(status));
+    return 2;
+  }
+  if (strcmp(text, "idn"))
+  {
+    for (addr=0; addr<31; addr++)
+      if (map & (1UL << addr))
+        printf("%d\n", addr);
+  }
+  else
+    fputs(idn, stdout);
+  return 0;
+}
+
+
+static void SrqCallback(void * ctx, int addr, int status, const unsigned char * data, size_t len)
+{
+  int * received = ctx;
+
+  printf("%d %02X ", addr, status);
+  fwrite(data, 1, len, stdout);
+  if (!len || ('\n' != data[len-1]))
+    printf("\n");
+  fflush(stdout);
+  (*received)++;
+}
+
+
+static int Events(gpibConv_t * gc, int count)
+{
+  int received = 0;
+  int status;
+
+  status = GC_SrqEvents(gc, SrqCallback, &received);
+  while ((GC_OK == status) && (received < count))
+  {
+    if (GC_Process(gc, 100) < 0)
+      status = GC_IOERROR;
+  }
+  if (GC_OK == status)
+    status = GC_SrqEvents(gc, NULL, NULL);
+  if (GC_OK != status)
+    fprintf(stderr, "%s\n", StatusName(status));
+  return (GC_OK == status)?0:2;
+}
+
+
+static void Usage(const char * name)
+{
+  fprintf(stderr, "usage: %s [-d device] [-a addr] [-n count] write|read|query|cmd|burst|values|drain|scan|events [text]\n", name);
+  exit(1);
+}
+
+
+int main(int argc, char * argv[])
+{
+  const char * device = getenv("GPIBCONV");
+  const char * command;
+  const char * text = "";
+  char reply[GC_MAX_LINE];
+  cliState_t st = {0, 0, 0, 1};
+  gpibConv_t * gc;
+  int addr = -1;
+  int count = 1;
+  int submitted = 0;
+  int status = GC_OK;
+  double start;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:a:n:")) != -1)
+  {
+    if ('d' == opt)
+      device = optarg;
+    else if ('a' == opt)
+      addr = atoi(optarg);
+    else if ('n' == opt)
+      count = atoi(optarg);
+    else
+      Usage(argv[0]);
+  }
+
+  if (optind >= argc)
+    Usage(argv[0]);
+  command = argv[optind++];
+  if (optind < argc)
+    text = argv[optind];
+
+  if (strcmp(command, "cmd") && strcmp(command, "write") && strcmp(command, "read") && strcmp(command, "query") &&
+      strcmp(command, "burst") && strcmp(command, "values") && strcmp(command, "drain") &&
+      strcmp(command, "scan") && strcmp(command, "events"))
+    Usage(argv[0]);
+  if (strcmp(command, "cmd") && strcmp(command, "drain") && strcmp(command, "scan") && strcmp(command, "events") && ((addr < 0) || (addr > 30)))
+  {
+    fprintf(stderr, "device address 0..30 required (-a)\n");
+    return 1;
+  }
+
+  gc = GC_Open(device?device:"/dev/ttyUSB0");
+  if (!gc)
+  {
+    perror(device?device:"/dev/ttyUSB0");
+    return 1;
+  }
+
+  if (!strcmp(command, "cmd"))
+  {
+    status = GC_Command(gc, text, reply, sizeof(reply));
+    printf("%s\n", reply);
+    GC_Close(gc);
+    return (GC_OK == status)?0:2;
+  }
+
+  if (!strcmp(command, "drain"))
+  {
+    status = Drain(gc);
+    GC_Close(gc);
+    return status;
+  }
+
+  if (!strcmp(command, "scan"))
+  {
+    status = Scan(gc, text);
+    GC_Close(gc);
+    return status;
+  }
+
+  if (!strcmp(command, "events"))
+  {
+    status = Events(gc, count);
+    GC_Close(gc);
+    return status;
+  }
+
+  if (!strcmp(command, "values"))
+  {
+    status = Values(gc, addr, text);
+    GC_Close(gc);
+    return status;
+  }
+
+  if (!strcmp(command, "burst"))
+  {
+    status = Burst(gc, addr, text, count);
+    GC_Close(gc);
+    return status;
+  }
+
+  st.print = (1 == count);
+  start = Now();
+  while ((st.completed < count) && (GC_IOERROR != status))
+  {
+    while ((submitted < count) && (st.outstanding < MAX_OUTSTANDING))
+    {
+      if (GC_OK != Submit(gc, command, addr, text, &st))
+      {
+        fprintf(stderr, "request rejected\n");
+        GC_Close(gc);
+        return 1;
+      }
+      st.outstanding++;
+      submitted++;
+    }
+    status = GC_Process(gc, 100);
+  }
+
+  if (GC_IOERROR == status)
+    fprintf(stderr, "%s\n", StatusName(status));
+  else if (count > 1)
+    fprintf(stderr, "%d %s, %d failed, %.1f/s\n", count, command, st.failed, count/(Now()-start));
+  else if (st.failed)
+    fprintf(stderr, "%s\n", "failed");
+
+  GC_Close(gc);
+  return ((GC_IOERROR == status) || st.failed)?2:0;
+}
@@ -0,0 +1,1027 @@
+#include "gpibconv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <limits.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+
+#define GC_RX_BUF_SIZE 4096
+
+typedef struct {
+  gcCallback_t cb;
+  void * ctx;
+  int addr;
+  int status;          // first failure of the operation
+  int chunked;         // device read, continued while chunks are full
+  unsigned char * data;
+  size_t len;
+  size_t size;
+} gcOp_t;
+
+typedef struct {
+  char line[GC_MAX_LINE];
+  size_t len;          // CR included
+  int reply;
+  int last;            // operation completes with this request
+  int data;            // reply payload belongs to operation data
+  gcOp_t * op;
+} gcRequest_t;
+
+struct gpibConv {
+  int fd;
+  int ownAddress;
+  int msgEndSeq;
+  gcRequest_t req[GC_MAX_PENDING];
+  unsigned int head;   // oldest request waiting for reply
+  unsigned int sent;   // next request to send
+  unsigned int tail;   // next free slot
+  size_t txOffset;     // bytes of req[sent] already written
+  size_t inFlight;     // bytes sent and not replied yet
+  gcOp_t * reading[31]; // device read sent and not finished, per address
+  int partial;         // reply of req[head] partly taken (F blocks)
+  unsigned char rx[GC_RX_BUF_SIZE];
+  size_t rxLen;
+  long long lastActivity;
+  gcSrqCallback_t srqCb;
+  void * srqCtx;
+};
+
+
+static long long NowMs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+
+/* FT232 holds received bytes up to latency timer (16 ms by default) before
+   sending them to host, which dominates round trip of short replies */
+static void SetLowLatency(int fd, const char * device)
+{
+  struct serial_struct ss;
+  char path[PATH_MAX];
+  char sysfs[PATH_MAX+64];
+  FILE * f;
+
+  if (0 == ioctl(fd, TIOCGSERIAL, &ss))
+  {
+    ss.flags |= ASYNC_LOW_LATENCY;
+    ioctl(fd, TIOCSSERIAL, &ss);
+  }
+
+  if (!realpath(device, path))
+    return;
+  snprintf(sysfs, sizeof(sysfs), "/sys/bus/usb-serial/devices/%s/latency_timer", basename(path));
+  f = fopen(sysfs, "w");
+  if (f)
+  {
+    fputs("1", f);
+    fclose(f);
+  }
+}
+
+
+static int SetupLine(int fd)
+{
+  struct termios tio;
+
+  if (tcgetattr(fd, &tio) < 0)
+    return -1;
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio);
+}
+
+
+static unsigned int Count(gpibConv_t * gc)
+{
+  return gc->tail - gc->head;
+}
+
+
+static gcOp_t * NewOp(int addr, int chunked, gcCallback_t cb, void * ctx)
+{
+  gcOp_t * op = calloc(1, sizeof(gcOp_t));
+
+  if (op)
+  {
+    op->cb = cb;
+    op->ctx = ctx;
+    op->addr = addr;
+    op->chunked = chunked;
+  }
+  return op;
+}
+
+
+static void FinishOp(gcOp_t * op)
+{
+  if (op->cb)
+    op->cb(op->ctx, op->status, op->data, op->len);
+  free(op->data);
+  free(op);
+}
+
+
+static void AppendOp(gcOp_t * op, const unsigned char * data, size_t len)
+{
+  unsigned char * p;
+
+  if (op->len + len > op->size)
+  {
+    p = realloc(op->data, op->len + len + GC_READ_CHUNK);
+    if (!p)
+    {
+      op->status = GC_IOERROR;
+      return;
+    }
+    op->data = p;
+    op->size = op->len + len + GC_READ_CHUNK;
+  }
+  memcpy(op->data + op->len, data, len);
+  op->len += len;
+}
+
+
+/* line without CR, caller checks free slots */
+static void Queue(gpibConv_t * gc, const char * line, size_t len, int reply, gcOp_t * op, int data, int last)
+{
+  gcRequest_t * r = &gc->req[gc->tail % GC_MAX_PENDING];
+
+  memcpy(r->line, line, len);
+  r->line[len++] = '\r';
+  r->len = len;
+  r->reply = reply;
+  r->op = op;
+  r->data = data;
+  r->last = last;
+  gc->tail++;
+}
+
+
+/* as Queue, but line goes before requests not sent yet */
+static void QueueNext(gpibConv_t * gc, const char * line, size_t len, int reply, gcOp_t * op, int data, int last)
+{
+  unsigned int pos = gc->sent + (gc->txOffset?1:0);
+  unsigned int i;
+  gcRequest_t r;
+
+  Queue(gc, line, len, reply, op, data, last);
+  r = gc->req[(gc->tail-1) % GC_MAX_PENDING];
+  for (i = gc->tail-1; i != pos; i--)
+    gc->req[i % GC_MAX_PENDING] = gc->req[(i-1) % GC_MAX_PENDING];
+  gc->req[pos % GC_MAX_PENDING] = r;
+}
+
+
+/* A new message to an instrument clears its output, so nothing else goes
+   to it while a read from it may still continue */
+static int Held(gpibConv_t * gc, gcRequest_t * r)
+{
+  int addr = r->op->addr;
+
+  return (addr >= 0) && (addr <= 30) && gc->reading[addr] && (gc->reading[addr] != r->op);
+}
+
+
+static void FailAll(gpibConv_t * gc)
+{
+  gcRequest_t * r;
+
+  while (Count(gc))
+  {
+    r = &gc->req[gc->head % GC_MAX_PENDING];
+    gc->head++;
+    r->op->status = GC_IOERROR;
+    if (r->last)
+      FinishOp(r->op);
+  }
+  gc->sent = gc->head;
+  gc->txOffset = 0;
+  gc->inFlight = 0;
+  gc->rxLen = 0;
+  gc->partial = 0;
+  memset(gc->reading, 0, sizeof(gc->reading));
+}
+
+
+static int TrySend(gpibConv_t * gc)
+{
+  gcRequest_t * r;
+  ssize_t n;
+
+  while (gc->sent != gc->tail)
+  {
+    r = &gc->req[gc->sent % GC_MAX_PENDING];
+    if ((0 == gc->txOffset) && (gc->inFlight + r->len > GC_RX_WINDOW))
+      break; // converter receive buffer could overflow
+    if ((0 == gc->txOffset) && Held(gc, r))
+      break;
+
+    n = write(gc->fd, r->line + gc->txOffset, r->len - gc->txOffset);
+    if (n < 0)
+      return ((EAGAIN == errno) || (EINTR == errno))?0:GC_IOERROR;
+
+    if (0 == gc->txOffset)
+    {
+      gc->inFlight += r->len;
+      if (r->data && r->op->chunked && (r->op->addr >= 0) && (r->op->addr <= 30))
+        gc->reading[r->op->addr] = r->op;
+    }
+    gc->txOffset += n;
+    if (gc->txOffset < r->len)
+      break;
+
+    gc->txOffset = 0;
+    if (gc->sent == gc->head)
+      gc->lastActivity = NowMs(); // link timeout counts from first request sent
+    gc->sent++;
+  }
+  return 0;
+}
+
+
+static int StatusOfLine(const unsigned char * line, size_t len)
+{
+  if ((2 == len) && !memcmp(line, "OK", 2))
+    return GC_OK;
+  if ((7 == len) && !memcmp(line, "TIMEOUT", 7))
+    return GC_TIMEOUT;
+  return GC_ERROR;
+}
+
+
+/* Returns number of rx bytes taken by reply of r, 0 if not complete yet,
+   F replies come block by block */
+static size_t ParseReply(gpibConv_t * gc, gcRequest_t * r, int * status, const unsigned char ** data, size_t * len)
+{
+  unsigned char * lf;
+  size_t n;
+  int i;
+
+  if (GC_REPLY_BURST == r->reply)
+  {
+    for (i=0, n=1; i<gc->rx[0]; i++, n+=3+gc->rx[n+2])
+    {
+      if (gc->rxLen < n+3)
+        return 0;
+    }
+    if (gc->rxLen < n)
+      return 0;
+    *data = gc->rx+1;
+    *len = n-1;
+    *status = gc->rx[0]?GC_OK:GC_TIMEOUT;
+    return n;
+  }
+
+  if (GC_REPLY_VALUES == r->reply)
+  {
+    // one block at a time, reply is complete with empty block
+    n = 1 + 4*gc->rx[0];
+    if (gc->rxLen < n)
+      return 0;
+    *data = gc->rx+1;
+    *len = n-1;
+    *status = GC_OK;
+    return n;
+  }
+
+  if (GC_REPLY_LISTEN == r->reply)
+  {
+    n = gc->rx[0];
+    if (gc->rxLen < n+2)
+      return 0;
+    *data = gc->rx+1;
+    *len = n+1;
+    *status = GC_OK;
+    return n+2;
+  }
+
+  if (GC_REPLY_BINARY == r->reply)
+  {
+    n = gc->rx[0];
+    if (gc->rxLen < n+1)
+      return 0;
+    *data = gc->rx+1;
+    *len = n;
+    *status = n?GC_OK:GC_TIMEOUT;
+    return n+1;
+  }
+
+  lf = memchr(gc->rx, '\n', gc->rxLen);
+  if (!lf)
+    return 0;
+  n = lf - gc->rx + 1;
+
+  if ((GC_REPLY_DEVICES == r->reply) && (10 == n) && (8 == strspn((char *)gc->rx, "0123456789ABCDEF")))
+  {
+    // one more line per bit of map
+    for (i = __builtin_popcountl(strtoul((char *)gc->rx, NULL, 16)); i; i--)
+    {
+      lf = memchr(gc->rx+n, '\n', gc->rxLen-n);
+      if (!lf)
+        return 0;
+      n = lf - gc->rx + 1;
+    }
+    *data = gc->rx;
+    *len = n;
+    *status = GC_OK;
+    return n;
+  }
+
+  *data = gc->rx;
+  *len = n;
+  if (GC_REPLY_TEXT == r->reply)
+  {
+    *status = ((9 == n) && !memcmp(gc->rx, "TIMEOUT\r\n", 9))?GC_TIMEOUT:GC_OK;
+    return n;
+  }
+
+  *len = ((n >= 2) && ('\r' == gc->rx[n-2]))?n-2:n-1;
+  if (GC_REPLY_STATUS == r->reply)
+    *status = StatusOfLine(gc->rx, *len);
+  else if (((5 == *len) && !memcmp(gc->rx, "ERROR", 5)) || ((13 == *len) && !memcmp(gc->rx, "WRONG COMMAND", 13)))
+    *status = GC_ERROR;
+  else
+    *status = GC_OK;
+  return n;
+}
+
+
+/* SRQ<aa>,<ss>,<n>:<payload> CR LF at start of rx, checked char by char so
+   that a binary reply is not taken for one. Returns 0 if rx starts with
+   something else, else 1 with rx bytes taken in *used (0 while record is
+   not complete). */
+static int ParseSrq(gpibConv_t * gc, size_t * used)
+{
+  size_t i, n;
+  int c, ok;
+
+  *used = 0;
+  if (!gc->srqCb)
+    return 0;
+  for (i=0; i<gc->rxLen; i++)
+  {
+    c = gc->rx[i];
+    if (i < 3)
+      ok = ("SRQ"[i] == c);
+    else if ((5 == i) || (8 == i))
+      ok = (',' == c);
+    else if (i < 8)
+      ok = (i < 5)?isdigit(c):isxdigit(c);
+    else if ((':' == c) && (i > 9))
+      break;
+    else
+      ok = isdigit(c) && (i < 15);
+    if (!ok)
+      return 0;
+  }
+  if (i == gc->rxLen)
+    return 1;
+
+  n = strtoul((char *)gc->rx+9, NULL, 10);
+  if (gc->rxLen < i+1+n+2)
+    return 1;
+  gc->srqCb(gc->srqCtx, (gc->rx[3]-'0')*10 + (gc->rx[4]-'0'), strtoul((char *)gc->rx+6, NULL, 16), gc->rx+i+1, n);
+  *used = i+1+n+2;
+  return 1;
+}
+
+
+static int ParseReplies(gpibConv_t * gc)
+{
+  gcRequest_t * r;
+  gcOp_t * op;
+  const unsigned char * data;
+  size_t len, used;
+  int status;
+  int completed = 0;
+  char line[GC_MAX_LINE];
+
+  while (gc->rxLen)
+  {
+    // SRQ records come only between replies
+    if (!gc->partial && ParseSrq(gc, &used))
+    {
+      if (!used)
+        break;
+      memmove(gc->rx, gc->rx+used, gc->rxLen-used);
+      gc->rxLen -= used;
+      continue;
+    }
+    if (gc->head == gc->sent)
+      break;
+
+    r = &gc->req[gc->head % GC_MAX_PENDING];
+    used = ParseReply(gc, r, &status, &data, &len);
+    if (!used)
+      break;
+
+    op = r->op;
+    if ((GC_REPLY_VALUES == r->reply) && len)
+    {
+      // values are collected in op, not limited by rx buffer
+      AppendOp(op, data, len);
+      memmove(gc->rx, gc->rx+used, gc->rxLen-used);
+      gc->rxLen -= used;
+      gc->partial = 1;
+      continue;
+    }
+    if ((GC_REPLY_VALUES == r->reply) && !op->len)
+      status = GC_TIMEOUT;
+    gc->partial = 0;
+
+    if ((GC_OK != status) && (GC_OK == op->status))
+      op->status = status;
+    if (r->data && ((GC_OK == status) || !op->chunked))
+      AppendOp(op, data, len);
+
+    memmove(gc->rx, gc->rx+used, gc->rxLen-used);
+    gc->rxLen -= used;
+    gc->inFlight -= r->len;
+    gc->head++;
+
+    if (r->data && op->chunked && (GC_OK == status) && (GC_READ_CHUNK == len))
+    {
+      // message longer than converter buffer, read on before anything not
+      // sent yet, addressing is repeated only if other requests have changed
+      // it meanwhile
+      snprintf(line, sizeof(line), "V%02dY", op->addr);
+      QueueNext(gc, line, strlen(line), GC_REPLY_BINARY, op, 1, 1);
+    }
+    else if (r->last)
+    {
+      if (op->chunked && (op->addr >= 0) && (op->addr <= 30) && (gc->reading[op->addr] == op))
+        gc->reading[op->addr] = NULL;
+      FinishOp(op);
+      completed++;
+    }
+  }
+  return completed;
+}
+
+
+int GC_Process(gpibConv_t * gc, int timeoutMs)
+{
+  struct pollfd p;
+  ssize_t n;
+  size_t used;
+  int completed;
+
+  if (TrySend(gc) < 0)
+  {
+    FailAll(gc);
+    return GC_IOERROR;
+  }
+
+  p.fd = gc->fd;
+  p.events = POLLIN | (GC_WantWrite(gc)?POLLOUT:0);
+  p.revents = 0;
+  if ((poll(&p, 1, timeoutMs) < 0) && (EINTR != errno))
+  {
+    FailAll(gc);
+    return GC_IOERROR;
+  }
+
+  if (p.revents & (POLLERR | POLLHUP | POLLNVAL))
+  {
+    FailAll(gc);
+    return GC_IOERROR;
+  }
+
+  if (p.revents & POLLIN)
+  {
+    n = read(gc->fd, gc->rx + gc->rxLen, sizeof(gc->rx) - gc->rxLen);
+    if (n > 0)
+    {
+      gc->rxLen += n;
+      gc->lastActivity = NowMs();
+    }
+  }
+
+  completed = ParseReplies(gc);
+
+  if ((gc->head == gc->sent) && gc->rxLen && !ParseSrq(gc, &used))
+    gc->rxLen = 0; // nothing asked for, e.g. echo or prompt
+
+  if ((gc->head != gc->sent) && (NowMs() - gc->lastActivity > GC_LINK_TIMEOUT_MS))
+  {
+    FailAll(gc);
+    return GC_IOERROR;
+  }
+
+  if (TrySend(gc) < 0)
+  {
+    FailAll(gc);
+    return GC_IOERROR;
+  }
+  return completed;
+}
+
+
+int GC_Fd(gpibConv_t * gc)
+{
+  return gc->fd;
+}
+
+
+int GC_WantWrite(gpibConv_t * gc)
+{
+  gcRequest_t * r;
+
+  if (gc->sent == gc->tail)
+    return 0;
+  r = &gc->req[gc->sent % GC_MAX_PENDING];
+  return gc->txOffset || ((gc->inFlight + r->len <= GC_RX_WINDOW) && !Held(gc, r));
+}
+
+
+int GC_Pending(gpibConv_t * gc)
+{
+  return Count(gc);
+}
+
+
+int GC_OwnAddress(gpibConv_t * gc)
+{
+  return gc->ownAddress;
+}
+
+
+int GC_Submit(gpibConv_t * gc, const char * line, int reply, gcCallback_t cb, void * ctx)
+{
+  size_t len = strlen(line);
+  gcOp_t * op;
+
+  if ((len >= GC_MAX_LINE) || (Count(gc) >= GC_MAX_PENDING) || strpbrk(line, "\r\n\b\x1b"))
+    return GC_ERROR;
+
+  op = NewOp(-1, 0, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  Queue(gc, line, len, reply, op, 1, 1);
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+/* W command can carry data which the line editor of converter passes as it
+   is, other data are sent with explicit addressing and T hex chunks */
+static int FitsLine(const unsigned char * data, size_t len)
+{
+  size_t i;
+
+  if (len > GC_MAX_LINE-4) // W<addr> ... CR
+    return 0;
+  for (i=0; i<len; i++)
+  {
+    if ((0 == data[i]) || (0x08 == data[i]) || ('\n' == data[i]) || ('\r' == data[i]) || (0x1b == data[i]))
+      return 0;
+  }
+  return 1;
+}
+
+
+#define GC_HEX_CHUNK ((GC_MAX_LINE - 5)/2) // T0D<hex>; CR
+
+static int QueueWrite(gpibConv_t * gc, int addr, const unsigned char * data, size_t len, gcOp_t * op, int last)
+{
+  char line[GC_MAX_LINE];
+  unsigned char * msg;
+  size_t i, n, pos;
+  unsigned int need;
+
+  if (FitsLine(data, len))
+  {
+    if (Count(gc) + 1 > GC_MAX_PENDING)
+      return GC_ERROR;
+    line[0] = 'W';
+    line[1] = '0' + addr/10;
+    line[2] = '0' + addr%10;
+    memcpy(line+3, data, len);
+    Queue(gc, line, len+3, GC_REPLY_STATUS, op, 0, last);
+    return GC_OK;
+  }
+
+  // T does not add message end sequence (Q), add it here
+  msg = malloc(len+2);
+  if (!msg)
+    return GC_IOERROR;
+  memcpy(msg, data, len);
+  if ((1 == gc->msgEndSeq) || (3 == gc->msgEndSeq))
+    msg[len++] = '\r';
+  if ((2 == gc->msgEndSeq) || (3 == gc->msgEndSeq))
+    msg[len++] = '\n';
+
+  need = 1 + (len + GC_HEX_CHUNK - 1)/GC_HEX_CHUNK;
+  if ((0 == len) || (Count(gc) + need > GC_MAX_PENDING))
+  {
+    free(msg);
+    return GC_ERROR;
+  }
+
+  line[0] = 'C';
+  line[1] = 0x3F; // UNL
+  line[2] = 0x20 + addr; // listen
+  line[3] = 0x40 + gc->ownAddress; // talk
+  Queue(gc, line, 4, GC_REPLY_STATUS, op, 0, 0);
+
+  for (pos=0; pos<len; pos+=n)
+  {
+    n = (len-pos > GC_HEX_CHUNK)?GC_HEX_CHUNK:len-pos;
+    strcpy(line, "T0D");
+    for (i=0; i<n; i++)
+      sprintf(line+3+2*i, "%02X", msg[pos+i]);
+    if (pos+n < len)
+      strcat(line, ";"); // no EOI
+    Queue(gc, line, strlen(line), GC_REPLY_STATUS, op, 0, last && (pos+n == len));
+  }
+  free(msg);
+  return GC_OK;
+}
+
+
+int GC_WriteAsync(gpibConv_t * gc, int addr, const void * data, size_t len, gcCallback_t cb, void * ctx)
+{
+  gcOp_t * op;
+
+  if ((addr < 0) || (addr > 30) || (addr == gc->ownAddress))
+    return GC_ERROR;
+
+  op = NewOp(addr, 0, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  if (GC_OK != QueueWrite(gc, addr, data, len, op, 1))
+  {
+    free(op);
+    return GC_ERROR;
+  }
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+int GC_ReadAsync(gpibConv_t * gc, int addr, gcCallback_t cb, void * ctx)
+{
+  char line[8];
+  gcOp_t * op;
+
+  if ((addr < 0) || (addr > 30) || (addr == gc->ownAddress) || (Count(gc) >= GC_MAX_PENDING))
+    return GC_ERROR;
+
+  op = NewOp(addr, 1, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  snprintf(line, sizeof(line), "V%02dY", addr);
+  Queue(gc, line, strlen(line), GC_REPLY_BINARY, op, 1, 1);
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+int GC_QueryAsync(gpibConv_t * gc, int addr, const void * data, size_t len, gcCallback_t cb, void * ctx)
+{
+  char line[8];
+  gcOp_t * op;
+
+  if ((addr < 0) || (addr > 30) || (addr == gc->ownAddress) || (Count(gc) + 1 >= GC_MAX_PENDING))
+    return GC_ERROR;
+
+  op = NewOp(addr, 1, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  if (GC_OK != QueueWrite(gc, addr, data, len, op, 0))
+  {
+    free(op);
+    return GC_ERROR;
+  }
+  snprintf(line, sizeof(line), "V%02dY", addr);
+  Queue(gc, line, strlen(line), GC_REPLY_BINARY, op, 1, 1);
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+int GC_ReadValuesAsync(gpibConv_t * gc, int addr, int decimals, gcCallback_t cb, void * ctx)
+{
+  char line[8];
+  gcOp_t * op;
+
+  if ((addr < 0) || (addr > 30) || (addr == gc->ownAddress) || (decimals > 9) || (Count(gc) >= GC_MAX_PENDING))
+    return GC_ERROR;
+
+  op = NewOp(addr, 0, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  if (decimals < 0)
+    snprintf(line, sizeof(line), "F%02d", addr);
+  else
+    snprintf(line, sizeof(line), "F%02d%d", addr, decimals);
+  Queue(gc, line, strlen(line), GC_REPLY_VALUES, op, 1, 1);
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+int GC_DrainAsync(gpibConv_t * gc, gcCallback_t cb, void * ctx)
+{
+  return GC_Submit(gc, "U", GC_REPLY_LISTEN, cb, ctx);
+}
+
+
+int GC_ScanAsync(gpibConv_t * gc, int idn, gcCallback_t cb, void * ctx)
+{
+  return GC_Submit(gc, idn?"A?I":"A?", idn?GC_REPLY_DEVICES:GC_REPLY_LINE, cb, ctx);
+}
+
+
+int GC_BurstAsync(gpibConv_t * gc, int addr, const void * query, size_t len, int count, gcCallback_t cb, void * ctx)
+{
+  char line[GC_MAX_LINE];
+  gcOp_t * op;
+  int n;
+
+  if ((addr < 0) || (addr > 30) || (addr == gc->ownAddress) || (count < 1) || (count > 255) ||
+      (0 == len) || (Count(gc) >= GC_MAX_PENDING))
+    return GC_ERROR;
+
+  n = snprintf(line, sizeof(line), "B%02d%d,", addr, count);
+  if (!FitsLine(query, len) || (n + len > GC_MAX_LINE-1))
+    return GC_ERROR;
+  memcpy(line+n, query, len);
+
+  op = NewOp(addr, 0, cb, ctx);
+  if (!op)
+    return GC_IOERROR;
+  Queue(gc, line, n+len, GC_REPLY_BURST, op, 1, 1);
+  TrySend(gc);
+  return GC_OK;
+}
+
+
+int GC_Flush(gpibConv_t * gc)
+{
+  while (Count(gc))
+  {
+    if (GC_Process(gc, 100) < 0)
+      return GC_IOERROR;
+  }
+  return GC_OK;
+}
+
+
+/* blocking calls */
+
+typedef struct {
+  int done;
+  int status;
+  unsigned char * buf;
+  size_t size;
+  size_t len;
+} gcResult_t;
+
+
+static void ResultCallback(void * ctx, int status, const unsigned char * data, size_t len)
+{
+  gcResult_t * res = ctx;
+
+  res->done = 1;
+  res->status = status;
+  if (res->buf)
+  {
+    res->len = (len > res->size)?res->size:len;
+    memcpy(res->buf, data, res->len);
+  }
+}
+
+
+static int Wait(gpibConv_t * gc, gcResult_t * res, int status)
+{
+  if (GC_OK != status)
+    return status;
+  while (!res->done)
+  {
+    if (GC_Process(gc, 100) < 0)
+      return GC_IOERROR;
+  }
+  return res->status;
+}
+
+
+int GC_Write(gpibConv_t * gc, int addr, const void * data, size_t len)
+{
+  gcResult_t res = {0};
+
+  return Wait(gc, &res, GC_WriteAsync(gc, addr, data, len, ResultCallback, &res));
+}
+
+
+int GC_Read(gpibConv_t * gc, int addr, void * buf, size_t size, size_t * len)
+{
+  gcResult_t res = {0, 0, buf, size, 0};
+  int status = Wait(gc, &res, GC_ReadAsync(gc, addr, ResultCallback, &res));
+
+  *len = res.len;
+  return status;
+}
+
+
+int GC_Query(gpibConv_t * gc, int addr, const void * data, size_t len, void * buf, size_t size, size_t * rlen)
+{
+  gcResult_t res = {0, 0, buf, size, 0};
+  int status = Wait(gc, &res, GC_QueryAsync(gc, addr, data, len, ResultCallback, &res));
+
+  *rlen = res.len;
+  return status;
+}
+
+
+/* values are little endian like on x86/ARM hosts */
+int GC_ReadFloats(gpibConv_t * gc, int addr, float * values, size_t max, size_t * count)
+{
+  gcResult_t res = {0, 0, (unsigned char *)values, max*sizeof(float), 0};
+  int status = Wait(gc, &res, GC_ReadValuesAsync(gc, addr, -1, ResultCallback, &res));
+
+  *count = res.len/sizeof(float);
+  return status;
+}
+
+
+int GC_ReadFixed(gpibConv_t * gc, int addr, int decimals, int32_t * values, size_t max, size_t * count)
+{
+  gcResult_t res = {0, 0, (unsigned char *)values, max*sizeof(int32_t), 0};
+  int status;
+
+  if (decimals < 0)
+    return GC_ERROR;
+  status = Wait(gc, &res, GC_ReadValuesAsync(gc, addr, decimals, ResultCallback, &res));
+  *count = res.len/sizeof(int32_t);
+  return status;
+}
+
+
+int GC_Drain(gpibConv_t * gc, void * buf, size_t size, size_t * len, int * flags)
+{
+  unsigned char reply[GC_READ_CHUNK+1];
+  gcResult_t res = {0, 0, reply, sizeof(reply), 0};
+  int status = Wait(gc, &res, GC_DrainAsync(gc, ResultCallback, &res));
+
+  *flags = res.len?reply[0]:0;
+  *len = res.len?res.len-1:0;
+  if (*len > size)
+    *len = size;
+  memcpy(buf, reply+1, *len);
+  return status;
+}
+
+
+int GC_Scan(gpibConv_t * gc, uint32_t * map, char * idn, size_t size)
+{
+  char reply[10 + 31*(GC_IDN_MAX+5) + 1];
+  gcResult_t res = {0, 0, (unsigned char *)reply, sizeof(reply)-1, 0};
+  int status = Wait(gc, &res, GC_ScanAsync(gc, idn != NULL, ResultCallback, &res));
+  char * p = reply;
+  char * q;
+  size_t n, len = 0;
+
+  reply[res.len] = 0;
+  *map = (GC_OK == status)?strtoul(reply, &p, 16):0;
+  for (p += strspn(p, "\r\n"); idn && *p && (len+1 < size); p = q + strspn(q, "\r\n"))
+  {
+    q = p + strcspn(p, "\r\n");
+    n = (q-p < (ptrdiff_t)(size-len-2))?(size_t)(q-p):size-len-2;
+    memcpy(idn+len, p, n);
+    len += n;
+    idn[len++] = '\n';
+  }
+  if (idn && size)
+    idn[len] = 0;
+  return status;
+}
+
+
+/* records may come right after S1 reply and until S0 reply */
+int GC_SrqEvents(gpibConv_t * gc, gcSrqCallback_t cb, void * ctx)
+{
+  gcResult_t res = {0};
+  int status;
+
+  if (cb)
+  {
+    gc->srqCb = cb;
+    gc->srqCtx = ctx;
+  }
+  status = Wait(gc, &res, GC_Submit(gc, cb?"S1":"S0", GC_REPLY_STATUS, ResultCallback, &res));
+  if (!cb || (GC_OK != status))
+    gc->srqCb = NULL;
+  return status;
+}
+
+
+int GC_Burst(gpibConv_t * gc, int addr, const void * query, size_t len, int count, void * buf, size_t size, size_t * rlen)
+{
+  gcResult_t res = {0, 0, buf, size, 0};
+  int status = Wait(gc, &res, GC_BurstAsync(gc, addr, query, len, count, ResultCallback, &res));
+
+  *rlen = res.len;
+  return status;
+}
+
+
+/* converter command with single line reply, reply is NUL terminated */
+int GC_Command(gpibConv_t * gc, const char * line, char * reply, size_t size)
+{
+  gcResult_t res = {0, 0, (unsigned char *)reply, size-1, 0};
+  int status = Wait(gc, &res, GC_Submit(gc, line, GC_REPLY_LINE, ResultCallback, &res));
+
+  reply[res.len] = 0;
+  return status;
+}
+
+
+/* Opens serial port in raw 115200 8N1 mode with low latency, for tools
+   using the converter data stream directly (printer mode capture) */
+int GC_OpenLine(const char * device)
+{
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd < 0)
+    return -1;
+  if (SetupLine(fd) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  SetLowLatency(fd, device);
+  return fd;
+}
+
+
+gpibConv_t * GC_Open(const char * device)
+{
+  gpibConv_t * gc;
+  char reply[GC_MAX_LINE];
+
+  gc = calloc(1, sizeof(gpibConv_t));
+  if (!gc)
+    return NULL;
+
+  gc->fd = GC_OpenLine(device);
+  if (gc->fd < 0)
+  {
+    free(gc);
+    return NULL;
+  }
+
+  // ESC leaves printer mode, otherwise it takes the next byte as escape
+  // sequence, so one CR is spare. Echo off for machine readable replies.
+  if (write(gc->fd, "\x1b\r\rE0\r", 6) != 6)
+  {
+    GC_Close(gc);
+    return NULL;
+  }
+  usleep(200000);
+  tcflush(gc->fd, TCIFLUSH);
+
+  if (GC_OK != GC_Command(gc, "A", reply, sizeof(reply)))
+  {
+    GC_Close(gc);
+    errno = EIO;
+    return NULL;
+  }
+  gc->ownAddress = atoi(reply);
+
+  if (GC_OK != GC_Command(gc, "Q", reply, sizeof(reply)))
+  {
+    GC_Close(gc);
+    errno = EIO;
+    return NULL;
+  }
+  gc->msgEndSeq = atoi(reply);
+
+  return gc;
+}
+
+
+void GC_Close(gpibConv_t * gc)
+{
+  FailAll(gc);
+  close(gc->fd);
+  free(gc);
+}
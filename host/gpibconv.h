@@ -0,0 +1,123 @@
+#ifndef GPIBCONV_HEADER
+#define GPIBCONV_HEADER
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Host side driver for GPIB to USB converter (see sw/main.c for the command
+   set). Requests are written to the converter without waiting for replies
+   to previous ones, as long as they fit into the converter receive buffer.
+   Replies are parsed incrementally and requests complete in order, except
+   device reads longer than GC_READ_CHUNK, which may finish after requests
+   to other instruments sent in the meantime. Their next chunk is read
+   before anything not sent yet, and requests to the same instrument wait
+   until the read is complete, as a new message clears instrument output.
+
+   Asynchronous calls take a callback which is called from GC_Process().
+   Blocking calls run GC_Process() until their request completes. The
+   descriptor returned by GC_Fd() may be used in poll()/epoll, writability
+   is only needed while GC_WantWrite() is true. */
+
+#define GC_OK 0
+#define GC_TIMEOUT 1    // converter reported TIMEOUT
+#define GC_ERROR 2      // converter reported ERROR or WRONG COMMAND
+#define GC_IOERROR -1   // serial link failure, converter not responding
+
+/* reply formats of converter commands */
+#define GC_REPLY_STATUS 1 // OK/TIMEOUT/ERROR line
+#define GC_REPLY_LINE 2   // text line, e.g. A, Q, S, Z
+#define GC_REPLY_BINARY 3 // <length><payload>, Y
+#define GC_REPLY_TEXT 4   // X payload up to LF or TIMEOUT line
+#define GC_REPLY_BURST 5  // <n> then n records <dt><length><payload>, B
+#define GC_REPLY_VALUES 6 // blocks <n><n 4 byte values> until n=0, F
+#define GC_REPLY_LISTEN 7 // <length><flags><payload>, U
+#define GC_REPLY_DEVICES 8 // map line, then <aa>:<reply> line per instrument, A?I
+
+#define GC_MAX_LINE 64     // converter command line, CR included
+#define GC_RX_WINDOW 64    // converter receive buffer, UART_RX_BUF_SIZE in sw/usart.h
+#define GC_READ_CHUNK 255  // largest Y reply, GPIB_BLOCK_MAX in sw/main.c
+#define GC_MAX_PENDING 256
+#define GC_LINK_TIMEOUT_MS 5000 // converter silent while requests pending
+
+typedef struct gpibConv gpibConv_t;
+
+/* status is GC_OK, GC_TIMEOUT, GC_ERROR or GC_IOERROR, data are valid only
+   during the call */
+typedef void (*gcCallback_t)(void * ctx, int status, const unsigned char * data, size_t len);
+
+gpibConv_t * GC_Open(const char * device);
+int GC_OpenLine(const char * device);
+void GC_Close(gpibConv_t * gc);
+
+int GC_Fd(gpibConv_t * gc);
+int GC_WantWrite(gpibConv_t * gc);
+int GC_Pending(gpibConv_t * gc);
+int GC_OwnAddress(gpibConv_t * gc);
+
+/* any converter command line (without CR) */
+int GC_Submit(gpibConv_t * gc, const char * line, int reply, gcCallback_t cb, void * ctx);
+
+/* device addressed transfers, addressing bytes are sent by converter only
+   when the bus is not addressed this way already */
+int GC_WriteAsync(gpibConv_t * gc, int addr, const void * data, size_t len, gcCallback_t cb, void * ctx);
+int GC_ReadAsync(gpibConv_t * gc, int addr, gcCallback_t cb, void * ctx);
+int GC_QueryAsync(gpibConv_t * gc, int addr, const void * data, size_t len, gcCallback_t cb, void * ctx);
+
+/* Query repeated count (1..255) times by converter, replies are collected in
+   converter RAM (about 1 KB) and come in one transfer. Callback data are
+   records <dt low><dt high><length><reply>, dt is time since previous
+   query in GC_BURST_TICK_US units, modulo 65536. Query must fit into a
+   converter command line, burst must end within GC_LINK_TIMEOUT_MS. */
+#define GC_BURST_TICK_US (2.0/3.0) // GPIB_TIMER_HZ in sw/gpib.h
+int GC_BurstAsync(gpibConv_t * gc, int addr, const void * query, size_t len, int count, gcCallback_t cb, void * ctx);
+
+/* Numeric reply converted by converter to 4 byte little endian values, IEEE
+   754 floats (decimals < 0) or 32 bit integers of value*10^decimals (0..9).
+   Callback data are the values. */
+#define GC_VALUE_INVALID ((int32_t)0x80000000) // integer of numeric token without digits
+int GC_ReadValuesAsync(gpibConv_t * gc, int addr, int decimals, gcCallback_t cb, void * ctx);
+
+/* Data captured by converter in background while it is addressed as
+   listener, returns at once with what has arrived (up to 255 bytes, never
+   past end of message). Callback data are <flags><payload>. */
+#define GC_LISTEN_EOI 0x01  // payload ends with byte sent with EOI
+#define GC_LISTEN_MORE 0x02 // more data are waiting
+int GC_DrainAsync(gpibConv_t * gc, gcCallback_t cb, void * ctx);
+
+/* Instruments on bus, found by converter from handshake lines in a few ms
+   (A?), bit n of map for address n. With idn each one is also asked for
+   *IDN? (A?I), about 30 ms more for instruments which don't answer.
+   Callback data are map line (8 hex digits) followed by a line
+   <aa>:<reply> per instrument, lines end with CR LF. */
+#define GC_IDN_MAX 72 // IDN_MAX in sw/main.c
+int GC_ScanAsync(gpibConv_t * gc, int idn, gcCallback_t cb, void * ctx);
+
+/* SRQ event mode (S1/S0). Converter finds requester by serial poll, reads
+   its message until EOI and pushes it between replies as
+   SRQ<aa>,<ss>,<n>:<payload> CR LF, which is passed to cb from GC_Process()
+   with the serial poll status byte. Requests may go on meanwhile, only the
+   instruments found when event mode is enabled are polled. Blocking call,
+   cb NULL disables event mode. */
+typedef void (*gcSrqCallback_t)(void * ctx, int addr, int status, const unsigned char * data, size_t len);
+int GC_SrqEvents(gpibConv_t * gc, gcSrqCallback_t cb, void * ctx);
+
+/* Sends and receives what is possible, waiting at most timeoutMs for link
+   activity (0 - don't wait, -1 - forever). Returns number of completed
+   requests or GC_IOERROR. */
+int GC_Process(gpibConv_t * gc, int timeoutMs);
+
+/* waits until all pending requests are completed */
+int GC_Flush(gpibConv_t * gc);
+
+int GC_Write(gpibConv_t * gc, int addr, const void * data, size_t len);
+int GC_Read(gpibConv_t * gc, int addr, void * buf, size_t size, size_t * len);
+int GC_Query(gpibConv_t * gc, int addr, const void * data, size_t len, void * buf, size_t size, size_t * rlen);
+int GC_ReadFloats(gpibConv_t * gc, int addr, float * values, size_t max, size_t * count);
+int GC_ReadFixed(gpibConv_t * gc, int addr, int decimals, int32_t * values, size_t max, size_t * count);
+int GC_Drain(gpibConv_t * gc, void * buf, size_t size, size_t * len, int * flags);
+/* idn NULL for map only, else gets "<aa>:<reply>\n" lines, NUL terminated */
+int GC_Scan(gpibConv_t * gc, uint32_t * map, char * idn, size_t size);
+int GC_Burst(gpibConv_t * gc, int addr, const void * query, size_t len, int count, void * buf, size_t size, size_t * rlen);
+int GC_Command(gpibConv_t * gc, const char * line, char * reply, size_t size);
+
+#endif
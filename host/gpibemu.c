@@ -0,0 +1,775 @@
+/* Converter emulator on a pseudo terminal, for testing host tools without
+   hardware. Follows the command set of sw/main.c (line editor, echo, OK/
+   TIMEOUT/ERROR replies, bus addressing) with simple instruments on all
+   addresses: a message ending with '?' makes the instrument talk,
+   "*IDN?" returns identification, "LONG?" a 300 byte reply, "TRACE?" 32
+   comma separated readings and anything else a reading. A? finds all of
+   them. Macros (@) are kept in RAM.
+
+   usage: gpibemu [-l link] [-s]
+     -l  create symlink to pty slave, e.g. /tmp/ttyGPIB
+     -s  limit output to 115200 baud */
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define BUF_SIZE 64
+#define GPIB_BUF_SIZE 1024 // largest pool run, POOL_SIZE in sw/pool.h
+#define GPIB_BLOCK_MAX 255
+#define MAX_DEVICES 31
+#define DEV_OUT_SIZE 512
+#define MACRO_COUNT 8 // sw/macro.h
+#define MACRO_SIZE 112
+
+typedef struct {
+  unsigned char in[DEV_OUT_SIZE];
+  int inLen;
+  unsigned char out[DEV_OUT_SIZE];
+  int outLen;
+  int outPos;
+  unsigned int readings;
+} emuDevice_t;
+
+static emuDevice_t devices[MAX_DEVICES];
+static int talker = -1;
+static unsigned long listeners = 0;
+static int listenAddress = 21;
+static int msgEndSeq = 0;
+static int localEcho = 1;
+static int remoteState = 0;
+static int throttle = 0;
+static unsigned int recoveries = 0;
+static char macros[MACRO_COUNT][MACRO_SIZE]; // steps NUL terminated, empty one ends
+static int fd;
+
+
+static void Out(const void * data, size_t len)
+{
+  const unsigned char * p = data;
+  ssize_t n;
+
+  while (len)
+  {
+    n = write(fd, p, throttle?1:len);
+    if (n <= 0)
+      return;
+    if (throttle)
+      usleep(87); // 10 bits at 115200 baud
+    p += n;
+    len -= n;
+  }
+}
+
+
+static void OutStr(const char * s)
+{
+  Out(s, strlen(s));
+}
+
+
+static void DeviceMessage(int addr)
+{
+  emuDevice_t * d = &devices[addr];
+  int len = d->inLen;
+  int i;
+
+  while (len && ((d->in[len-1] == '\r') || (d->in[len-1] == '\n')))
+    len--;
+  d->inLen = 0;
+  if ((0 == len) || (d->in[len-1] != '?'))
+    return;
+
+  if ((5 == len) && !memcmp(d->in, "*IDN?", 5))
+    d->outLen = sprintf((char *)d->out, "GPIBEMU,MODEL%02d,0,1.0\n", addr);
+  else if ((5 == len) && !memcmp(d->in, "LONG?", 5))
+  {
+    for (i=0; i<299; i++)
+      d->out[i] = 'A' + i%26;
+    d->out[i++] = '\n';
+    d->outLen = i;
+  }
+  else if ((6 == len) && !memcmp(d->in, "TRACE?", 6))
+  {
+    for (i=0, len=0; i<32; i++)
+      len += sprintf((char *)d->out+len, "%+.5E%c", (i-16)*0.125 + d->readings++*1e-3, (i < 31)?',':'\n');
+    d->outLen = len;
+  }
+  else
+  {
+    d->readings++;
+    d->outLen = sprintf((char *)d->out, "+%u.%06uE-03\n", d->readings/1000, d->readings%1000);
+  }
+  d->outPos = 0;
+}
+
+
+static int Transmit(const unsigned char * data, int len, int eoi)
+{
+  int addr, i;
+  int any = 0;
+
+  for (addr=0; addr<MAX_DEVICES; addr++)
+  {
+    if ((addr == listenAddress) || !(listeners & (1UL << addr)))
+      continue;
+    any = 1;
+    for (i=0; (i<len) && (devices[addr].inLen < DEV_OUT_SIZE); i++)
+      devices[addr].in[devices[addr].inLen++] = data[i];
+    if (eoi)
+      DeviceMessage(addr);
+  }
+  return any && len;
+}
+
+
+static void Command(const unsigned char * data, int len)
+{
+  int i;
+  unsigned char c;
+
+  for (i=0; i<len; i++)
+  {
+    c = data[i] & 0x7F;
+    if (0x3F == c)
+      listeners = 0;
+    else if ((c >= 0x20) && (c < 0x3F))
+      listeners |= 1UL << (c & 0x1F);
+    else if (0x5F == c)
+      talker = -1;
+    else if ((c >= 0x40) && (c < 0x5F))
+    {
+      talker = c & 0x1F;
+      listeners &= ~(1UL << talker);
+    }
+  }
+}
+
+
+/* receives until EOI, at most max bytes like GPIB_Receive_till_eoi */
+static int Receive(unsigned char * buf, int max)
+{
+  emuDevice_t * d;
+  int n = 0;
+
+  if ((talker < 0) || (talker == listenAddress) || !(listeners & (1UL << listenAddress)))
+    return 0;
+  d = &devices[talker];
+  while ((d->outPos < d->outLen) && (n < max))
+    buf[n++] = d->out[d->outPos++];
+  if (d->outPos == d->outLen)
+    d->outLen = d->outPos = 0;
+  return n;
+}
+
+
+/* Z6/Z8 payload, see sw/encode.h */
+static void OutEncoded(int format, const unsigned char * buf, int len)
+{
+  static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  static const char base85[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+  int group = ('6' == format)?3:4;
+  char text[8];
+  uint32_t v;
+  int i, j, n;
+
+  for (i=0; i<len; i+=group)
+  {
+    n = (len-i < group)?len-i:group;
+    for (j=0, v=0; j<group; j++)
+      v = (v << 8) | ((j < n)?buf[i+j]:0);
+    if ('6' == format)
+    {
+      for (j=0; j<4; j++)
+        text[j] = (j <= n)?base64[(v >> (18-6*j)) & 0x3F]:'=';
+      Out((unsigned char *)text, 4);
+    }
+    else
+    {
+      for (j=4; j>=0; j--, v/=85)
+        text[j] = base85[v % 85];
+      Out((unsigned char *)text, n+1);
+    }
+  }
+}
+
+
+static void SendReceived(int format, const unsigned char * buf, int len)
+{
+  char hex[4];
+  unsigned char l = len;
+  int i;
+
+  if ('Y' == format)
+  {
+    Out(&l, 1);
+    Out(buf, len);
+  }
+  else if ('Z' == format)
+  {
+    sprintf(hex, "%02x", len);
+    OutStr(hex);
+    for (i=0; i<len; i++)
+    {
+      sprintf(hex, "%02x", buf[i]);
+      OutStr(hex);
+    }
+    OutStr("\r\n");
+  }
+  else if (('6' == format) || ('8' == format))
+  {
+    sprintf(hex, "%02x", len);
+    OutStr(hex);
+    OutEncoded(format, buf, len);
+    OutStr("\r\n");
+  }
+  else if (len)
+    Out(buf, len);
+  else
+    OutStr("TIMEOUT\r\n");
+}
+
+
+/* B reply, samples are 100 us apart */
+static void Burst(int addr, const unsigned char * query, int len, int count)
+{
+  unsigned char data[GPIB_BUF_SIZE];
+  int pos = 0;
+  int n = 0;
+  unsigned char samples;
+  int rx = 0;
+  int max = 1;
+
+  while ((n < count) && (pos+4 <= GPIB_BUF_SIZE) && (rx < max))
+  {
+    listeners = 1UL << addr;
+    talker = listenAddress;
+    Transmit(query, len, 1);
+    listeners = 1UL << listenAddress;
+    talker = addr;
+    max = (GPIB_BUF_SIZE-pos-3 > GPIB_BLOCK_MAX)?GPIB_BLOCK_MAX:GPIB_BUF_SIZE-pos-3;
+    rx = Receive(data+pos+3, max);
+    if (0 == rx)
+      break;
+    data[pos] = n?150:0;
+    data[pos+1] = 0;
+    data[pos+2] = rx;
+    pos += 3+rx;
+    n++;
+  }
+  samples = n;
+  Out(&samples, 1);
+  Out(data, pos);
+}
+
+
+/* F reply, tokens converted with strtod, see sw/num.h */
+static void Numbers(const unsigned char * text, int len, int decimals)
+{
+  unsigned char block[1+4*15];
+  char token[64];
+  double v, scale = 1;
+  long long fixed;
+  uint32_t u;
+  float f;
+  int i = 0, n;
+
+  for (n=0; n<decimals; n++)
+    scale *= 10;
+  block[0] = 0;
+  while (i < len)
+  {
+    while ((i < len) && (strchr(" \t\r\n,;", text[i])))
+      i++;
+    for (n=0; (i < len) && !strchr(" \t\r\n,;", text[i]); i++)
+      if (n < (int)sizeof(token)-1)
+        token[n++] = text[i];
+    token[n] = 0;
+    if (!n || !strchr("+-.0123456789", token[0]))
+      continue;
+    v = strtod(token, NULL);
+    if (!strpbrk(token, "0123456789"))
+      v = NAN;
+    if (decimals < 0)
+    {
+      f = v;
+      memcpy(&u, &f, 4);
+    }
+    else
+    {
+      fixed = isnan(v)?INT32_MIN:llround(v*scale);
+      fixed = (fixed > INT32_MAX)?INT32_MAX:(fixed < -INT32_MAX)?-INT32_MAX:fixed;
+      u = isnan(v)?0x80000000UL:(uint32_t)fixed;
+    }
+    for (n=0; n<4; n++)
+      block[1+4*block[0]+n] = u >> (8*n);
+    if (15 == ++block[0])
+    {
+      Out(block, sizeof(block));
+      block[0] = 0;
+    }
+  }
+  if (block[0])
+    Out(block, 1+4*block[0]);
+  block[0] = 0;
+  Out(block, 1);
+}
+
+
+static void OutFloat(float f)
+{
+  unsigned char b[4];
+  uint32_t u;
+  int i;
+
+  memcpy(&u, &f, 4);
+  for (i=0; i<4; i++)
+    b[i] = u >> (8*i);
+  Out(b, 4);
+}
+
+
+static void AggregateRecord(int flags, int count, int failed, float mean, float min, float max)
+{
+  unsigned char head[5] = {flags, count, count >> 8, failed, failed >> 8};
+
+  Out(head, sizeof(head));
+  OutFloat(count?mean:NAN);
+  OutFloat(count?min:NAN);
+  OutFloat(count?max:NAN);
+}
+
+
+/* J, polls until ESC, first number of each reply is summarized */
+static void Aggregate(int addr, const unsigned char * query, int len, int window, int ms)
+{
+  unsigned char data[GPIB_BUF_SIZE];
+  struct pollfd p = {fd, POLLIN, 0};
+  float x, mean = 0, min = 0, max = 0;
+  int count = 0, failed = 0;
+  unsigned char c;
+  char * end;
+  int n;
+
+  while (1)
+  {
+    if (poll(&p, 1, ms) > 0)
+    {
+      if ((read(fd, &c, 1) == 1) && (0x1b == c))
+        break;
+      continue; // other input is dropped like on converter
+    }
+
+    listeners = 1UL << addr;
+    talker = listenAddress;
+    Transmit(query, len, 1);
+    listeners = 1UL << listenAddress;
+    talker = addr;
+    n = Receive(data, GPIB_BUF_SIZE-1);
+    data[n] = 0;
+    x = strtod((char *)data + strspn((char *)data, " \t\r\n,;"), &end);
+    if (!n || ((unsigned char *)end == data))
+      failed++;
+    else if (!count++)
+      mean = min = max = x;
+    else
+    {
+      mean += (x - mean)/count;
+      min = (x < min)?x:min;
+      max = (x > max)?x:max;
+    }
+    if (count + failed >= window)
+    {
+      AggregateRecord(0, count, failed, mean, min, max);
+      count = failed = 0;
+    }
+  }
+  AggregateRecord(1, count, failed, mean, min, max);
+}
+
+
+static int AppendEndSeq(unsigned char * buf, int len)
+{
+  if ((1 == msgEndSeq) || (3 == msgEndSeq))
+    buf[len++] = '\r';
+  if ((2 == msgEndSeq) || (3 == msgEndSeq))
+    buf[len++] = '\n';
+  return len;
+}
+
+
+static int ParseAddress(const unsigned char * s)
+{
+  int addr;
+
+  if (!isdigit(s[0]) || !isdigit(s[1]))
+    return -1;
+  addr = (s[0]-'0')*10 + (s[1]-'0');
+  return ((addr <= 30) && (addr != listenAddress))?addr:-1;
+}
+
+
+static int Hex(unsigned char c)
+{
+  c = toupper(c);
+  return isdigit(c)?c-'0':((c >= 'A') && (c <= 'F'))?c-'A'+10:-1;
+}
+
+
+static void Execute(unsigned char * buf, int len);
+
+
+/* @ command, macros in RAM instead of EEPROM */
+static void Macro(unsigned char * buf, int len)
+{
+  unsigned char step[BUF_SIZE+4];
+  int n = (len >= 2)?buf[1]-'0':-1;
+  int c = (len >= 3)?buf[2]:0;
+  int pos = 0;
+
+  if ((n < 0) || (n >= MACRO_COUNT))
+    OutStr("ERROR\r\n");
+  else if ((2 == len) && macros[n][0])
+  {
+    for (pos=0; macros[n][pos]; pos += strlen(macros[n]+pos)+1)
+    {
+      strcpy((char *)step, macros[n]+pos);
+      if (localEcho)
+      {
+        OutStr((char *)step);
+        OutStr("\r\n");
+      }
+      Execute(step, strlen((char *)step));
+    }
+  }
+  else if (('+' == c) && (len > 3) && ('@' != buf[3]))
+  {
+    while (macros[n][pos])
+      pos += strlen(macros[n]+pos)+1;
+    if (pos + len-3 + 2 > MACRO_SIZE)
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    memcpy(macros[n]+pos, buf+3, len-3);
+    macros[n][pos+len-3] = 0;
+    macros[n][pos+len-2] = 0;
+    OutStr("OK\r\n");
+  }
+  else if (('-' == c) && (3 == len))
+  {
+    macros[n][0] = 0;
+    OutStr("OK\r\n");
+  }
+  else if (('?' == c) && (3 == len))
+  {
+    for (pos=0; macros[n][pos]; pos += strlen(macros[n]+pos)+1)
+    {
+      OutStr(macros[n]+pos);
+      OutStr("\r\n");
+    }
+  }
+  else
+    OutStr("ERROR\r\n");
+}
+
+
+static void Execute(unsigned char * buf, int len)
+{
+  unsigned char data[GPIB_BUF_SIZE];
+  unsigned char command = toupper(buf[0]);
+  char reply[48];
+  int addr, n, i, eoi, format, ms;
+
+  if (('D' == command) || ('M' == command))
+  {
+    n = AppendEndSeq(buf, len);
+    OutStr(Transmit(buf+1, n-1, 'D' == command)?"OK\r\n":"TIMEOUT\r\n");
+  }
+  else if ('C' == command)
+  {
+    n = AppendEndSeq(buf, len);
+    Command(buf+1, n-1);
+    OutStr("OK\r\n");
+  }
+  else if ('T' == command)
+  {
+    eoi = !((len > 3) && (';' == buf[len-1]));
+    n = eoi?len:len-1;
+    if ((n < 5) || !(n & 1) || ('0' != buf[1]) || (('C' != toupper(buf[2])) && ('D' != toupper(buf[2]))))
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    for (i=3; i<n; i+=2)
+    {
+      if ((Hex(buf[i]) < 0) || (Hex(buf[i+1]) < 0))
+      {
+        OutStr("ERROR\r\n");
+        return;
+      }
+      data[(i-3)/2] = Hex(buf[i])*16 + Hex(buf[i+1]);
+    }
+    if ('C' == toupper(buf[2]))
+    {
+      Command(data, (n-3)/2);
+      OutStr("OK\r\n");
+    }
+    else
+      OutStr(Transmit(data, (n-3)/2, eoi)?"OK\r\n":"TIMEOUT\r\n");
+  }
+  else if ('W' == command)
+  {
+    addr = (len >= 3)?ParseAddress(buf+1):-1;
+    n = (addr >= 0)?AppendEndSeq(buf, len):0;
+    if (n > 3)
+    {
+      listeners = 1UL << addr;
+      talker = listenAddress;
+      OutStr(Transmit(buf+3, n-3, 1)?"OK\r\n":"TIMEOUT\r\n");
+    }
+    else
+      OutStr("ERROR\r\n");
+  }
+  else if ('V' == command)
+  {
+    addr = ((len >= 3) && (len <= 5))?ParseAddress(buf+1):-1;
+    format = (len >= 4)?toupper(buf[3]):'X';
+    if ((4 == len) && ('X' != format) && ('Y' != format) && ('Z' != format))
+      format = 0;
+    else if ((5 == len) && ('Z' == format) && (('6' == buf[4]) || ('8' == buf[4])))
+      format = buf[4];
+    else if (len >= 5)
+      format = 0;
+    if (!format)
+      OutStr("WRONG COMMAND\r\n");
+    else if (addr >= 0)
+    {
+      listeners = 1UL << listenAddress;
+      talker = addr;
+      n = Receive(data, ('X' == format)?GPIB_BUF_SIZE-1:GPIB_BLOCK_MAX);
+      SendReceived(format, data, n);
+    }
+    else
+      OutStr("ERROR\r\n");
+  }
+  else if ('B' == command)
+  {
+    addr = (len >= 3)?ParseAddress(buf+1):-1;
+    for (i=3, n=0; (i < len) && isdigit(buf[i]); i++)
+      n = n*10 + buf[i]-'0';
+    if ((addr < 0) || (n < 1) || (n > 255) || (i+1 >= len) || (',' != buf[i]))
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    Burst(addr, buf+i+1, AppendEndSeq(buf, len)-i-1, n);
+  }
+  else if ('U' == command) // instruments talk at once, capture is their output buffer
+  {
+    n = (1 == len)?Receive(data+2, GPIB_BLOCK_MAX):-1;
+    if (n < 0)
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    data[0] = n;
+    data[1] = 0;
+    if ((talker >= 0) && n)
+      data[1] = devices[talker].outLen?0x02:0x01; // more or EOI
+    Out(data, n+2);
+  }
+  else if ('J' == command)
+  {
+    addr = (len >= 3)?ParseAddress(buf+1):-1;
+    for (i=3, n=0; (i < len) && isdigit(buf[i]) && (n <= 65535); i++)
+      n = n*10 + buf[i]-'0';
+    ms = 0;
+    if ((i < len) && ('/' == buf[i]))
+      for (i++; (i < len) && isdigit(buf[i]) && (ms <= 715000); i++)
+        ms = ms*10 + buf[i]-'0';
+    if ((addr < 0) || (n < 1) || (n > 65535) || (ms > 715000) || (i+1 >= len) || (',' != buf[i]))
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    Aggregate(addr, buf+i+1, AppendEndSeq(buf, len)-i-1, n, ms);
+  }
+  else if ('F' == command)
+  {
+    addr = ((3 == len) || (4 == len))?ParseAddress(buf+1):-1;
+    if ((addr < 0) || ((4 == len) && !isdigit(buf[3])))
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    listeners = 1UL << listenAddress;
+    talker = addr;
+    n = Receive(data, GPIB_BUF_SIZE-1);
+    Numbers(data, n, (4 == len)?buf[3]-'0':-1);
+  }
+  else if (('X' == command) || ('Y' == command) || ('Z' == command))
+  {
+    if (('Z' == command) && (2 == len) && (('6' == buf[1]) || ('8' == buf[1])))
+      command = buf[1];
+    n = Receive(data, ('X' == command)?GPIB_BUF_SIZE-1:GPIB_BLOCK_MAX);
+    SendReceived(command, data, n);
+  }
+  else if (('R' == command) || ('L' == command))
+  {
+    remoteState = ('R' == command);
+    OutStr("OK\r\n");
+  }
+  else if ('I' == command)
+  {
+    talker = -1;
+    listeners = 0;
+    OutStr("OK\r\n");
+  }
+  else if ('S' == command) // instruments never request service, S1/S0 only switch
+  {
+    if (1 == len)
+      sprintf(reply, "%d0%d\r\n", remoteState, (listeners & (1UL << listenAddress))?1:0);
+    else
+      strcpy(reply, ((2 == len) && (('0' == buf[1]) || ('1' == buf[1])))?"OK\r\n":"ERROR\r\n");
+    OutStr(reply);
+  }
+  else if ('@' == command)
+    Macro(buf, len);
+  else if ('!' == command) // instruments never stall, IFC is all recovery does
+  {
+    if ((2 == len) && ('R' == toupper(buf[1])))
+    {
+      talker = -1;
+      listeners = 0;
+      recoveries++;
+      sprintf(reply, "5,00,3,1,%u\r\n", recoveries);
+    }
+    else if (1 == len)
+      sprintf(reply, recoveries?"5,00,3,1,%u\r\n":"0,00,0,0,0\r\n", recoveries);
+    else
+      strcpy(reply, ((2 == len) && (('0' == buf[1]) || ('1' == buf[1])))?"OK\r\n":"ERROR\r\n");
+    OutStr(reply);
+  }
+  else if (('A' == command) && (len >= 2) && ('?' == buf[1]))
+  {
+    if ((len > 3) || ((3 == len) && ('I' != toupper(buf[2]))))
+    {
+      OutStr("ERROR\r\n");
+      return;
+    }
+    sprintf(reply, "%08lX\r\n", 0x7FFFFFFFUL & ~(1UL << listenAddress));
+    OutStr(reply);
+    for (addr=0; (3 == len) && (addr<MAX_DEVICES); addr++)
+    {
+      if (addr == listenAddress)
+        continue;
+      sprintf(reply, "%02d:GPIBEMU,MODEL%02d,0,1.0\r\n", addr, addr);
+      OutStr(reply);
+    }
+  }
+  else if (('E' == command) || ('Q' == command) || ('A' == command))
+  {
+    int * value = ('E' == command)?&localEcho:('Q' == command)?&msgEndSeq:&listenAddress;
+    int max = ('E' == command)?1:('Q' == command)?3:30;
+
+    if (1 == len)
+    {
+      sprintf(reply, ('A' == command)?"%02d\r\n":"%d\r\n", *value);
+      OutStr(reply);
+    }
+    else if ((len == (('A' == command)?3:2)) && isdigit(buf[1]) && (atoi((char *)buf+1) <= max))
+    {
+      *value = atoi((char *)buf+1);
+      OutStr("OK\r\n");
+    }
+    else
+      OutStr("ERROR\r\n");
+  }
+  else
+    OutStr("WRONG COMMAND\r\n");
+}
+
+
+int main(int argc, char * argv[])
+{
+  unsigned char buf[BUF_SIZE+4];
+  unsigned char c;
+  const char * link = NULL;
+  int bufPos = 0;
+  int slave;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "l:s")) != -1)
+  {
+    if ('l' == opt)
+      link = optarg;
+    else if ('s' == opt)
+      throttle = 1;
+    else
+    {
+      fprintf(stderr, "usage: %s [-l link] [-s]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if ((fd < 0) || grantpt(fd) || unlockpt(fd))
+  {
+    perror("pty");
+    return 1;
+  }
+  slave = open(ptsname(fd), O_RDWR | O_NOCTTY); // keeps pty open between clients
+  printf("%s\n", ptsname(fd));
+  fflush(stdout);
+  if (link)
+  {
+    unlink(link);
+    if (symlink(ptsname(fd), link))
+      perror(link);
+  }
+
+  while (read(fd, &c, 1) == 1)
+  {
+    if (0x1b == c) // escape sequences are not used remotely, drop next two bytes
+    {
+      if ((read(fd, &c, 1) == 1) && (0x5B == c))
+        read(fd, &c, 1);
+    }
+    else if (0x08 == c)
+    {
+      if (bufPos)
+        bufPos--;
+    }
+    else if ('\n' == c)
+    {
+    }
+    else if ('\r' == c)
+    {
+      if (localEcho)
+        OutStr("\r\n");
+      if (bufPos)
+        Execute(buf, bufPos);
+      bufPos = 0;
+      if (localEcho)
+        OutStr("<GPIB> ");
+    }
+    else if (bufPos < BUF_SIZE-1)
+    {
+      buf[bufPos++] = c;
+      if (localEcho)
+        Out(&c, 1);
+    }
+  }
+
+  close(slave);
+  return 0;
+}
@@ -0,0 +1,160 @@
+/* Long term logger, converter polls device and summarizes readings itself
+   (J command), only one record per window comes over the link. Prints
+   local time, number of readings, failed polls, mean, min and max.
+
+   usage: gpiblog [-d device] -a addr [-n window] [-i ms] query
+     -n  polls per summary, 1..65535, default 100
+     -i  interval between polls, default 0 (as fast as bus allows)
+
+   Device defaults to $GPIBCONV or /dev/ttyUSB0. Ctrl-C ends logging, the
+   partial window is printed too. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "gpibconv.h"
+
+/* record format, see Aggregate_Send in sw/main.c */
+#define AGG_LAST 0x01
+#define AGG_RECORD_SIZE 17
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void OnSignal(int sig)
+{
+  stop = 1;
+}
+
+
+static float Float(const unsigned char * p)
+{
+  uint32_t u = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  float f;
+
+  memcpy(&f, &u, 4);
+  return f;
+}
+
+
+static void Record(const unsigned char * r)
+{
+  char stamp[32];
+  time_t now = time(NULL);
+
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+  printf("%s %5u %5u %.7g %.7g %.7g%s\n", stamp, r[1] | (r[2] << 8), r[3] | (r[4] << 8),
+         Float(r+5), Float(r+9), Float(r+13), (r[0] & AGG_LAST)?" partial":"");
+  fflush(stdout);
+}
+
+
+int main(int argc, char * argv[])
+{
+  const char * device = getenv("GPIBCONV");
+  unsigned char rec[AGG_RECORD_SIZE];
+  char line[GC_MAX_LINE];
+  gpibConv_t * gc;
+  struct pollfd p;
+  int recLen = 0;
+  int addr = -1;
+  int window = 100;
+  int interval = 0;
+  int escaped = 0;
+  int done = 0;
+  ssize_t n;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:a:n:i:")) != -1)
+  {
+    if ('d' == opt)
+      device = optarg;
+    else if ('a' == opt)
+      addr = atoi(optarg);
+    else if ('n' == opt)
+      window = atoi(optarg);
+    else if ('i' == opt)
+      interval = atoi(optarg);
+    else
+      optind = argc+1;
+  }
+  if ((optind+1 != argc) || (addr < 0) || (addr > 30) || (window < 1) || (window > 65535) ||
+      (interval < 0) || (interval > 715000))
+  {
+    fprintf(stderr, "usage: %s [-d device] -a addr [-n window] [-i ms] query\n", argv[0]);
+    return 1;
+  }
+
+  if (!device)
+    device = "/dev/ttyUSB0";
+  gc = GC_Open(device); // echo off, records follow command line directly
+  if (!gc)
+  {
+    perror(device);
+    return 1;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  p.fd = GC_Fd(gc);
+  p.events = POLLIN;
+  snprintf(line, sizeof(line), "J%02d%d/%d,%s\r", addr, window, interval, argv[optind]);
+  if (write(p.fd, line, strlen(line)) != (ssize_t)strlen(line))
+  {
+    perror(device);
+    GC_Close(gc);
+    return 1;
+  }
+
+  while (!done)
+  {
+    if (stop && !escaped)
+    {
+      if (write(p.fd, "\x1b", 1) != 1)
+        break;
+      escaped = 1;
+    }
+
+    n = poll(&p, 1, escaped?1000:-1);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      perror("poll");
+      break;
+    }
+    if (0 == n) // no last record after ESC
+      break;
+
+    n = read(p.fd, rec+recLen, AGG_RECORD_SIZE-recLen);
+    if ((n < 0) && ((EAGAIN == errno) || (EINTR == errno)))
+      continue;
+    if (n <= 0)
+    {
+      perror(device);
+      break;
+    }
+    if ((0 == recLen) && ('E' == rec[0])) // ERROR instead of records
+    {
+      fprintf(stderr, "converter refused command\n");
+      break;
+    }
+    recLen += n;
+    if (AGG_RECORD_SIZE == recLen)
+    {
+      Record(rec);
+      done = rec[0] & AGG_LAST;
+      recLen = 0;
+    }
+  }
+
+  GC_Close(gc);
+  return 0;
+}
@@ -0,0 +1,319 @@
+/* Polls instruments on several converters (one per bus) at once from a
+   single thread. Every converter link is non-blocking and watched with
+   epoll, queries are pipelined to each converter up to a depth, so buses
+   run concurrently and the aggregate rate grows with the number of buses.
+   Replies of all buses are merged into one stream in order of arrival,
+   each line carries local time (us), device, address and reply or failure.
+
+   usage: gpibmux [-n count] [-i ms] [-p depth] device:addr:query ...
+     -n  queries per instrument, default 0 (until Ctrl-C)
+     -i  interval between queries of an instrument, default 0 (as fast as
+         bus allows)
+     -p  queries outstanding per converter, 1..32, default 8
+
+   Instruments on the same device share its converter and are queried in
+   turn. Count, failures and rate per converter are printed to stderr at
+   the end. A converter whose link fails is dropped, the others go on. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include "gpibconv.h"
+
+#define MUX_MAX_BUSES 16
+#define MUX_MAX_QUERIES 64
+#define MUX_MAX_DEPTH 32
+#define MUX_SWEEP_MS 100 // GC_Process() of quiet links, for link timeout
+
+typedef struct {
+  const char * device;
+  gpibConv_t * gc;
+  int events;      // registered with epoll, 0 when dropped
+  int outstanding;
+  unsigned long completed;
+  unsigned long failed;
+} muxBus_t;
+
+typedef struct {
+  muxBus_t * bus;
+  int addr;
+  const char * query;
+  unsigned long submitted;
+  double due;      // time of next query
+} muxQuery_t;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void OnSignal(int sig)
+{
+  stop = 1;
+}
+
+
+static double Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+static const char * StatusName(int status)
+{
+  if (GC_TIMEOUT == status)
+    return "TIMEOUT";
+  if (GC_ERROR == status)
+    return "ERROR";
+  return "I/O ERROR";
+}
+
+
+static void Done(void * ctx, int status, const unsigned char * data, size_t len)
+{
+  muxQuery_t * q = ctx;
+  char stamp[32];
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&tv.tv_sec));
+  q->bus->outstanding--;
+  q->bus->completed++;
+
+  printf("%s.%06ld %s %d ", stamp, (long)tv.tv_usec, q->bus->device, q->addr);
+  if (GC_OK != status)
+  {
+    q->bus->failed++;
+    printf("%s\n", StatusName(status));
+    return;
+  }
+  while (len && (('\n' == data[len-1]) || ('\r' == data[len-1])))
+    len--;
+  fwrite(data, 1, len, stdout);
+  printf("\n");
+}
+
+
+static int Watch(int ep, muxBus_t * b)
+{
+  struct epoll_event ev;
+  int events = EPOLLIN | (GC_WantWrite(b->gc)?EPOLLOUT:0);
+
+  if (events == b->events)
+    return 0;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = b;
+  if (epoll_ctl(ep, b->events?EPOLL_CTL_MOD:EPOLL_CTL_ADD, GC_Fd(b->gc), &ev) < 0)
+    return -1;
+  b->events = events;
+  return 0;
+}
+
+
+static void Drop(int ep, muxBus_t * b)
+{
+  fprintf(stderr, "%s: converter not responding, dropped\n", b->device);
+  epoll_ctl(ep, EPOLL_CTL_DEL, GC_Fd(b->gc), NULL);
+  b->events = 0;
+}
+
+
+static int Parse(char * spec, muxQuery_t * q)
+{
+  char * addr = strchr(spec, ':');
+  char * query = addr?strchr(addr+1, ':'):NULL;
+  char * end;
+
+  if (!query || (addr == spec) || !query[1])
+    return -1;
+  *addr++ = 0;
+  *query++ = 0;
+  q->addr = strtol(addr, &end, 10);
+  q->query = query;
+  return ((end == addr) || *end || (q->addr < 0) || (q->addr > 30))?-1:0;
+}
+
+
+int main(int argc, char * argv[])
+{
+  muxBus_t buses[MUX_MAX_BUSES];
+  muxQuery_t queries[MUX_MAX_QUERIES];
+  struct epoll_event ev[MUX_MAX_BUSES];
+  unsigned long count = 0;
+  double interval = 0;
+  int depth = 8;
+  int busCount = 0;
+  int queryCount = 0;
+  double start, now, lastSweep, wait;
+  unsigned long total = 0;
+  int active, submitted, failed = 0;
+  int ep, n, i, j;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:i:p:")) != -1)
+  {
+    if ('n' == opt)
+      count = strtoul(optarg, NULL, 10);
+    else if ('i' == opt)
+      interval = atoi(optarg)/1000.0;
+    else if ('p' == opt)
+      depth = atoi(optarg);
+    else
+      optind = argc+1;
+  }
+  if ((optind >= argc) || (argc-optind > MUX_MAX_QUERIES) || (interval < 0) ||
+      (depth < 1) || (depth > MUX_MAX_DEPTH))
+  {
+    fprintf(stderr, "usage: %s [-n count] [-i ms] [-p depth] device:addr:query ...\n", argv[0]);
+    return 1;
+  }
+
+  memset(buses, 0, sizeof(buses));
+  memset(queries, 0, sizeof(queries));
+  for (; optind < argc; optind++)
+  {
+    muxQuery_t * q = &queries[queryCount++];
+
+    if (Parse(argv[optind], q) < 0)
+    {
+      fprintf(stderr, "device:addr:query expected, addr 0..30: %s\n", argv[optind]);
+      return 1;
+    }
+    for (i=0; (i < busCount) && strcmp(buses[i].device, argv[optind]); i++)
+      ;
+    if (i == busCount)
+    {
+      if (MUX_MAX_BUSES == busCount)
+      {
+        fprintf(stderr, "at most %d converters\n", MUX_MAX_BUSES);
+        return 1;
+      }
+      buses[busCount++].device = argv[optind];
+    }
+    q->bus = &buses[i];
+  }
+
+  ep = epoll_create1(0);
+  if (ep < 0)
+  {
+    perror("epoll");
+    return 1;
+  }
+  for (i=0; i<busCount; i++)
+  {
+    buses[i].gc = GC_Open(buses[i].device);
+    if (!buses[i].gc || (Watch(ep, &buses[i]) < 0))
+    {
+      perror(buses[i].device);
+      return 1;
+    }
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  start = lastSweep = Now();
+  for (j=0; j<queryCount; j++)
+    queries[j].due = start;
+
+  do
+  {
+    // fill pipelines, instruments of a bus in turn
+    now = Now();
+    wait = MUX_SWEEP_MS/1000.0;
+    do
+    {
+      submitted = 0;
+      for (j=0; j<queryCount; j++)
+      {
+        muxQuery_t * q = &queries[j];
+
+        if (stop || !q->bus->events || (count && (q->submitted >= count)))
+          continue;
+        if (q->due > now)
+        {
+          if (q->due - now < wait)
+            wait = q->due - now;
+          continue;
+        }
+        if (q->bus->outstanding >= depth)
+          continue;
+        if (GC_OK != GC_QueryAsync(q->bus->gc, q->addr, q->query, strlen(q->query), Done, q))
+        {
+          fprintf(stderr, "%s: request rejected\n", q->bus->device);
+          stop = 1;
+          break;
+        }
+        q->bus->outstanding++;
+        q->submitted++;
+        q->due = interval?(q->due + interval):now;
+        submitted = 1;
+      }
+    } while (submitted);
+
+    for (i=0; i<busCount; i++)
+    {
+      if (buses[i].events && (Watch(ep, &buses[i]) < 0))
+      {
+        perror("epoll");
+        stop = 1;
+      }
+    }
+    fflush(stdout);
+
+    n = epoll_wait(ep, ev, MUX_MAX_BUSES, (int)(wait*1000) + 1);
+    if ((n < 0) && (EINTR != errno))
+    {
+      perror("epoll");
+      break;
+    }
+    for (i=0; i<n; i++)
+    {
+      muxBus_t * b = ev[i].data.ptr;
+
+      if (b->events && (GC_Process(b->gc, 0) < 0))
+        Drop(ep, b);
+    }
+
+    // links without events still need GC_Process() to notice silence
+    if (Now() - lastSweep >= MUX_SWEEP_MS/1000.0)
+    {
+      for (i=0; i<busCount; i++)
+        if (buses[i].events && buses[i].outstanding && (GC_Process(buses[i].gc, 0) < 0))
+          Drop(ep, &buses[i]);
+      lastSweep = Now();
+    }
+
+    active = 0;
+    for (j=0; j<queryCount; j++)
+    {
+      muxQuery_t * q = &queries[j];
+
+      if (q->bus->events && (q->bus->outstanding || (!stop && (!count || (q->submitted < count)))))
+        active = 1;
+    }
+  } while (active);
+  fflush(stdout);
+
+  now = Now() - start;
+  for (i=0; i<busCount; i++)
+  {
+    fprintf(stderr, "%s: %lu queries, %lu failed, %.1f/s%s\n", buses[i].device, buses[i].completed,
+            buses[i].failed, buses[i].completed/now, buses[i].events?"":", dropped");
+    total += buses[i].completed;
+    if (buses[i].failed || !buses[i].events)
+      failed = 1;
+    GC_Close(buses[i].gc);
+  }
+  if (busCount > 1)
+    fprintf(stderr, "total: %lu queries, %.1f/s\n", total, total/now);
+  close(ep);
+  return failed?2:0;
+}
@@ -0,0 +1,65 @@
+#include "gpibrle.h"
+
+#define RLE_STATE_DATA 0
+#define RLE_STATE_COUNT 1
+#define RLE_STATE_BYTE 2
+#define RLE_STATE_CONTROL 3
+
+
+void RLE_DecoderInit(rleDecoder_t * d)
+{
+  d->state = RLE_STATE_DATA;
+  d->count = 0;
+  d->control = 0;
+}
+
+
+size_t RLE_Decode(rleDecoder_t * d, const unsigned char * in, size_t inLen,
+                  unsigned char * out, size_t outSize, size_t * consumed)
+{
+  size_t i = 0;
+  size_t o = 0;
+  unsigned char c;
+
+  d->control = 0;
+
+  while ((i < inLen) && (o < outSize))
+  {
+    c = in[i];
+
+    if (RLE_STATE_DATA == d->state)
+    {
+      if (RLE_MARK == c)
+        d->state = RLE_STATE_COUNT;
+      else
+        out[o++] = c;
+    }
+    else if (RLE_STATE_COUNT == d->state)
+    {
+      d->count = c;
+      d->state = c?RLE_STATE_BYTE:RLE_STATE_CONTROL;
+    }
+    else if (RLE_STATE_CONTROL == d->state)
+    {
+      d->control = c;
+      d->state = RLE_STATE_DATA;
+      i++;
+      break;
+    }
+    else // run, may be split when out is full
+    {
+      while (d->count && (o < outSize))
+      {
+        out[o++] = c;
+        d->count--;
+      }
+      if (d->count)
+        break;
+      d->state = RLE_STATE_DATA;
+    }
+    i++;
+  }
+
+  *consumed = i;
+  return o;
+}
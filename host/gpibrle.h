@@ -0,0 +1,25 @@
+#ifndef GPIBRLE_HEADER
+#define GPIBRLE_HEADER
+
+#include <stddef.h>
+
+/* Decoder for run length coded printer/device mode streams, see sw/rle.h */
+
+#define RLE_MARK 0xFE
+#define RLE_CTRL_EOI 0x01 // end of message (plot) in printer mode
+
+typedef struct {
+  unsigned char state;
+  unsigned char count;
+  unsigned char control; // code of last stream control record, 0 if none
+} rleDecoder_t;
+
+void RLE_DecoderInit(rleDecoder_t * d);
+
+/* Decodes up to inLen bytes into out. Stops early when out is full or after
+   a stream control record (d->control is set then). Returns number of bytes
+   written to out, *consumed is set to number of input bytes used. */
+size_t RLE_Decode(rleDecoder_t * d, const unsigned char * in, size_t inLen,
+                  unsigned char * out, size_t outSize, size_t * consumed);
+
+#endif
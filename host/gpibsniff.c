@@ -0,0 +1,265 @@
+/* Bus analyzer client, puts converter into analyzer mode (N command) and
+   prints bus traffic with timestamps, command bytes decoded.
+
+   usage: gpibsniff [-d device] [-a] [-v] [-w file] [-r file]
+     -a  converter takes part in handshake as acceptor (N1), default is
+         pure observer (N0)
+     -v  also print timer wrap records (handshake state every 43.7 ms)
+     -w  save raw records to file
+     -r  decode raw records saved before instead of live capture
+
+   Device defaults to $GPIBCONV or /dev/ttyUSB0. Ctrl-C ends capture. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include "gpibconv.h"
+
+/* record format, see sw/sniff.h */
+#define SNIFF_ATN 0x01
+#define SNIFF_EOI 0x02
+#define SNIFF_SRQ 0x04
+#define SNIFF_REN 0x08
+#define SNIFF_IFC 0x10
+#define SNIFF_LOST 0x80
+#define SNIFF_REC_MASK 0x60
+#define SNIFF_REC_DATA 0x00
+#define SNIFF_REC_LINES 0x20
+#define SNIFF_REC_WRAP 0x40
+#define SNIFF_HS_DAV 0x01
+#define SNIFF_HS_NRFD 0x02
+#define SNIFF_HS_NDAC 0x04
+#define SNIFF_RECORD_SIZE 4
+#define SNIFF_TIMER_HZ 1500000.0 // GPIB_TIMER_HZ in sw/gpib.h
+
+typedef struct {
+  unsigned long long wraps;
+  unsigned char rec[SNIFF_RECORD_SIZE];
+  int recLen;
+  int verbose;
+} sniffDecoder_t;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void OnSignal(int sig)
+{
+  stop = 1;
+}
+
+
+static void Mnemonic(unsigned char c, char * s)
+{
+  static const struct { unsigned char code; const char * name; } universal[] = {
+    {0x01, "GTL"}, {0x04, "SDC"}, {0x05, "PPC"}, {0x08, "GET"}, {0x09, "TCT"},
+    {0x11, "LLO"}, {0x14, "DCL"}, {0x15, "PPU"}, {0x18, "SPE"}, {0x19, "SPD"}};
+  unsigned int i;
+
+  c &= 0x7F;
+  if (0x3F == c)
+    strcpy(s, "UNL");
+  else if (0x5F == c)
+    strcpy(s, "UNT");
+  else if ((c & 0x60) == 0x20)
+    sprintf(s, "MLA%d", c & 0x1F);
+  else if ((c & 0x60) == 0x40)
+    sprintf(s, "MTA%d", c & 0x1F);
+  else if ((c & 0x60) == 0x60)
+    sprintf(s, "MSA%d", c & 0x1F);
+  else
+  {
+    strcpy(s, "?");
+    for (i=0; i<sizeof(universal)/sizeof(universal[0]); i++)
+      if (universal[i].code == c)
+        strcpy(s, universal[i].name);
+  }
+}
+
+
+static void Lines(unsigned char flags, char * s)
+{
+  sprintf(s, "%s%s%s%s%s", (flags & SNIFF_ATN)?" ATN":"", (flags & SNIFF_EOI)?" EOI":"",
+          (flags & SNIFF_SRQ)?" SRQ":"", (flags & SNIFF_REN)?" REN":"", (flags & SNIFF_IFC)?" IFC":"");
+}
+
+
+static void Record(sniffDecoder_t * d, const unsigned char * r)
+{
+  unsigned char type = r[0] & SNIFF_REC_MASK;
+  double us;
+  char text[32];
+  char lines[32];
+
+  if (SNIFF_REC_WRAP == type)
+    d->wraps++;
+  us = (d->wraps*65536 + (r[2] | (r[3] << 8))) * 1e6 / SNIFF_TIMER_HZ;
+
+  if (r[0] & SNIFF_LOST)
+    printf("*** records lost, link too slow\n");
+
+  Lines(r[0], lines);
+  if (SNIFF_REC_DATA == type)
+  {
+    if (r[0] & SNIFF_ATN)
+      Mnemonic(r[1], text);
+    else if ((r[1] >= 0x20) && (r[1] < 0x7F))
+      sprintf(text, "'%c'", r[1]);
+    else
+      text[0] = 0;
+    printf("%14.1f  %c %02X %-6s%s\n", us, (r[0] & SNIFF_ATN)?'C':'D', r[1], text, lines);
+  }
+  else if ((SNIFF_REC_LINES == type) || d->verbose)
+  {
+    printf("%14.1f  %s%s |%s%s%s\n", us, (SNIFF_REC_LINES == type)?"lines":"wrap ", lines,
+           (r[1] & SNIFF_HS_DAV)?" DAV":"", (r[1] & SNIFF_HS_NRFD)?" NRFD":"", (r[1] & SNIFF_HS_NDAC)?" NDAC":"");
+  }
+}
+
+
+static void Decode(sniffDecoder_t * d, const unsigned char * data, size_t len)
+{
+  size_t i;
+
+  for (i=0; i<len; i++)
+  {
+    d->rec[d->recLen++] = data[i];
+    if (SNIFF_RECORD_SIZE == d->recLen)
+    {
+      Record(d, d->rec);
+      d->recLen = 0;
+    }
+  }
+  fflush(stdout);
+}
+
+
+static int DecodeFile(sniffDecoder_t * d, const char * name)
+{
+  unsigned char buf[4096];
+  size_t n;
+  FILE * f = fopen(name, "rb");
+
+  if (!f)
+  {
+    perror(name);
+    return 1;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    Decode(d, buf, n);
+  fclose(f);
+  return 0;
+}
+
+
+int main(int argc, char * argv[])
+{
+  const char * device = getenv("GPIBCONV");
+  const char * input = NULL;
+  const char * output = NULL;
+  sniffDecoder_t d;
+  unsigned char buf[4096];
+  gpibConv_t * gc;
+  FILE * raw = NULL;
+  struct pollfd p;
+  int acceptor = 0;
+  int idle = 0;
+  ssize_t n;
+  int opt;
+
+  memset(&d, 0, sizeof(d));
+  while ((opt = getopt(argc, argv, "d:avw:r:")) != -1)
+  {
+    if ('d' == opt)
+      device = optarg;
+    else if ('a' == opt)
+      acceptor = 1;
+    else if ('v' == opt)
+      d.verbose = 1;
+    else if ('w' == opt)
+      output = optarg;
+    else if ('r' == opt)
+      input = optarg;
+    else
+    {
+      fprintf(stderr, "usage: %s [-d device] [-a] [-v] [-w file] [-r file]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (input)
+    return DecodeFile(&d, input);
+
+  if (output && !(raw = fopen(output, "wb")))
+  {
+    perror(output);
+    return 1;
+  }
+
+  if (!device)
+    device = "/dev/ttyUSB0";
+  gc = GC_Open(device); // echo off, records follow command line directly
+  if (!gc)
+  {
+    perror(device);
+    return 1;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  p.fd = GC_Fd(gc);
+  p.events = POLLIN;
+  if (write(p.fd, acceptor?"N1\r":"N0\r", 3) != 3)
+  {
+    perror(device);
+    GC_Close(gc);
+    return 1;
+  }
+
+  // after ESC converter sends records still buffered, then goes idle
+  while (idle < 2)
+  {
+    if (stop && !idle)
+    {
+      if (write(p.fd, "\x1b", 1) != 1)
+        break;
+      idle = 1;
+    }
+
+    n = poll(&p, 1, idle?200:-1);
+    if (n < 0)
+    {
+      if (EINTR == errno)
+        continue;
+      perror("poll");
+      break;
+    }
+    if (0 == n)
+    {
+      idle++;
+      continue;
+    }
+
+    n = read(p.fd, buf, sizeof(buf));
+    if (n > 0)
+    {
+      if (raw)
+        fwrite(buf, 1, n, raw);
+      Decode(&d, buf, n);
+    }
+    else if ((0 == n) || ((EAGAIN != errno) && (EINTR != errno)))
+    {
+      perror(device);
+      break;
+    }
+  }
+
+  if (raw)
+    fclose(raw);
+  GC_Close(gc);
+  return 0;
+}
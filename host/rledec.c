@@ -0,0 +1,41 @@
+/* Decodes run length coded converter stream (K1 setting) from stdin or
+   file to stdout, e.g. printer mode capture saved by terminal program.
+
+   usage: rledec [input file] */
+
+#include <stdio.h>
+#include <string.h>
+#include "gpibrle.h"
+
+int main(int argc, char * argv[])
+{
+  unsigned char in[4096];
+  unsigned char out[4096];
+  rleDecoder_t d;
+  size_t len, pos, used, n;
+  FILE * f = stdin;
+
+  if ((argc > 1) && strcmp(argv[1], "-"))
+  {
+    f = fopen(argv[1], "rb");
+    if (!f)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  RLE_DecoderInit(&d);
+  while ((len = fread(in, 1, sizeof(in), f)) > 0)
+  {
+    for (pos = 0; pos < len; pos += used)
+    {
+      n = RLE_Decode(&d, in+pos, len-pos, out, sizeof(out), &used);
+      fwrite(out, 1, n, stdout);
+    }
+  }
+
+  if (f != stdin)
+    fclose(f);
+  return 0;
+}
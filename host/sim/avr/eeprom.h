@@ -0,0 +1,21 @@
+#ifndef SIM_AVR_EEPROM
+#define SIM_AVR_EEPROM
+
+#include <stdint.h>
+#include <string.h>
+
+/* EEMEM variables are ordinary variables, EEPROM lasts as long as the
+   simulation (also over simulated resets) */
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t * p) { return *p; }
+static inline void eeprom_write_byte(uint8_t * p, uint8_t v) { *p = v; }
+static inline void eeprom_update_byte(uint8_t * p, uint8_t v) { *p = v; }
+static inline uint16_t eeprom_read_word(const uint16_t * p) { return *p; }
+static inline void eeprom_update_word(uint16_t * p, uint16_t v) { *p = v; }
+static inline void eeprom_read_block(void * dst, const void * src, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_write_block(const void * src, void * dst, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_update_block(const void * src, void * dst, size_t n) { memcpy(dst, src, n); }
+static inline void eeprom_busy_wait(void) {}
+
+#endif
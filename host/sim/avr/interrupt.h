@@ -0,0 +1,14 @@
+#ifndef SIM_AVR_INTERRUPT
+#define SIM_AVR_INTERRUPT
+
+#include "sim.h"
+
+/* interrupts are run by simulated time, between register accesses */
+#define SIGNAL(vector) void vector(void)
+#define ISR(vector) void vector(void)
+#define SIG_OVERFLOW0 Sim_Timer0Overflow
+
+#define sei() Sim_Interrupts(1)
+#define cli() Sim_Interrupts(0)
+
+#endif
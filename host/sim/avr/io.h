@@ -0,0 +1,55 @@
+/* ATmega32 registers for the host build of the firmware. Port and data
+   direction registers are plain variables the bus model reads, input pins
+   and timer 1 are functions which advance simulated time. */
+#ifndef SIM_AVR_IO
+#define SIM_AVR_IO
+
+#include <stdint.h>
+#include "sim.h"
+
+extern volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+extern volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+extern volatile uint8_t PINB, PIND;
+extern volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL, UDR;
+extern volatile uint8_t TIMSK, TCNT0, TCCR0, TCCR1A, TCCR1B;
+extern volatile uint8_t MCUCSR, WDTCR;
+
+#define PINA (Sim_PINA())
+#define PINC (Sim_PINC())
+#define TCNT1 (*Sim_TCNT1())
+#define TIFR (*Sim_TIFR())
+
+#define _BV(b) (1 << (b))
+
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PD2 2
+
+#define U2X 1
+#define UDRE 5
+#define RXEN 4
+#define TXEN 3
+#define RXCIE 7
+#define UDRIE 5
+#define URSEL 7
+#define UCSZ0 1
+#define TOIE0 0
+#define CS00 0
+#define CS02 2
+#define CS11 1
+#define TOV1 2
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+
+#endif
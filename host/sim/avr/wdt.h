@@ -0,0 +1,19 @@
+#ifndef SIM_AVR_WDT
+#define SIM_AVR_WDT
+
+#include "sim.h"
+
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+
+#define wdt_enable(timeout) Sim_Watchdog(timeout)
+#define wdt_disable() Sim_Watchdog(-1)
+#define wdt_reset() Sim_WatchdogReset()
+
+#endif
@@ -0,0 +1,670 @@
+/* Load generator for the host build of the firmware. Firmware runs against
+   simulated instruments (simdev.c) and gets a pseudo random mix of
+   transactions over the simulated 115200 baud link, each one sent when the
+   previous reply has left the converter:
+     dso block      W<a>CURV?, V<a>Y until the 4000 byte binary reply is in
+     plotter write  W<a>PA<x>,<y>;PD;
+     dmm read       W<a>READ?, V<a>X
+     dmm values     W<a>READ?, F<a>
+     srq read       W<a>MEAS?, S polled until SRQ, V<a>X, with -e the
+                    reply pushed by converter in SRQ event mode (S1)
+     flaky read     W<a>READ?, V<a>Y, instrument stalls every 7th transfer,
+                    after a stall ! has to report the bus free or cleared
+     paused read    W<a>READ?, V<a>Y until the reply is in, talker pauses
+                    longer than the converter waits, bus must not get IFC
+     bus scan       A?, map of instruments found from handshake lines
+     dmm macro      @<n> running W<a>READ? and V<a>X stored at start
+   Replies are compared with what the instruments sent. Prints count,
+   errors, timeouts, latency percentiles and payload throughput per
+   transaction type, all in simulated time. A transaction which doesn't
+   finish in the hang limit stops the run with bus and instrument state, so
+   does firmware which stops touching the hardware for 5 s of wall time.
+
+   usage: gpibload [-n transactions] [-s seed] [-t ms] [-e] [-v] [-w file] [-D spec]...
+     -n  transactions, default 1000
+     -s  seed of transaction mix, default 1
+     -t  hang limit in simulated ms, default 10000
+     -e  SRQ event mode
+     -v  one line per transaction
+     -w  save bus trace in gpibsniff -w format, for gpibreplay
+     -D  instrument model[@addr][:key=value,...], replaces default set
+         dso@1 plotter@5 dmm@22 srq@9 flaky@17 pausing@12, keys see sim/simdev.h,
+         e.g. -D dso:accept=500,reply=8000
+
+   Exit status is 0 when all transactions ended as expected. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+#include "simdev.h"
+
+#define REPLY_STATUS 0 // OK/TIMEOUT/ERROR line
+#define REPLY_LINE 1   // text up to LF, X reply and S state
+#define REPLY_BLOCK 2  // Y, <length><payload>
+#define REPLY_VALUES 3 // F, blocks <n><values> until n=0
+#define REPLY_SRQ 4    // SRQ<a>,<status>,<length>:<payload> CR LF, pushed in event mode
+
+#define RESULT_OK 0
+#define RESULT_TIMEOUT 1
+#define RESULT_ERROR 2
+
+#define OP_SETUP -1
+#define OP_BLOCK 0
+#define OP_PLOT 1
+#define OP_READ 2
+#define OP_VALUES 3
+#define OP_SRQ 4
+#define OP_FLAKY 5
+#define OP_SCAN 6
+#define OP_MACRO 7
+#define OP_PAUSED 8
+#define OPS 9
+
+#define WATCHDOG_S 5
+#define MACROS 8 // MACRO_COUNT in sw/macro.h
+
+static const char * opNames[OPS] = {"dso block", "plotter write", "dmm read", "dmm values",
+                                    "srq read", "flaky read", "bus scan", "dmm macro", "paused read"};
+
+typedef struct {
+  unsigned long count;
+  unsigned long errors;
+  unsigned long timeouts;
+  unsigned long bytes;
+  simTime_t busy;
+  double * latency; // us
+  size_t size;
+} opStats_t;
+
+static opStats_t stats[OPS];
+
+/* transaction in progress */
+static struct {
+  int op;
+  simDevice_t * dev;
+  int step;
+  int reply;
+  char cmd[64];
+  simTime_t start;
+  unsigned char expect[65536];
+  int expectLen;
+  int got;
+  unsigned long bytes;
+  unsigned long clears; // IFC pulses before transaction
+} tr;
+
+static unsigned char rx[65536+16];
+static int rxLen = 0;
+static unsigned long done = 0;
+static unsigned long total = 1000;
+static unsigned long seed = 1;
+static simTime_t hangLimit = 10000*SIM_MS;
+static int verbose = 0;
+static int events = 0;
+static int hung = 0;
+static simTime_t lastSeen = 0;
+static char setup[2+3*MACROS][64]; // echo off, macros of dmm instruments, S1
+static int setupCount = 0;
+static int macros[SIMDEV_MAX]; // macro number of instrument, -1 none
+
+
+static unsigned long Random(void)
+{
+  seed = seed*1103515245UL + 12345UL;
+  return (seed >> 16) & 0x7FFF;
+}
+
+
+static void Send(simTime_t t, int reply, const char * format, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap, format);
+  len = vsnprintf(tr.cmd, sizeof(tr.cmd), format, ap);
+  va_end(ap);
+  tr.reply = reply;
+  rxLen = 0;
+  Sim_UartWrite(tr.cmd, len, t);
+}
+
+
+static int Complete(void)
+{
+  int i;
+
+  if ((REPLY_STATUS == tr.reply) || (REPLY_LINE == tr.reply))
+    return rxLen && ('\n' == rx[rxLen-1]);
+  if (REPLY_BLOCK == tr.reply)
+    return rxLen && (rxLen == 1+rx[0]);
+  if (REPLY_SRQ == tr.reply)
+  {
+    for (i=0; (i<rxLen) && (':' != rx[i]); i++);
+    return (i < rxLen) && (rxLen == i+1+atoi((char *)rx+9)+2); // SRQaa,ss,n
+  }
+  for (i=0; i<rxLen; i += 1+4*rx[i]) // REPLY_VALUES
+    if (0 == rx[i])
+      return i+1 == rxLen;
+  return 0;
+}
+
+
+static int Status(void)
+{
+  if ((4 == rxLen) && !memcmp(rx, "OK\r\n", 4))
+    return RESULT_OK;
+  if ((9 == rxLen) && !memcmp(rx, "TIMEOUT\r\n", 9))
+    return RESULT_TIMEOUT;
+  return RESULT_ERROR;
+}
+
+
+/* reply the instrument prepared for the query just written */
+static void Expect(void)
+{
+  tr.expectLen = tr.dev->replies?SimDev_Reply(tr.dev, tr.dev->replies-1, tr.expect):0;
+  tr.got = 0;
+}
+
+
+static int CompareText(void)
+{
+  if (Status() == RESULT_TIMEOUT)
+    return RESULT_TIMEOUT;
+  tr.bytes += rxLen;
+  return ((rxLen == tr.expectLen) && !memcmp(rx, tr.expect, rxLen))?RESULT_OK:RESULT_ERROR;
+}
+
+
+/* F reply against numbers of expected text */
+static int CompareValues(void)
+{
+  char text[65536];
+  char * p = text;
+  char * end;
+  unsigned int u;
+  float f;
+  double v;
+  int i, k;
+
+  memcpy(text, tr.expect, tr.expectLen);
+  text[tr.expectLen] = 0;
+  for (i=0; rx[i]; i += 1+4*rx[i])
+    for (k=0; k<rx[i]; k++)
+    {
+      u = rx[i+1+4*k] | (rx[i+2+4*k] << 8) | (rx[i+3+4*k] << 16) | ((unsigned int)rx[i+4+4*k] << 24);
+      memcpy(&f, &u, 4);
+      v = strtod(p, &end);
+      if ((end == p) || (f < v - 1e-6*(1+abs((int)v))) || (f > v + 1e-6*(1+abs((int)v))))
+        return RESULT_ERROR;
+      p = end + (',' == *end);
+      tr.bytes += 4;
+    }
+  if (0 == i)
+    return RESULT_TIMEOUT;
+  return ('\n' == *p)?RESULT_OK:RESULT_ERROR;
+}
+
+
+/* A? map against instruments on simulated bus */
+static int Scan(void)
+{
+  unsigned long map = 0;
+  char text[16];
+  int i;
+
+  if (Status() == RESULT_TIMEOUT)
+    return RESULT_TIMEOUT;
+  for (i=0; i<simDeviceCount; i++)
+    map |= 1UL << simDevices[i].address;
+  snprintf(text, sizeof(text), "%08lX\r\n", map);
+  return ((rxLen == 10) && !memcmp(rx, text, 10))?RESULT_OK:RESULT_ERROR;
+}
+
+
+/* record pushed in event mode against what the instrument sent */
+static int SrqRecord(void)
+{
+  char head[16];
+  int n;
+
+  snprintf(head, sizeof(head), "SRQ%02d,50,%d:", tr.dev->address, tr.expectLen);
+  n = strlen(head);
+  if ((rxLen != n+tr.expectLen+2) || memcmp(rx, head, n) || memcmp(rx+n, tr.expect, tr.expectLen))
+    return RESULT_ERROR;
+  tr.bytes += tr.expectLen;
+  return RESULT_OK;
+}
+
+
+/* ! after stall of flaky instrument, talker which stopped leaves the bus
+   free, listener which holds it has to be cleared with IFC */
+static int Recovery(void)
+{
+  int cause, result, ms;
+  unsigned int lines, count;
+
+  rx[rxLen < (int)sizeof(rx)?rxLen:rxLen-1] = 0;
+  if ((5 != sscanf((char *)rx, "%d,%x,%d,%d,%u", &cause, &lines, &result, &ms, &count)) ||
+      (cause < 1) || (cause > 4) || (((3 == cause)?2:3) != result))
+    return RESULT_ERROR;
+  return RESULT_TIMEOUT;
+}
+
+
+static void Begin(simTime_t t);
+
+
+static void Finish(simTime_t t, int result)
+{
+  opStats_t * s = &stats[tr.op];
+  simTime_t latency = t - tr.start;
+
+  if (s->count == s->size)
+  {
+    s->size = s->size?2*s->size:256;
+    s->latency = realloc(s->latency, s->size*sizeof(double));
+    if (!s->latency)
+    {
+      perror("gpibload");
+      exit(1);
+    }
+  }
+  s->latency[s->count++] = latency/1e3;
+  s->busy += latency;
+  s->bytes += tr.bytes;
+  if (RESULT_TIMEOUT == result)
+    s->timeouts++;
+  else if (RESULT_ERROR == result)
+    s->errors++;
+
+  if (verbose)
+    printf("%12.3f ms %-14s %2d %9.3f ms %s\n", tr.start/1e6, opNames[tr.op], tr.dev?tr.dev->address:-1,
+           latency/1e6, (RESULT_OK == result)?"ok":(RESULT_TIMEOUT == result)?"timeout":"ERROR");
+
+  if (++done >= total)
+    Sim_Stop();
+  Begin(t);
+}
+
+
+/* reply of current step is complete at time t */
+static void Continue(simTime_t t)
+{
+  int address = tr.dev?tr.dev->address:0;
+  int result;
+  int n;
+
+  if (OP_SETUP == tr.op)
+  {
+    if (RESULT_OK != Status())
+    {
+      fprintf(stderr, "converter didn't take %.*s\n", (int)strlen(tr.cmd)-1, tr.cmd);
+      hung = 1;
+      Sim_Stop();
+    }
+    if (++tr.step < setupCount)
+      Send(t, REPLY_STATUS, "%s", setup[tr.step]);
+    else
+      Begin(t);
+    return;
+  }
+
+  if (OP_SCAN == tr.op)
+  {
+    Finish(t, Scan());
+    return;
+  }
+
+  if (3 == tr.step) // recovery after stall
+  {
+    Finish(t, Recovery());
+    return;
+  }
+
+  if (0 == tr.step) // query or plotter data written
+  {
+    result = Status();
+    if ((RESULT_TIMEOUT == result) && (OP_FLAKY == tr.op))
+    {
+      tr.step = 3;
+      Send(t, REPLY_LINE, "!\r");
+      return;
+    }
+    if ((RESULT_OK != result) || (OP_PLOT == tr.op))
+    {
+      Finish(t, result);
+      return;
+    }
+    Expect();
+    tr.step = 1;
+    if (OP_MACRO == tr.op) // macro goes on with V<a>X
+    {
+      tr.reply = REPLY_LINE;
+      rxLen = 0;
+    }
+    else if ((OP_SRQ == tr.op) && events) // converter reads reply when SRQ comes
+    {
+      tr.step = 2;
+      tr.reply = REPLY_SRQ;
+      rxLen = 0;
+    }
+    else if (OP_SRQ == tr.op)
+      Send(t, REPLY_LINE, "S\r");
+    else if (OP_VALUES == tr.op)
+      Send(t, REPLY_VALUES, "F%02d\r", address);
+    else if (OP_READ == tr.op)
+      Send(t, REPLY_LINE, "V%02dX\r", address);
+    else
+      Send(t, REPLY_BLOCK, "V%02dY\r", address);
+    return;
+  }
+
+  switch (tr.op)
+  {
+  case OP_BLOCK:
+  case OP_PAUSED:
+    n = rx[0];
+    if ((tr.got+n > tr.expectLen) || memcmp(rx+1, tr.expect+tr.got, n))
+      Finish(t, RESULT_ERROR);
+    else if ((tr.bytes += n, tr.got += n) == tr.expectLen)
+      Finish(t, ((OP_PAUSED == tr.op) && (Sim_Clears() != tr.clears))?RESULT_ERROR:RESULT_OK);
+    else if (0 == n)
+      Finish(t, RESULT_TIMEOUT);
+    else
+      Send(t, REPLY_BLOCK, "V%02dY\r", address);
+    break;
+  case OP_FLAKY:
+    n = rx[0];
+    tr.bytes += n;
+    if ((n > tr.expectLen) || memcmp(rx+1, tr.expect, n))
+      Finish(t, RESULT_ERROR);
+    else if (n == tr.expectLen)
+      Finish(t, RESULT_OK);
+    else
+    {
+      tr.step = 3;
+      Send(t, REPLY_LINE, "!\r");
+    }
+    break;
+  case OP_VALUES:
+    Finish(t, CompareValues());
+    break;
+  case OP_SRQ:
+    if (events)
+      Finish(t, SrqRecord());
+    else if ((1 == tr.step) && (rxLen == 5) && ('1' == rx[1]))
+    {
+      tr.step = 2;
+      Send(t, REPLY_LINE, "V%02dX\r", address);
+    }
+    else if (1 == tr.step)
+      Send(t, REPLY_LINE, "S\r");
+    else
+      Finish(t, CompareText());
+    break;
+  default:
+    Finish(t, CompareText());
+  }
+}
+
+
+static void Hang(void)
+{
+  unsigned char lines = Sim_BusLines();
+
+  fprintf(stderr, "HANG: transaction %lu (%s at %d) not finished %.1f ms after start\n",
+          done+1, (tr.op >= 0)?opNames[tr.op]:"setup", tr.dev?tr.dev->address:-1,
+          (simNow - tr.start)/1e6);
+  fprintf(stderr, "  step %d, last command ", tr.step);
+  fwrite(tr.cmd, 1, strlen(tr.cmd)-1, stderr);
+  fprintf(stderr, ", %d reply bytes\n  bus lines %02X data %02X (asserted)\n", rxLen, lines, Sim_BusData());
+  hung = 1;
+  Sim_Stop();
+}
+
+
+static void Begin(simTime_t t)
+{
+  simDevice_t * d = &simDevices[Random() % simDeviceCount];
+
+  tr.dev = d;
+  tr.step = 0;
+  tr.start = t;
+  tr.bytes = 0;
+  tr.clears = Sim_Clears();
+  Sim_At(t + hangLimit, Hang);
+
+  if (0 == Random() % 32)
+  {
+    tr.op = OP_SCAN;
+    tr.dev = 0;
+    Send(t, REPLY_LINE, "A?\r");
+    return;
+  }
+
+  if (!strcmp(d->model, "dso"))
+  {
+    tr.op = OP_BLOCK;
+    Send(t, REPLY_STATUS, "W%02dCURV?\r", d->address);
+  }
+  else if (!strcmp(d->model, "plotter"))
+  {
+    tr.op = OP_PLOT;
+    Send(t, REPLY_STATUS, "W%02dPA%lu,%lu;PD;\r", d->address, Random() % 10000, Random() % 7500);
+    tr.bytes = strlen(tr.cmd)-4;
+  }
+  else if (!strcmp(d->model, "srq"))
+  {
+    tr.op = OP_SRQ;
+    Send(t, REPLY_STATUS, "W%02dMEAS?\r", d->address);
+  }
+  else if (!strcmp(d->model, "pausing"))
+  {
+    tr.op = OP_PAUSED;
+    Send(t, REPLY_STATUS, "W%02dREAD?\r", d->address);
+  }
+  else if ((macros[d-simDevices] >= 0) && (0 == Random() % 3))
+  {
+    tr.op = OP_MACRO;
+    Send(t, REPLY_STATUS, "@%d\r", macros[d-simDevices]);
+  }
+  else
+  {
+    tr.op = !strcmp(d->model, "flaky")?OP_FLAKY:(Random() & 1)?OP_VALUES:OP_READ;
+    Send(t, REPLY_STATUS, "W%02dREAD?\r", d->address);
+  }
+}
+
+
+static void Output(unsigned char c, simTime_t t)
+{
+  if (rxLen < (int)sizeof(rx))
+    rx[rxLen++] = c;
+  if (Complete())
+    Continue(t);
+}
+
+
+/* firmware which spins without touching hardware doesn't advance time */
+static void OnAlarm(int sig)
+{
+  if (simNow == lastSeen)
+  {
+    fprintf(stderr, "HANG: firmware stuck at %.6f s simulated time, transaction %lu\n", simNow/1e9, done+1);
+    SimDev_Report(stderr);
+    _exit(2);
+  }
+  lastSeen = simNow;
+  alarm(WATCHDOG_S);
+}
+
+
+static double Percentile(const opStats_t * s, double q)
+{
+  return s->latency[(size_t)(q*(s->count-1) + 0.5)];
+}
+
+
+static int CompareDouble(const void * a, const void * b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+
+static void Report(double wall)
+{
+  opStats_t * s;
+  unsigned long errors = 0;
+  int i;
+
+  printf("transaction     count errors timeouts  p50 ms   p90 ms   p99 ms   max ms    kB/s\n");
+  for (i=0; i<OPS; i++)
+  {
+    s = &stats[i];
+    if (!s->count)
+      continue;
+    qsort(s->latency, s->count, sizeof(double), CompareDouble);
+    printf("%-14s %6lu %6lu %8lu %8.3f %8.3f %8.3f %8.3f %7.2f\n", opNames[i], s->count, s->errors,
+           s->timeouts, Percentile(s, 0.5)/1e3, Percentile(s, 0.9)/1e3, Percentile(s, 0.99)/1e3,
+           s->latency[s->count-1]/1e3, s->busy?s->bytes*1e6/s->busy:0.0);
+    errors += s->errors;
+  }
+  printf("%lu transactions, %lu errors, %.3f s simulated (%.1f/s), %.2f s wall, %lu bytes lost in UART buffer, %lu IFC\n",
+         done, errors, simNow/1e9, simNow?done*1e9/simNow:0.0, wall, Sim_UartDropped(), Sim_Clears());
+  SimDev_Report(stdout);
+}
+
+
+static int Instrument(char * spec)
+{
+  static const struct {const char * model; int address;} defaults[] = {
+    {"dso", 1}, {"plotter", 5}, {"dmm", 22}, {"srq", 9}, {"flaky", 17}, {"pausing", 12}};
+  char * options = strchr(spec, ':');
+  char * at = strchr(spec, '@');
+  char * key;
+  char * value;
+  simDevice_t * d;
+  int address = -1;
+  unsigned int i;
+
+  if (options)
+    *options++ = 0;
+  if (at && (!options || (at < options)))
+  {
+    *at = 0;
+    address = atoi(at+1);
+  }
+  for (i=0; (address < 0) && (i<sizeof(defaults)/sizeof(defaults[0])); i++)
+    if (!strcmp(defaults[i].model, spec))
+      address = defaults[i].address;
+  d = SimDev_Add(spec, address);
+  if (!d)
+  {
+    fprintf(stderr, "bad instrument %s@%d\n", spec, address);
+    return 0;
+  }
+
+  for (key = options?strtok(options, ","):NULL; key; key = strtok(NULL, ","))
+  {
+    value = strchr(key, '=');
+    if (!value || (*value++ = 0, !SimDev_Set(d, key, value)))
+    {
+      fprintf(stderr, "bad option %s of %s\n", key, spec);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+int main(int argc, char * argv[])
+{
+  static const char * defaults[] = {"dso", "plotter", "dmm", "srq", "flaky", "pausing"};
+  char spec[16];
+  struct timespec t0, t1;
+  FILE * trace = NULL;
+  unsigned long errors = 0;
+  int opt;
+  int i, n;
+
+  while ((opt = getopt(argc, argv, "n:s:t:evw:D:")) != -1)
+  {
+    if ('n' == opt)
+      total = strtoul(optarg, NULL, 0);
+    else if ('s' == opt)
+      seed = strtoul(optarg, NULL, 0);
+    else if ('t' == opt)
+      hangLimit = strtoul(optarg, NULL, 0)*SIM_MS;
+    else if ('e' == opt)
+      events = 1;
+    else if ('v' == opt)
+      verbose = 1;
+    else if ('w' == opt)
+    {
+      trace = fopen(optarg, "wb");
+      if (!trace)
+      {
+        perror(optarg);
+        return 1;
+      }
+    }
+    else if ('D' == opt)
+    {
+      if (!Instrument(optarg))
+        return 1;
+    }
+    else
+      optind = argc+1;
+  }
+  if ((optind != argc) || !total || !hangLimit)
+  {
+    fprintf(stderr, "usage: %s [-n transactions] [-s seed] [-t ms] [-e] [-v] [-w file] [-D model[@addr][:key=value,...]]...\n", argv[0]);
+    return 1;
+  }
+  if (!simDeviceCount)
+    for (i=0; i<(int)(sizeof(defaults)/sizeof(defaults[0])); i++)
+      Instrument(strcpy(spec, defaults[i]));
+
+  Sim_Trace(trace);
+  signal(SIGALRM, OnAlarm);
+  alarm(WATCHDOG_S);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  strcpy(setup[setupCount++], "E0\r");
+  for (i=0, n=0; i<simDeviceCount; i++)
+  {
+    macros[i] = -1;
+    if (strcmp(simDevices[i].model, "dmm") || (n >= MACROS))
+      continue;
+    macros[i] = n;
+    sprintf(setup[setupCount++], "@%d-\r", n);
+    sprintf(setup[setupCount++], "@%d+W%02dREAD?\r", n, simDevices[i].address);
+    sprintf(setup[setupCount++], "@%d+V%02dX\r", n++, simDevices[i].address);
+  }
+  if (events)
+    strcpy(setup[setupCount++], "S1\r");
+
+  tr.op = OP_SETUP;
+  tr.step = 0;
+  Send(0, REPLY_STATUS, "%s", setup[0]);
+  Sim_Run(Output);
+
+  alarm(0);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (trace)
+    fclose(trace);
+  Report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9);
+
+  for (i=0; i<OPS; i++)
+    errors += stats[i].errors;
+  return (hung || errors)?1:0;
+}
@@ -0,0 +1,711 @@
+/* Replays a recorded bus trace through the host build of the firmware. The
+   trace is a file of analyzer records (sw/sniff.h) as saved by gpibsniff -w
+   from a real bus or by gpibload -w from the simulated one. It is cut into
+   messages at EOI and ATN, every instrument in it is replaced by a scripted
+   device (simdev.h) which sends and expects its recorded messages, no byte
+   earlier than it came in the recording, and the converter takes the place
+   of the controller:
+     controller to instrument   W<a><data>, or T0C/T0D for binary data,
+                                several listeners or no EOI at the end
+     instrument to controller   V<a>Y until the message is in, also
+                                across pauses of the talker
+     other commands             T0C with the recorded bytes (SDC, GET,
+                                SPE, ...), I for IFC
+     talk-only instrument       converter in printer mode (P), for traces
+                                without any command, e.g. plotter output
+   Messages between two instruments are not replayed. The controller is the
+   address which takes part in most messages, 0 or 21 on a tie.
+
+   Checks what the converter sends to the PC and what the instruments get
+   against the recording, and compares bus time of the messages (first to
+   last byte, which leaves out instrument reply delays and PC turnaround)
+   with the recorded one. Messages the talker ended without EOI are read
+   until the converter's timeout.
+
+   usage: gpibreplay [-c addr] [-l percent] [-t ms] [-v] [-w file] trace
+     -c  controller address in trace
+     -l  fail when bus time exceeds recorded one by more than percent
+     -t  hang limit of one message in simulated ms, default 10000
+     -v  one line per message
+     -w  save bus trace of the replay
+
+   Exit status is 0 when all messages came through unchanged (and in time
+   with -l). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <unistd.h>
+#include "sim.h"
+#include "simdev.h"
+#include "../../sw/sniff.h"
+
+#define STEP_COMMAND 0 // command bytes other than addressing
+#define STEP_WRITE 1   // controller to instruments
+#define STEP_READ 2    // instrument to controller
+#define STEP_PRINT 3   // talk-only instrument
+#define STEP_IFC 4
+#define STEP_SKIP 5    // instrument to instrument
+
+#define REPLY_STATUS 0 // OK/TIMEOUT/ERROR line
+#define REPLY_BLOCK 1  // Y, <length><payload>
+#define REPLY_PRINT 2  // printer mode output, all bytes of step
+
+#define HEX_CHUNK 28   // T0C/T0D bytes per command line, BUF_SIZE/2 buffer in sw/main.c
+#define WRITE_MAX 58   // W<a><data> on one command line
+#define CMD_MLA 0x20
+#define CMD_MTA 0x40
+#define CMD_UNL 0x3F
+#define CMD_UNT 0x5F
+#define TALK_ONLY_ADDRESS 1
+#define WATCHDOG_S 5
+
+static const char * stepNames[] = {"command", "write", "read", "print", "ifc", "skipped"};
+
+typedef struct {
+  int type;
+  int command;         // ATN group, else data message
+  int talker;          // -1 none
+  uint32_t listeners;
+  int eoi;             // last byte sent with EOI
+  int len;
+  int size;
+  unsigned char * data;
+  simTime_t * time;    // recorded DAV of each byte
+  simTime_t * gap;     // to previous bus byte
+  simTime_t prev;      // previous bus byte of first one
+  simTime_t replay;    // bus time in replay
+} step_t;
+
+static step_t * steps = NULL;
+static int stepCount = 0;
+static int controller = -1;
+static int talkOnly = 1;       // no command in trace
+static int lostRecords = 0;
+static simTime_t traceStart = 0;
+static simTime_t traceEnd = 0;
+
+/* scripts of instruments, a message per step they take part in */
+static simMessage_t * scripts[31];
+static int scriptCounts[31];
+
+/* replay in progress */
+static struct {
+  int step;
+  int part;            // command lines of step sent
+  int pos;             // bytes of step sent or received
+  int reply;
+  char cmd[64];
+  simTime_t start;
+  simTime_t busy;      // bus time of instruments when step started
+} rp;
+
+static unsigned char rx[1024];
+static int rxLen = 0;
+static unsigned long errors = 0;
+static int hung = 0;
+static int verbose = 0;
+static simTime_t hangLimit = 10000*SIM_MS;
+static simTime_t replayStart = 0;
+static simTime_t lastSeen = 0;
+
+
+static step_t * NewStep(int type, int talker, uint32_t listeners, simTime_t prev)
+{
+  step_t * s;
+
+  if (0 == (stepCount & 255))
+  {
+    steps = realloc(steps, (stepCount+256)*sizeof(step_t));
+    if (!steps)
+    {
+      perror("gpibreplay");
+      exit(1);
+    }
+  }
+  s = &steps[stepCount++];
+  memset(s, 0, sizeof(*s));
+  s->type = type;
+  s->talker = talker;
+  s->listeners = listeners;
+  s->prev = prev;
+  return s;
+}
+
+
+static void AddByte(step_t * s, unsigned char c, simTime_t t)
+{
+  if (s->len == s->size)
+  {
+    s->size = s->size?2*s->size:64;
+    s->data = realloc(s->data, s->size);
+    s->time = realloc(s->time, s->size*sizeof(simTime_t));
+    if (!s->data || !s->time)
+    {
+      perror("gpibreplay");
+      exit(1);
+    }
+  }
+  s->data[s->len] = c;
+  s->time[s->len++] = t;
+}
+
+
+/* Cuts trace into command groups and data messages, addressing is followed
+   like instruments do. Command groups of addressing only are dropped, the
+   converter addresses by itself. */
+static int Load(const char * name)
+{
+  unsigned char r[SNIFF_RECORD_SIZE];
+  step_t * group = NULL;
+  step_t * msg = NULL;
+  uint64_t wraps = 0;
+  simTime_t t, prev = 0;
+  uint32_t listeners = 0;
+  int talker = -1;
+  int special = 0;
+  int ifc = 0;
+  int bytes = 0;
+  unsigned char c;
+  FILE * f = fopen(name, "rb");
+
+  if (!f)
+  {
+    perror(name);
+    return 0;
+  }
+  while (fread(r, 1, sizeof(r), f) == sizeof(r))
+  {
+    if (SNIFF_REC_WRAP == (r[0] & SNIFF_REC_MASK))
+      wraps++;
+    t = (wraps*65536 + (r[2] | (r[3] << 8))) * 2000 / 3; // 1.5 MHz ticks
+    lostRecords |= (r[0] & SNIFF_LOST)?1:0;
+
+    if ((r[0] & SNIFF_IFC) && !ifc)
+    {
+      NewStep(STEP_IFC, -1, 0, prev);
+      msg = group = NULL;
+      talker = -1;
+      listeners = 0;
+    }
+    ifc = r[0] & SNIFF_IFC;
+    if ((r[0] & SNIFF_ATN) || (msg && msg->eoi))
+      msg = NULL; // message ends at EOI or when controller takes the bus
+    if (!(r[0] & SNIFF_ATN))
+      group = NULL;
+    if (SNIFF_REC_DATA != (r[0] & SNIFF_REC_MASK))
+      continue;
+
+    if (!bytes++)
+      traceStart = t;
+    traceEnd = t;
+    c = r[1] & 0x7F;
+    if (r[0] & SNIFF_ATN)
+    {
+      talkOnly = 0;
+      if (!group)
+      {
+        group = NewStep(STEP_SKIP, -1, 0, prev);
+        group->command = 1;
+        special = 0;
+      }
+      AddByte(group, r[1], t);
+      if (CMD_UNL == c)
+        listeners = 0;
+      else if (CMD_UNT == c)
+        talker = -1;
+      else if ((c >= CMD_MLA) && (c < CMD_UNL))
+        listeners |= 1UL << (c & 0x1F);
+      else if ((c >= CMD_MTA) && (c < CMD_UNT))
+        talker = c & 0x1F;
+      else
+        special = 1;
+      group->type = special?STEP_COMMAND:STEP_SKIP; // plain addressing is done by converter
+    }
+    else
+    {
+      if (!msg)
+        msg = NewStep(STEP_SKIP, talker, listeners & ~((talker >= 0)?1UL << talker:0), prev);
+      AddByte(msg, r[1], t);
+      msg->eoi = (r[0] & SNIFF_EOI)?1:0;
+    }
+    prev = t;
+  }
+  fclose(f);
+  return 1;
+}
+
+
+/* address which takes part in most messages, on a tie 0 or 21 if among
+   them */
+static int FindController(void)
+{
+  int counts[31] = {0};
+  int best = 0;
+  int found = -1;
+  int i, a, n;
+
+  for (i=0; i<stepCount; i++)
+    if (!steps[i].command && (steps[i].talker >= 0))
+      for (a=0; a<31; a++)
+        counts[a] += ((steps[i].listeners | (1UL << steps[i].talker)) >> a) & 1;
+  for (a=0; a<31; a++)
+    best = (counts[a] > best)?counts[a]:best;
+  if (!best)
+    return -1;
+  if ((counts[0] == best) || (counts[21] == best))
+    return (counts[0] == best)?0:21;
+  for (a=0, n=0; a<31; a++)
+    if (counts[a] == best)
+      found = a, n++;
+  return (1 == n)?found:-1;
+}
+
+
+static void AddMessage(int address, step_t * s, int talk)
+{
+  simMessage_t * m;
+
+  if (0 == (scriptCounts[address] & 255))
+  {
+    scripts[address] = realloc(scripts[address], (scriptCounts[address]+256)*sizeof(simMessage_t));
+    if (!scripts[address])
+    {
+      perror("gpibreplay");
+      exit(1);
+    }
+  }
+  m = &scripts[address][scriptCounts[address]++];
+  m->talk = talk;
+  m->eoi = s->eoi;
+  m->len = s->len;
+  m->data = s->data;
+  m->gap = s->gap;
+}
+
+
+/* steps the converter replays and scripts of instruments */
+static int Prepare(void)
+{
+  step_t * s;
+  int i, a;
+
+  if (!talkOnly && (controller < 0))
+    controller = FindController();
+  if (!talkOnly && (controller < 0))
+  {
+    fprintf(stderr, "controller address not found, use -c\n");
+    return 0;
+  }
+
+  for (i=0; i<stepCount; i++)
+  {
+    s = &steps[i];
+    if (talkOnly && (STEP_IFC == s->type))
+      s->type = STEP_SKIP;
+    if ((STEP_SKIP != s->type) || ((s->talker < 0) && !talkOnly) || !s->len)
+      continue;
+    if (talkOnly)
+      s->type = STEP_PRINT;
+    else if (s->talker == controller)
+      s->type = (s->listeners & ~(1UL << controller))?STEP_WRITE:STEP_SKIP;
+    else if (s->listeners & (1UL << controller))
+      s->type = STEP_READ;
+  }
+
+  for (i=0; i<stepCount; i++)
+  {
+    s = &steps[i];
+    if ((STEP_WRITE != s->type) && (STEP_READ != s->type) && (STEP_PRINT != s->type))
+      continue;
+    s->gap = malloc(s->len*sizeof(simTime_t));
+    if (!s->gap)
+    {
+      perror("gpibreplay");
+      exit(1);
+    }
+    for (a=0; a<s->len; a++)
+      s->gap[a] = s->time[a] - (a?s->time[a-1]:s->prev);
+    if (STEP_PRINT == s->type)
+      AddMessage(TALK_ONLY_ADDRESS, s, 1);
+    else if (STEP_READ == s->type)
+      AddMessage(s->talker, s, 1);
+    else
+      for (a=0; a<31; a++)
+        if ((a != controller) && (s->listeners & (1UL << a)))
+          AddMessage(a, s, 0);
+  }
+
+  for (a=0; a<31; a++)
+    if (scriptCounts[a] && !SimDev_AddScript(a, scripts[a], scriptCounts[a], talkOnly))
+    {
+      fprintf(stderr, "too many instruments in trace\n");
+      return 0;
+    }
+  return 1;
+}
+
+
+/* instrument of replayed message */
+static int Instrument(const step_t * s)
+{
+  if (STEP_READ == s->type)
+    return s->talker;
+  if (STEP_WRITE == s->type)
+    return __builtin_ctzl(s->listeners & ~(1UL << controller));
+  return (STEP_PRINT == s->type)?TALK_ONLY_ADDRESS:-1;
+}
+
+
+static int Printable(const step_t * s)
+{
+  int i;
+
+  for (i=0; i<s->len; i++)
+    if ((s->data[i] < 0x20) || (s->data[i] > 0x7E))
+      return 0;
+  return 1;
+}
+
+
+static void Send(simTime_t t, int reply, const char * format, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap, format);
+  len = vsnprintf(rp.cmd, sizeof(rp.cmd), format, ap);
+  va_end(ap);
+  rp.reply = reply;
+  rxLen = 0;
+  Sim_UartWrite(rp.cmd, len, t);
+}
+
+
+/* T0C/T0D line with up to HEX_CHUNK bytes, ';' for data without EOI */
+static void SendHex(simTime_t t, char type, const unsigned char * data, int len, int eoi)
+{
+  char hex[2*HEX_CHUNK+1];
+  int i;
+
+  for (i=0; i<len; i++)
+    sprintf(hex+2*i, "%02X", data[i]);
+  Send(t, REPLY_STATUS, "T0%c%s%s\r", type, hex, (('D' == type) && !eoi)?";":"");
+}
+
+
+static int Status(void)
+{
+  return (4 == rxLen) && !memcmp(rx, "OK\r\n", 4);
+}
+
+
+static simTime_t Busy(void)
+{
+  simTime_t busy = 0;
+  int i;
+
+  for (i=0; i<simDeviceCount; i++)
+    busy += simDevices[i].scriptBusy;
+  return busy;
+}
+
+
+static void Hang(void)
+{
+  fprintf(stderr, "HANG: message %d (%s) not finished %.1f ms after start, last command ",
+          rp.step+1, stepNames[steps[rp.step].type], (simNow - rp.start)/1e6);
+  fwrite(rp.cmd, 1, strlen(rp.cmd)-1, stderr);
+  fprintf(stderr, ", %d bytes of %d\n  bus lines %02X data %02X (asserted)\n", rp.pos,
+          steps[rp.step].len, Sim_BusLines(), Sim_BusData());
+  SimDev_Report(stderr);
+  hung = 1;
+  Sim_Stop();
+}
+
+
+static void Begin(simTime_t t);
+
+
+static void Next(simTime_t t, int ok)
+{
+  step_t * s = &steps[rp.step];
+
+  s->replay = Busy() - rp.busy;
+  if (!ok)
+    errors++;
+  if (verbose)
+    printf("%12.3f ms %-7s %2d %6d bytes %10.3f ms %10.3f ms %s\n", rp.start/1e6, stepNames[s->type],
+           Instrument(s), s->len, s->len?(s->time[s->len-1] - s->time[0])/1e6:0.0, s->replay/1e6,
+           ok?"ok":"ERROR");
+  rp.step++;
+  Begin(t);
+}
+
+
+/* first or next command line of step */
+static void Step(simTime_t t)
+{
+  step_t * s = &steps[rp.step];
+  unsigned char addressing[33];
+  int n = 0;
+  int a;
+
+  switch (s->type)
+  {
+  case STEP_COMMAND:
+    if (rp.pos >= s->len)
+      Next(t, 1);
+    else
+    {
+      n = (s->len-rp.pos > HEX_CHUNK)?HEX_CHUNK:s->len-rp.pos;
+      SendHex(t, 'C', s->data+rp.pos, n, 1);
+      rp.pos += n;
+    }
+    break;
+  case STEP_WRITE:
+    if (!rp.part && s->eoi && (s->len <= WRITE_MAX) && Printable(s) &&
+        (__builtin_popcountl(s->listeners & ~(1UL << controller)) == 1))
+    {
+      Send(t, REPLY_STATUS, "W%02d%.*s\r", Instrument(s), s->len, s->data);
+      rp.pos = s->len;
+    }
+    else if (!rp.part) // unlisten, converter talks, instruments listen
+    {
+      addressing[n++] = CMD_UNL;
+      addressing[n++] = CMD_MTA + controller;
+      for (a=0; a<31; a++)
+        if ((a != controller) && (s->listeners & (1UL << a)) && (n < HEX_CHUNK))
+          addressing[n++] = CMD_MLA + a;
+      SendHex(t, 'C', addressing, n, 1);
+    }
+    else
+    {
+      n = (s->len-rp.pos > HEX_CHUNK)?HEX_CHUNK:s->len-rp.pos;
+      SendHex(t, 'D', s->data+rp.pos, n, s->eoi && (rp.pos+n == s->len));
+      rp.pos += n;
+    }
+    rp.part++;
+    break;
+  case STEP_READ:
+    if (!rp.pos)
+      SimDev_Offer(SimDev_Find(s->talker), t);
+    Send(t, REPLY_BLOCK, "V%02dY\r", s->talker);
+    break;
+  case STEP_IFC:
+    Send(t, REPLY_STATUS, "I\r");
+    break;
+  }
+}
+
+
+/* reply of current command line is complete at time t */
+static void Continue(simTime_t t)
+{
+  step_t * s = &steps[rp.step];
+  int n;
+
+  if (rp.step < 0) // converter set up, E0 and converter at controller address
+  {
+    if (!Status())
+    {
+      fprintf(stderr, "converter didn't take %.*s\n", (int)strlen(rp.cmd)-1, rp.cmd);
+      hung = 1;
+      Sim_Stop();
+    }
+    if (++rp.step < 0)
+    {
+      Send(t, REPLY_STATUS, "A%02d\r", controller);
+      return;
+    }
+    if (talkOnly)
+      Sim_UartWrite("P\r", 2, t); // printer mode doesn't reply
+    replayStart = t;
+    Begin(t);
+    return;
+  }
+
+  if (STEP_PRINT == s->type)
+  {
+    Next(t, !memcmp(rx, s->data, s->len));
+    return;
+  }
+  if (STEP_READ == s->type)
+  {
+    n = rx[0];
+    if ((rp.pos+n > s->len) || memcmp(rx+1, s->data+rp.pos, n))
+      Next(t, 0);
+    else if ((rp.pos += n) == s->len)
+      Next(t, 1);
+    else if (0 == n)
+      Next(t, 0); // message ended early, nothing more in converter's timeout
+    else
+      Step(t); // full block or talker paused
+    return;
+  }
+  if (!Status())
+  {
+    Next(t, 0);
+    return;
+  }
+  if ((STEP_WRITE == s->type) && (rp.pos < s->len))
+    Step(t);
+  else if (STEP_WRITE == s->type)
+    Next(t, 1);
+  else if (STEP_COMMAND == s->type)
+    Step(t);
+  else
+    Next(t, 1);
+}
+
+
+static void Begin(simTime_t t)
+{
+  while ((rp.step < stepCount) && (STEP_SKIP == steps[rp.step].type))
+    rp.step++;
+  if (rp.step >= stepCount)
+  {
+    Sim_Stop();
+    return;
+  }
+
+  rp.part = 0;
+  rp.pos = 0;
+  rp.start = t;
+  rp.busy = Busy();
+  Sim_At(t + hangLimit, Hang);
+  if (STEP_PRINT == steps[rp.step].type) // printer mode output goes on through all steps
+  {
+    rp.reply = REPLY_PRINT;
+    rxLen = 0;
+  }
+  else
+    Step(t);
+}
+
+
+static int Complete(void)
+{
+  if (REPLY_STATUS == rp.reply)
+    return rxLen && ('\n' == rx[rxLen-1]);
+  if (REPLY_BLOCK == rp.reply)
+    return rxLen && (rxLen == 1+rx[0]);
+  return rxLen == steps[rp.step].len;
+}
+
+
+static void Output(unsigned char c, simTime_t t)
+{
+  if (rxLen < (int)sizeof(rx))
+    rx[rxLen++] = c;
+  if (Complete())
+    Continue(t);
+}
+
+
+/* firmware which spins without touching hardware doesn't advance time */
+static void OnAlarm(int sig)
+{
+  if (simNow == lastSeen)
+  {
+    fprintf(stderr, "HANG: firmware stuck at %.6f s simulated time, message %d\n", simNow/1e9, rp.step+1);
+    SimDev_Report(stderr);
+    _exit(2);
+  }
+  lastSeen = simNow;
+  alarm(WATCHDOG_S);
+}
+
+
+int main(int argc, char * argv[])
+{
+  FILE * trace = NULL;
+  simTime_t recorded = 0;
+  simTime_t replayed = 0;
+  double limit = -1;
+  unsigned long bytes = 0;
+  int replayedCount = 0, skipped = 0;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "c:l:t:vw:")) != -1)
+  {
+    if ('c' == opt)
+      controller = atoi(optarg);
+    else if ('l' == opt)
+      limit = strtod(optarg, NULL);
+    else if ('t' == opt)
+      hangLimit = strtoul(optarg, NULL, 0)*SIM_MS;
+    else if ('v' == opt)
+      verbose = 1;
+    else if ('w' == opt)
+    {
+      trace = fopen(optarg, "wb");
+      if (!trace)
+      {
+        perror(optarg);
+        return 1;
+      }
+    }
+    else
+      optind = argc+1;
+  }
+  if ((optind != argc-1) || (controller > 30) || !hangLimit)
+  {
+    fprintf(stderr, "usage: %s [-c addr] [-l percent] [-t ms] [-v] [-w file] trace\n", argv[0]);
+    return 1;
+  }
+  if (!Load(argv[optind]) || !Prepare())
+    return 1;
+  if (lostRecords)
+    fprintf(stderr, "trace has lost records, replay may not match\n");
+
+  Sim_Trace(trace);
+  signal(SIGALRM, OnAlarm);
+  alarm(WATCHDOG_S);
+
+  rp.step = talkOnly?-1:-2;
+  Send(0, REPLY_STATUS, "E0\r");
+  Sim_Run(Output);
+  alarm(0);
+  if (trace)
+    fclose(trace);
+
+  for (i=0; i<stepCount; i++)
+  {
+    if (STEP_SKIP == steps[i].type)
+    {
+      skipped += !steps[i].command;
+      continue;
+    }
+    if ((STEP_WRITE != steps[i].type) && (STEP_READ != steps[i].type) && (STEP_PRINT != steps[i].type))
+      continue;
+    replayedCount++;
+    bytes += steps[i].len;
+    recorded += (steps[i].time[steps[i].len-1] - steps[i].time[0]) *
+                ((STEP_WRITE == steps[i].type)?__builtin_popcountl(steps[i].listeners & ~(1UL << controller)):1);
+  }
+  for (i=0; i<simDeviceCount; i++)
+  {
+    errors += simDevices[i].mismatches;
+    if (simDevices[i].scriptPos < simDevices[i].scriptCount)
+      errors++; // instrument still waits for messages
+  }
+  replayed = Busy();
+
+  printf("%d messages replayed, %d skipped, %lu bytes, %lu errors%s\n", replayedCount, skipped, bytes, errors,
+         hung?", not finished":"");
+  printf("bus time %.3f ms, recorded %.3f ms (%+.1f%%)\n", replayed/1e6, recorded/1e6,
+         recorded?100.0*((double)replayed - recorded)/recorded:0.0);
+  printf("elapsed %.3f ms, recorded %.3f ms\n", (simNow - replayStart)/1e6, (traceEnd - traceStart)/1e6);
+  SimDev_Report(stdout);
+
+  if ((limit >= 0) && (replayed > recorded*(1 + limit/100)))
+  {
+    printf("bus time over limit of %+.1f%%\n", limit);
+    return 1;
+  }
+  return (hung || errors)?1:0;
+}
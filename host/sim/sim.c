@@ -0,0 +1,431 @@
+/* Simulated ATmega32 around the firmware: registers, timers, interrupts and
+   UART, see sim.h. Time only moves when firmware touches the hardware, so a
+   run is deterministic and independent of host speed. */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include "sim.h"
+#include "simdev.h"
+#include "avr/io.h"
+#include "../../sw/sniff.h"
+
+#define TIFR_SENTINEL 0x80 // OCF2, not used by firmware, missing after write
+#define TIMER1_TICKS(ns) ((ns)*3/2000) // 1.5 MHz
+#define TIMER1_NS(ticks) ((ticks)*2000/3)
+#define UART_QUEUE_GROW 1024
+
+volatile uint8_t PORTA, PORTB, PORTC, PORTD;
+volatile uint8_t DDRA, DDRB, DDRC, DDRD;
+volatile uint8_t PINB, PIND;
+volatile uint8_t UCSRA, UCSRB, UCSRC, UBRRH, UBRRL, UDR;
+volatile uint8_t TIMSK, TCNT0, TCCR0, TCCR1A, TCCR1B;
+volatile uint8_t MCUCSR, WDTCR;
+
+simTime_t simNow = 0;
+
+int Firmware_Main();
+
+static volatile uint16_t tcnt1 = 0;
+static uint16_t tcnt1Read = 0; // value firmware got last, other one was written
+static simTime_t timer1Base = 0;
+static uint64_t tov1Cleared = 0; // overflows since base when TOV1 was cleared
+static volatile uint8_t tifr = TIFR_SENTINEL;
+
+static int interrupts = 0;
+static simTime_t t0Next = SIM_T0_NS;
+static int t0Pending = 0;
+static simTime_t wdtPeriod = 0;
+static simTime_t wdtLast = 0;
+
+static simTime_t hookTime = 0;
+static void (*hook)(void) = 0;
+static simOutput_t output = 0;
+static jmp_buf stopJump;
+
+/* bytes from PC still on the wire */
+typedef struct {
+  unsigned char c;
+  simTime_t t;
+} uartByte_t;
+static uartByte_t * pcQueue = 0;
+static size_t pcHead = 0, pcTail = 0, pcSize = 0;
+static simTime_t pcLast = 0;
+static unsigned long rxDropped = 0;
+
+/* converter buffers, same sizes as in sw/usart.c */
+static unsigned char rxBuf[SIM_UART_RX_SIZE];
+static unsigned char rxHead = 0, rxTail = 0;
+volatile unsigned char uartEscapes = 0;
+static simTime_t txFinish[SIM_UART_TX_SIZE];
+static unsigned char txHead = 0, txTail = 0;
+static simTime_t txLast = 0;
+
+static uint8_t busLines = 0;
+static uint8_t busData = 0;
+static uint8_t ifc = 0;
+static unsigned long clears = 0;
+
+static FILE * trace = 0;
+static uint8_t traceLines = 0;
+static uint64_t traceWraps = 0;
+
+
+static uint64_t Timer1Ticks(void)
+{
+  return TIMER1_TICKS(simNow - timer1Base);
+}
+
+
+/* TCNT1 and TIFR writes since last access, IFC pulse counted */
+static void Writes(void)
+{
+  if (tcnt1 != tcnt1Read)
+  {
+    timer1Base = simNow - TIMER1_NS((simTime_t)tcnt1);
+    tov1Cleared = 0;
+    tcnt1Read = tcnt1;
+  }
+  if (!(tifr & TIFR_SENTINEL))
+  {
+    if (tifr & _BV(TOV1)) // writing one clears the flag
+      tov1Cleared = Timer1Ticks() >> 16;
+    tifr = TIFR_SENTINEL;
+  }
+  if ((DDRC & ~PORTC & SIM_IFC) && !ifc)
+    clears++;
+  ifc = DDRC & ~PORTC & SIM_IFC;
+}
+
+
+/* bytes which have arrived go to receive buffer like in receive interrupt */
+static void Deliver(void)
+{
+  unsigned char next;
+
+  while ((pcHead != pcTail) && (pcQueue[pcTail].t <= simNow))
+  {
+    next = (rxHead + 1) & (SIM_UART_RX_SIZE - 1);
+    if (next != rxTail)
+    {
+      rxBuf[rxHead] = pcQueue[pcTail].c;
+      rxHead = next;
+      if (27 == pcQueue[pcTail].c)
+        uartEscapes++;
+    }
+    else
+      rxDropped++;
+    pcTail++;
+  }
+  if (pcHead == pcTail)
+    pcHead = pcTail = 0;
+}
+
+
+static void Advance(simTime_t ns)
+{
+  void (*f)(void);
+
+  Writes();
+  simNow += ns;
+  Deliver();
+
+  if (TCCR0 && (simNow >= t0Next))
+  {
+    while (simNow >= t0Next)
+      t0Next += SIM_T0_NS;
+    t0Pending = 1; // overflows while interrupts are off give one interrupt
+  }
+  if (t0Pending && interrupts && (TIMSK & _BV(TOIE0)))
+  {
+    t0Pending = 0;
+    interrupts = 0;
+    Sim_Timer0Overflow();
+    interrupts = 1;
+  }
+
+  if (wdtPeriod && (simNow - wdtLast > wdtPeriod))
+  {
+    fprintf(stderr, "sim: watchdog reset at %.6f s, not simulated\n", simNow/1e9);
+    Sim_Stop();
+  }
+
+  if (hook && (simNow >= hookTime))
+  {
+    f = hook;
+    hook = 0;
+    f();
+  }
+}
+
+
+static void TraceRecord(uint8_t flags, uint8_t data, uint64_t ticks)
+{
+  unsigned char r[SNIFF_RECORD_SIZE] = {flags, data, ticks & 0xFF, (ticks >> 8) & 0xFF};
+
+  fwrite(r, 1, sizeof(r), trace);
+}
+
+
+/* bus bytes (DAV asserted) and changes of ATN/SRQ/REN/IFC as analyzer
+   records, with a wrap record at each overflow of the 16 bit timestamp */
+static void Trace(void)
+{
+  uint64_t ticks = TIMER1_TICKS(simNow);
+  uint8_t flags = ((busLines & SIM_ATN)?SNIFF_ATN:0) | ((busLines & SIM_EOI)?SNIFF_EOI:0) |
+                  ((busLines & SIM_SRQ)?SNIFF_SRQ:0) | ((busLines & SIM_REN)?SNIFF_REN:0) |
+                  ((busLines & SIM_IFC)?SNIFF_IFC:0);
+  uint8_t hs = ((busLines & SIM_DAV)?SNIFF_HS_DAV:0) | ((busLines & SIM_NRFD)?SNIFF_HS_NRFD:0) |
+               ((busLines & SIM_NDAC)?SNIFF_HS_NDAC:0);
+  uint8_t changed = busLines ^ traceLines;
+
+  for (; (ticks >> 16) > traceWraps; traceWraps++)
+    TraceRecord(SNIFF_REC_WRAP | flags, hs, 0);
+  if (changed & (SIM_ATN | SIM_SRQ | SIM_REN | SIM_IFC))
+    TraceRecord(SNIFF_REC_LINES | flags, hs, ticks);
+  if ((changed & busLines) & SIM_DAV)
+    TraceRecord(SNIFF_REC_DATA | flags, busData, ticks);
+  traceLines = busLines;
+}
+
+
+/* lines of converter and devices until devices don't change them */
+static void Resolve(void)
+{
+  int n;
+
+  for (n=0; n<16; n++)
+  {
+    busLines = (DDRC & ~PORTC) | SimDev_Lines();
+    busData = (DDRA & ~PORTA) | SimDev_Data();
+    if (!SimDev_Step(busLines, busData))
+      break;
+  }
+  if (trace)
+    Trace();
+}
+
+
+uint8_t Sim_PINA(void)
+{
+  Advance(SIM_ACCESS_NS);
+  Resolve();
+  return ~busData;
+}
+
+
+uint8_t Sim_PINC(void)
+{
+  Advance(SIM_ACCESS_NS);
+  Resolve();
+  return ~busLines;
+}
+
+
+volatile uint16_t * Sim_TCNT1(void)
+{
+  Advance(SIM_ACCESS_NS);
+  tcnt1 = tcnt1Read = Timer1Ticks() & 0xFFFF;
+  return &tcnt1;
+}
+
+
+volatile uint8_t * Sim_TIFR(void)
+{
+  Advance(SIM_ACCESS_NS);
+  tifr = TIFR_SENTINEL | (((Timer1Ticks() >> 16) > tov1Cleared)?_BV(TOV1):0);
+  return &tifr;
+}
+
+
+void Sim_Interrupts(int enable)
+{
+  interrupts = enable;
+  if (enable)
+    Advance(0); // pending interrupt runs now
+}
+
+
+void Sim_Delay(simTime_t ns)
+{
+  Advance(ns);
+}
+
+
+void Sim_Watchdog(int timeout)
+{
+  wdtPeriod = (timeout < 0)?0:(15*SIM_MS << timeout);
+  wdtLast = simNow;
+}
+
+
+void Sim_WatchdogReset(void)
+{
+  wdtLast = simNow;
+}
+
+
+void Sim_Trace(FILE * f)
+{
+  trace = f;
+}
+
+
+void Sim_At(simTime_t t, void (*f)(void))
+{
+  hookTime = t;
+  hook = f;
+}
+
+
+void Sim_Run(simOutput_t out)
+{
+  output = out;
+  PINB = _BV(PB5); // printer mode and local echo jumpers open
+  if (!setjmp(stopJump))
+    Firmware_Main();
+}
+
+
+void Sim_Stop(void)
+{
+  longjmp(stopJump, 1);
+}
+
+
+void Sim_UartWrite(const void * data, size_t len, simTime_t t)
+{
+  const unsigned char * p = data;
+  size_t i;
+
+  if (pcHead + len > pcSize)
+  {
+    pcSize = pcHead + len + UART_QUEUE_GROW;
+    pcQueue = realloc(pcQueue, pcSize * sizeof(uartByte_t));
+    if (!pcQueue)
+    {
+      perror("sim");
+      exit(1);
+    }
+  }
+  if (t < pcLast)
+    t = pcLast;
+  for (i=0; i<len; i++)
+  {
+    t += SIM_BYTE_NS;
+    pcQueue[pcHead].c = p[i];
+    pcQueue[pcHead].t = t;
+    pcHead++;
+  }
+  pcLast = t;
+}
+
+
+unsigned long Sim_UartDropped(void)
+{
+  return rxDropped;
+}
+
+
+uint8_t Sim_BusLines(void)
+{
+  Resolve();
+  return busLines;
+}
+
+
+uint8_t Sim_BusData(void)
+{
+  Resolve();
+  return busData;
+}
+
+
+unsigned long Sim_Clears(void)
+{
+  return clears;
+}
+
+
+/* ------- sw/usart.h ------- */
+
+int Sim_UartAvailable(void)
+{
+  Advance(SIM_LOOP_NS);
+  return rxHead != rxTail;
+}
+
+
+void UART_init(void)
+{
+}
+
+
+static void TxDrain(void)
+{
+  while ((txHead != txTail) && (txFinish[txTail] <= simNow))
+    txTail = (txTail + 1) & (SIM_UART_TX_SIZE - 1);
+}
+
+
+void UART_transmit(unsigned char data)
+{
+  unsigned char next = (txHead + 1) & (SIM_UART_TX_SIZE - 1);
+
+  TxDrain();
+  if (next == txTail) // buffer full, wait for oldest byte
+  {
+    Advance(txFinish[txTail] - simNow);
+    TxDrain();
+  }
+  txLast = ((txLast > simNow)?txLast:simNow) + SIM_BYTE_NS;
+  txFinish[txHead] = txLast;
+  txHead = next;
+  if (output)
+    output(data, txLast);
+}
+
+
+unsigned char UART_receive(void)
+{
+  unsigned char data;
+
+  while (!Sim_UartAvailable());
+  data = rxBuf[rxTail];
+  rxTail = (rxTail + 1) & (SIM_UART_RX_SIZE - 1);
+  if (27 == data)
+    uartEscapes--;
+  return data;
+}
+
+
+unsigned char UART_peek(void)
+{
+  return rxBuf[rxTail];
+}
+
+
+unsigned char UART_TxFree(void)
+{
+  TxDrain();
+  return (txTail - txHead - 1) & (SIM_UART_TX_SIZE - 1);
+}
+
+
+int Sim_printf(const char * format, ...)
+{
+  char buf[4096];
+  va_list ap;
+  int len, i;
+
+  va_start(ap, format);
+  len = vsnprintf(buf, sizeof(buf), format, ap);
+  va_end(ap);
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf)-1;
+  for (i=0; i<len; i++)
+    UART_transmit(buf[i]);
+  return len;
+}
@@ -0,0 +1,60 @@
+#ifndef SIM_HEADER
+#define SIM_HEADER
+
+/* Host build of the converter firmware. The sources in sw/ are compiled
+   unchanged against the shims in this directory: register reads advance
+   simulated time and let the instrument models on the simulated bus
+   react, the UART is replaced by queues with 115200 baud timing. Firmware
+   main() becomes Firmware_Main() and runs until Sim_Stop(). */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint64_t simTime_t; // ns
+
+#define SIM_US 1000ULL
+#define SIM_MS 1000000ULL
+#define SIM_ACCESS_NS 250     // one pin or timer read, a few instructions
+#define SIM_LOOP_NS 1000      // main loop pass when nothing arrived from PC
+#define SIM_BYTE_NS 86806     // 10 bits at 115200 baud
+#define SIM_T0_NS 10922667    // timer 0 overflow, 128 counts of 12 MHz/1024
+#define SIM_UART_RX_SIZE 64   // UART_RX_BUF_SIZE in sw/usart.h
+#define SIM_UART_TX_SIZE 64   // UART_TX_BUF_SIZE in sw/usart.h
+
+extern simTime_t simNow;
+
+/* registers, see avr/io.h */
+uint8_t Sim_PINA(void);
+uint8_t Sim_PINC(void);
+volatile uint16_t * Sim_TCNT1(void);
+volatile uint8_t * Sim_TIFR(void);
+void Sim_Interrupts(int enable);
+void Sim_Delay(simTime_t ns);
+void Sim_Watchdog(int timeout);
+void Sim_WatchdogReset(void);
+void Sim_Timer0Overflow(void); // firmware timer 0 interrupt
+
+/* Runs firmware until Sim_Stop() is called from a hook. Output hook gets
+   every byte the converter sends with the time it has left the UART. */
+typedef void (*simOutput_t)(unsigned char c, simTime_t t);
+void Sim_Run(simOutput_t output);
+void Sim_Stop(void);
+
+/* bus bytes and changes of ATN/SRQ/REN/IFC are written to f as analyzer
+   records (sw/sniff.h), the format gpibsniff -w saves from a real bus */
+void Sim_Trace(FILE * f);
+
+/* f is called once when simulated time reaches t, replaces earlier one */
+void Sim_At(simTime_t t, void (*f)(void));
+
+/* bytes from PC, they arrive one after another from time t on */
+void Sim_UartWrite(const void * data, size_t len, simTime_t t);
+unsigned long Sim_UartDropped(void); // bytes lost in full converter buffer
+
+/* host side of bus lines, active (asserted) bits, see sw/gpib.h */
+uint8_t Sim_BusLines(void);
+uint8_t Sim_BusData(void);
+unsigned long Sim_Clears(void); // IFC pulses of converter
+
+#endif
@@ -0,0 +1,573 @@
+/* Instrument models on the simulated bus, see simdev.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simdev.h"
+
+/* acceptor handshake */
+#define AH_IDLE 0     // not listening, lines released
+#define AH_NOTREADY 1 // NRFD and NDAC asserted until due
+#define AH_READY 2    // NRFD released, waiting for DAV
+#define AH_ACCEPT 3   // byte latched, NDAC released at due
+#define AH_WAITDAV 4  // waiting for DAV released
+
+/* source handshake */
+#define SH_IDLE 0
+#define SH_WAITREADY 1  // byte on data lines, waiting for all listeners ready
+#define SH_DAVDELAY 2   // DAV asserted at davDue
+#define SH_WAITACCEPT 3 // waiting for all listeners to accept
+
+typedef struct {
+  const char * name;
+  simTime_t ready, accept, dav, cmd, reply;
+  int size, eos, eoi, binary, srq, stallEvery, stallAfter;
+  simTime_t pause;
+  int pauseAt;
+} simModel_t;
+
+static const simModel_t models[] = {
+  {"dso", 1*SIM_US, 1*SIM_US, 1*SIM_US, 2*SIM_US, 2*SIM_MS, 4000, 0, 1, 1, 0, 0, 0, 0, 0},
+  {"plotter", 2*SIM_MS, 10*SIM_US, 10*SIM_US, 5*SIM_US, 10*SIM_MS, 14, 1, 1, 0, 0, 0, 0, 0, 0},
+  {"dmm", 5*SIM_US, 5*SIM_US, 10*SIM_US, 3*SIM_US, 20*SIM_MS, 14, 1, 1, 0, 0, 0, 0, 0, 0},
+  {"srq", 5*SIM_US, 5*SIM_US, 10*SIM_US, 3*SIM_US, 50*SIM_MS, 56, 1, 1, 0, 1, 0, 0, 0, 0},
+  {"flaky", 5*SIM_US, 5*SIM_US, 10*SIM_US, 3*SIM_US, 20*SIM_MS, 14, 1, 1, 0, 0, 7, 3, 0, 0},
+  {"pausing", 5*SIM_US, 5*SIM_US, 10*SIM_US, 3*SIM_US, 20*SIM_MS, 28, 1, 1, 0, 0, 0, 0, 50*SIM_MS, 5},
+};
+
+simDevice_t simDevices[SIMDEV_MAX];
+int simDeviceCount = 0;
+
+
+simDevice_t * SimDev_Add(const char * model, int address)
+{
+  const simModel_t * m = 0;
+  simDevice_t * d;
+  unsigned int i;
+
+  for (i=0; i<sizeof(models)/sizeof(models[0]); i++)
+    if (!strcmp(models[i].name, model))
+      m = &models[i];
+  if (!m || (simDeviceCount >= SIMDEV_MAX) || (address < 0) || (address > 30) || SimDev_Find(address))
+    return 0;
+
+  d = &simDevices[simDeviceCount++];
+  memset(d, 0, sizeof(*d));
+  snprintf(d->model, sizeof(d->model), "%s", m->name);
+  d->address = address;
+  d->readyDelay = m->ready;
+  d->acceptDelay = m->accept;
+  d->davDelay = m->dav;
+  d->cmdDelay = m->cmd;
+  d->replyDelay = m->reply;
+  d->replySize = m->size;
+  d->eos = m->eos;
+  d->eoi = m->eoi;
+  d->binary = m->binary;
+  d->srq = m->srq;
+  d->stallEvery = m->stallEvery;
+  d->stallAfter = m->stallAfter;
+  d->pause = m->pause;
+  d->pauseAt = m->pauseAt;
+  d->stallIn = d->stallOut = -1;
+  return d;
+}
+
+
+simDevice_t * SimDev_Find(int address)
+{
+  int i;
+
+  for (i=0; i<simDeviceCount; i++)
+    if (simDevices[i].address == address)
+      return &simDevices[i];
+  return 0;
+}
+
+
+/* scripted device goes on with next message, talker output is prepared */
+static void NextMessage(simDevice_t * d)
+{
+  const simMessage_t * m;
+
+  d->scriptPos++;
+  d->scriptByte = 0;
+  d->outLen = d->outPos = 0;
+  if (d->scriptPos >= d->scriptCount)
+    return;
+  m = &d->script[d->scriptPos];
+  if (!m->talk)
+    return;
+  d->out = m->data;
+  d->outLen = m->len;
+  d->eoi = m->eoi;
+  d->outReady = simNow + m->gap[0];
+  d->held = !d->talkOnly;
+  d->replies++;
+}
+
+
+static const simMessage_t * Scripted(const simDevice_t * d)
+{
+  return (d->script && (d->scriptPos < d->scriptCount))?&d->script[d->scriptPos]:0;
+}
+
+
+/* handshake of dso model, pacing comes from script */
+simDevice_t * SimDev_AddScript(int address, const simMessage_t * script, int count, int talkOnly)
+{
+  simDevice_t * d = SimDev_Add("dso", address);
+
+  if (!d)
+    return 0;
+  strcpy(d->model, "trace");
+  d->script = script;
+  d->scriptCount = count;
+  d->talk = d->talkOnly = talkOnly;
+  d->scriptPos = -1;
+  NextMessage(d);
+  return d;
+}
+
+
+void SimDev_Offer(simDevice_t * d, simTime_t t)
+{
+  const simMessage_t * m = Scripted(d);
+
+  if (!m || !m->talk || !d->held)
+    return;
+  d->held = 0;
+  d->outReady = t + m->gap[0];
+}
+
+
+int SimDev_Set(simDevice_t * d, const char * key, const char * value)
+{
+  double v = strtod(value, 0);
+  simTime_t t = (v > 0)?(simTime_t)(v*SIM_US):0;
+
+  if (!strcmp(key, "ready"))
+    d->readyDelay = t;
+  else if (!strcmp(key, "accept"))
+    d->acceptDelay = t;
+  else if (!strcmp(key, "dav"))
+    d->davDelay = t;
+  else if (!strcmp(key, "cmd"))
+    d->cmdDelay = t;
+  else if (!strcmp(key, "reply"))
+    d->replyDelay = t;
+  else if (!strcmp(key, "size") && (v >= 1) && (v <= 65535))
+    d->replySize = (int)v;
+  else if (!strcmp(key, "eos"))
+    d->eos = (v != 0);
+  else if (!strcmp(key, "eoi"))
+    d->eoi = (v != 0);
+  else if (!strcmp(key, "binary"))
+    d->binary = (v != 0);
+  else if (!strcmp(key, "srq"))
+    d->srq = (v != 0);
+  else if (!strcmp(key, "stall") && (v >= 0))
+    d->stallEvery = (int)v;
+  else if (!strcmp(key, "after") && (v >= 0))
+    d->stallAfter = (int)v;
+  else if (!strcmp(key, "pause"))
+    d->pause = t;
+  else if (!strcmp(key, "at") && (v >= 0))
+    d->pauseAt = (int)v;
+  else
+    return 0;
+  return 1;
+}
+
+
+/* binary pattern or comma separated numbers as long as they fit */
+int SimDev_Reply(const simDevice_t * d, unsigned long index, unsigned char * buf)
+{
+  int end = d->replySize - (d->eos?1:0);
+  int len = 0;
+  char num[32];
+  int n, k;
+
+  if (d->binary)
+    for (len=0; len<end; len++)
+      buf[len] = (index*31 + len*7 + d->address) & 0xFF;
+  else
+    for (k=0; ; k++)
+    {
+      n = snprintf(num, sizeof(num), "%s%+.6E", k?",":"",
+                   ((long)((index*131 + k*17) % 20000) - 10000)/1000.0);
+      if (len+n > end)
+        break;
+      memcpy(buf+len, num, n);
+      len += n;
+    }
+  if (d->eos)
+    buf[len++] = '\n';
+  return len;
+}
+
+
+static int Stalls(const simDevice_t * d, unsigned long n)
+{
+  return d->stallEvery && (0 == n % d->stallEvery);
+}
+
+
+static int ReplyPending(const simDevice_t * d)
+{
+  return (d->outPos < d->outLen) && (simNow >= d->outReady) && !d->held;
+}
+
+
+static int ServiceRequest(const simDevice_t * d)
+{
+  return d->srq && ReplyPending(d) && !d->srqServiced;
+}
+
+
+static void Clear(simDevice_t * d)
+{
+  if (d->script) // recorded messages go on
+    return;
+  d->inLen = 0;
+  d->outLen = d->outPos = 0;
+}
+
+
+static void Message(simDevice_t * d)
+{
+  int n = d->inLen;
+
+  while (n && (('\n' == d->in[n-1]) || ('\r' == d->in[n-1])))
+    n--;
+  d->messages++;
+  d->inLen = 0;
+  if (!n || ('?' != d->in[n-1]))
+    return;
+
+  if (!d->out)
+    d->out = malloc(65536);
+  if (!d->out)
+  {
+    perror("sim");
+    exit(1);
+  }
+  d->outLen = SimDev_Reply(d, d->replies++, d->out);
+  d->outPos = 0;
+  d->outReady = simNow + d->replyDelay;
+  d->srqServiced = 0;
+  d->stallOut = Stalls(d, d->replies)?d->stallAfter:-1;
+}
+
+
+/* byte received by scripted device against the recorded one */
+static void ScriptIn(simDevice_t * d)
+{
+  const simMessage_t * m = Scripted(d);
+
+  if (!m || m->talk)
+  {
+    d->mismatches++;
+    return;
+  }
+  if (!d->scriptByte)
+    d->firstDav = d->lastDav;
+  if ((d->byte != m->data[d->scriptByte]) || (d->byteEoi != ((d->scriptByte == m->len-1) && m->eoi)))
+    d->mismatches++;
+  if ((++d->scriptByte == m->len) || d->byteEoi)
+  {
+    d->scriptBusy += d->lastDav - d->firstDav;
+    d->messages++;
+    NextMessage(d);
+  }
+}
+
+
+/* accepted byte, interface command or device data */
+static void Take(simDevice_t * d)
+{
+  const simMessage_t * m = Scripted(d);
+  unsigned char c = d->byte & 0x7F;
+  unsigned char addr = c & 0x1F;
+
+  if (m && m->talk && !d->outPos)
+    d->outReady = simNow + m->gap[0];
+
+  if (d->byteAtn)
+  {
+    if (0x3F == c) // UNL
+      d->listen = 0;
+    else if ((c >= 0x20) && (c < 0x3F) && (addr == d->address)) // MLA
+      d->listen = 1, d->talk = 0;
+    else if (0x5F == c) // UNT
+      d->talk = 0;
+    else if ((c >= 0x40) && (c < 0x5F)) // MTA, other talker unaddresses
+    {
+      d->talk = (addr == d->address);
+      if (d->talk)
+        d->listen = 0;
+    }
+    else if (0x18 == c) // SPE
+      d->serialPoll = 1;
+    else if (0x19 == c) // SPD
+      d->serialPoll = 0;
+    else if ((0x14 == c) || ((0x04 == c) && d->listen)) // DCL, SDC
+      Clear(d);
+    return;
+  }
+
+  d->bytesIn++;
+  if (d->script)
+  {
+    ScriptIn(d);
+    return;
+  }
+  if (d->inLen < SIMDEV_IN_SIZE)
+    d->in[d->inLen++] = d->byte;
+  if (d->byteEoi || ('\n' == d->byte))
+    Message(d);
+}
+
+
+static void Acceptor(simDevice_t * d, unsigned char lines, unsigned char data, int atn)
+{
+  const simMessage_t * m;
+
+  if (!atn && !d->listen)
+  {
+    d->acceptor = AH_IDLE;
+    d->drive &= ~(SIM_NRFD | SIM_NDAC);
+    return;
+  }
+
+  switch (d->acceptor)
+  {
+  case AH_IDLE:
+    d->drive |= SIM_NRFD | SIM_NDAC;
+    d->due = simNow + (atn?d->cmdDelay:d->readyDelay);
+    d->acceptor = AH_NOTREADY;
+    break;
+  case AH_NOTREADY:
+    if (simNow >= d->due)
+    {
+      d->drive &= ~SIM_NRFD;
+      d->acceptor = AH_READY;
+    }
+    break;
+  case AH_READY:
+    if (lines & SIM_DAV)
+    {
+      d->drive |= SIM_NRFD;
+      d->byte = data;
+      d->byteAtn = atn?1:0;
+      d->byteEoi = (lines & SIM_EOI)?1:0;
+      if (!atn)
+        d->lastDav = simNow;
+      d->due = simNow + (atn?d->cmdDelay:d->acceptDelay);
+      d->acceptor = AH_ACCEPT;
+    }
+    break;
+  case AH_ACCEPT:
+    if (simNow < d->due)
+      break;
+    if (!d->byteAtn && !d->inLen)
+      d->stallIn = Stalls(d, d->messages+1)?d->stallAfter:-1;
+    if (!d->byteAtn && (d->stallIn == d->inLen))
+    {
+      d->stalled = 1; // NRFD and NDAC stay asserted
+      d->stalls++;
+      break;
+    }
+    Take(d);
+    d->drive &= ~SIM_NDAC;
+    d->acceptor = AH_WAITDAV;
+    break;
+  case AH_WAITDAV:
+    if (!(lines & SIM_DAV))
+    {
+      d->drive |= SIM_NDAC;
+      d->due = simNow + (atn?d->cmdDelay:d->readyDelay);
+      m = Scripted(d);
+      if (!atn && m && !m->talk && d->scriptByte && (d->lastDav + m->gap[d->scriptByte] > d->due))
+        d->due = d->lastDav + m->gap[d->scriptByte];
+      d->acceptor = AH_NOTREADY;
+    }
+    break;
+  }
+}
+
+
+/* status byte in serial poll, RQS and MAV */
+static unsigned char Status(const simDevice_t * d)
+{
+  return (ServiceRequest(d)?0x40:0) | (ReplyPending(d)?0x10:0);
+}
+
+
+static void Source(simDevice_t * d, unsigned char lines, int atn)
+{
+  const simMessage_t * m = Scripted(d);
+  int poll = d->serialPoll && !d->script; // scripted status byte is a message
+  int last;
+
+  if (atn || !d->talk || (!poll && !ReplyPending(d)))
+  {
+    d->drive &= ~(SIM_DAV | SIM_EOI);
+    d->data = 0;
+    d->source = SH_IDLE;
+    return;
+  }
+
+  switch (d->source)
+  {
+  case SH_IDLE:
+    d->data = poll?Status(d):d->out[d->outPos];
+    last = poll || ((d->outPos == d->outLen-1) && d->eoi);
+    d->drive = last?(d->drive | SIM_EOI):(d->drive & ~SIM_EOI);
+    d->source = SH_WAITREADY;
+    break;
+  case SH_WAITREADY:
+    if (!(lines & SIM_NRFD) && (lines & SIM_NDAC)) // all ready, someone listens
+    {
+      d->davDue = simNow + d->davDelay;
+      if (m && d->outPos && (d->lastDav + m->gap[d->outPos] > d->davDue))
+        d->davDue = d->lastDav + m->gap[d->outPos];
+      if (d->resume > d->davDue)
+        d->davDue = d->resume;
+      d->source = SH_DAVDELAY;
+    }
+    break;
+  case SH_DAVDELAY:
+    if (simNow >= d->davDue)
+    {
+      d->drive |= SIM_DAV;
+      d->source = SH_WAITACCEPT;
+      if (!d->outPos)
+        d->firstDav = simNow;
+      d->lastDav = simNow;
+    }
+    break;
+  case SH_WAITACCEPT:
+    if (lines & SIM_NDAC)
+      break;
+    d->drive &= ~(SIM_DAV | SIM_EOI);
+    d->data = 0;
+    d->source = SH_IDLE;
+    d->bytesOut++;
+    if (poll)
+      d->srqServiced = 1;
+    else if (++d->outPos == d->stallOut)
+    {
+      d->stalled = 1; // rest of reply never comes
+      d->stalls++;
+    }
+    else if (d->pause && (d->outPos == d->pauseAt) && (d->outPos < d->outLen))
+    {
+      d->resume = simNow + d->pause; // addressing again doesn't restart it
+      d->pauses++;
+    }
+    else if (m && (d->outPos == d->outLen))
+    {
+      d->scriptBusy += d->lastDav - d->firstDav;
+      NextMessage(d);
+    }
+    break;
+  }
+}
+
+
+/* ATN gets stalled device going again, interrupted message or reply is lost */
+static void Recover(simDevice_t * d)
+{
+  d->stalled = 0;
+  if (AH_ACCEPT == d->acceptor)
+  {
+    d->inLen = 0;
+    d->messages++;
+  }
+  else
+    d->outLen = d->outPos = 0;
+  d->acceptor = AH_IDLE;
+  d->source = SH_IDLE;
+  d->drive &= ~(SIM_NRFD | SIM_NDAC | SIM_DAV | SIM_EOI);
+  d->data = 0;
+}
+
+
+static int Step(simDevice_t * d, unsigned char lines, unsigned char data)
+{
+  unsigned char drive = d->drive;
+  unsigned char out = d->data;
+  int acceptor = d->acceptor;
+  int source = d->source;
+  int atn = lines & SIM_ATN;
+
+  if (lines & SIM_IFC)
+    d->listen = d->talk = d->serialPoll = 0;
+  if (d->stalled && !atn)
+    return 0;
+  if (d->stalled)
+    Recover(d);
+
+  Acceptor(d, lines, data, atn);
+  Source(d, lines, atn);
+  d->drive = ServiceRequest(d)?(d->drive | SIM_SRQ):(d->drive & ~SIM_SRQ);
+
+  return (drive != d->drive) || (out != d->data) || (acceptor != d->acceptor) || (source != d->source);
+}
+
+
+int SimDev_Step(unsigned char lines, unsigned char data)
+{
+  int changed = 0;
+  int i;
+
+  for (i=0; i<simDeviceCount; i++)
+    changed |= Step(&simDevices[i], lines, data);
+  return changed;
+}
+
+
+unsigned char SimDev_Lines(void)
+{
+  unsigned char lines = 0;
+  int i;
+
+  for (i=0; i<simDeviceCount; i++)
+    lines |= simDevices[i].drive;
+  return lines;
+}
+
+
+unsigned char SimDev_Data(void)
+{
+  unsigned char data = 0;
+  int i;
+
+  for (i=0; i<simDeviceCount; i++)
+    data |= simDevices[i].data;
+  return data;
+}
+
+
+void SimDev_Report(FILE * f)
+{
+  static const char * lineNames[8] = {"REN", "ATN", "SRQ", "IFC", "NDAC", "NRFD", "DAV", "EOI"};
+  const simDevice_t * d;
+  int i, b;
+
+  for (i=0; i<simDeviceCount; i++)
+  {
+    d = &simDevices[i];
+    fprintf(f, "  %2d %-8s msg %lu reply %lu in %lu out %lu stalls %lu pauses %lu%s%s%s",
+            d->address, d->model, d->messages, d->replies, d->bytesIn, d->bytesOut, d->stalls, d->pauses,
+            d->listen?", listener":"", d->talk?", talker":"", d->stalled?", STALLED":"");
+    if (d->script)
+      fprintf(f, ", script %d/%d, %lu mismatches", d->scriptPos, d->scriptCount, d->mismatches);
+    fprintf(f, ", AH%d SH%d, drives", d->acceptor, d->source);
+    for (b=7; b>=0; b--)
+      if (d->drive & (1 << b))
+        fprintf(f, " %s", lineNames[b]);
+    fprintf(f, "\n");
+  }
+}
@@ -0,0 +1,137 @@
+#ifndef SIMDEV_HEADER
+#define SIMDEV_HEADER
+
+/* Instrument models on the simulated bus. A device follows addressing
+   commands, accepts data as listener with its own handshake latencies and
+   answers messages ending with '?' after its reply delay, as talker, with
+   a reply of configurable size, EOS (LF) and EOI. Faulty devices stop
+   handshaking in the middle of some messages until ATN is asserted again,
+   slow talkers pause in the middle of every reply.
+   Scripted devices replay the messages of a recorded trace instead. */
+
+#include <stdio.h>
+#include "sim.h"
+
+/* bus lines, bits of PINC (sw/gpib.h), set when asserted */
+#define SIM_EOI 0x80
+#define SIM_DAV 0x40
+#define SIM_NRFD 0x20
+#define SIM_NDAC 0x10
+#define SIM_IFC 0x08
+#define SIM_SRQ 0x04
+#define SIM_ATN 0x02
+#define SIM_REN 0x01
+
+#define SIMDEV_MAX 15
+#define SIMDEV_IN_SIZE 1024
+
+/* message of a scripted device: bytes it sends as talker or expects as
+   listener, byte i not earlier than gap[i] after the previous bus byte
+   (DAV to DAV), for gap[0] any byte the device has seen */
+typedef struct {
+  int talk;
+  int eoi;               // last byte sent with EOI
+  int len;
+  unsigned char * data;
+  simTime_t * gap;
+} simMessage_t;
+
+typedef struct {
+  /* configuration */
+  char model[16];
+  int address;
+  simTime_t readyDelay;  // byte taken until ready for next one (NRFD)
+  simTime_t acceptDelay; // DAV seen until byte accepted (NDAC)
+  simTime_t davDelay;    // listeners ready until DAV, as talker
+  simTime_t cmdDelay;    // ready/accept latency for ATN commands, interface chip
+  simTime_t replyDelay;  // query received until reply is available
+  int replySize;         // reply bytes, LF included
+  int eos;               // reply ends with LF
+  int eoi;               // EOI sent with last reply byte
+  int binary;            // binary data instead of comma separated numbers
+  int srq;               // SRQ asserted while reply is waiting
+  int stallEvery;        // every n-th message and reply stops (0 never) ...
+  int stallAfter;        // ... after this many bytes
+  simTime_t pause;       // reply pauses (0 never) ...
+  int pauseAt;           // ... after this many bytes
+  const simMessage_t * script;
+  int scriptCount;
+  int talkOnly;          // scripted talker which is never addressed
+
+  /* interface state */
+  int listen;
+  int talk;
+  int serialPoll;
+  int stalled;
+  int acceptor;          // acceptor handshake state
+  int source;            // talker handshake state
+  simTime_t due;         // end of current acceptor latency
+  simTime_t davDue;
+  unsigned char byte;
+  unsigned char byteAtn;
+  unsigned char byteEoi;
+  unsigned char drive;   // asserted lines
+  unsigned char data;    // asserted data lines
+
+  /* device state */
+  unsigned char in[SIMDEV_IN_SIZE];
+  int inLen;
+  unsigned char * out;
+  int outLen;
+  int outPos;
+  simTime_t outReady;
+  int srqServiced;
+  int stallIn;           // byte of message / reply the device stops at, -1 none
+  int stallOut;
+  int scriptPos;         // current message of script
+  int scriptByte;        // bytes of it accepted as listener
+  int held;              // talk message waits for SimDev_Offer()
+  simTime_t lastDav;     // previous byte of current message
+  simTime_t firstDav;
+  simTime_t resume;      // end of pause, DAV not earlier
+
+  /* statistics */
+  unsigned long messages;
+  unsigned long replies;
+  unsigned long bytesIn;
+  unsigned long bytesOut;
+  unsigned long stalls;
+  unsigned long pauses;
+  unsigned long mismatches; // received bytes other than scripted
+  simTime_t scriptBusy;     // first to last byte of each scripted message
+} simDevice_t;
+
+extern simDevice_t simDevices[SIMDEV_MAX];
+extern int simDeviceCount;
+
+/* models: dso (fast, large binary reply), plotter (slow listener), dmm
+   (short numeric replies after integration time), srq (slow measurement,
+   SRQ when done), flaky (dmm which stalls every 7th transfer), pausing (dmm
+   with longer reply which pauses 50 ms after its 5th byte) */
+simDevice_t * SimDev_Add(const char * model, int address);
+simDevice_t * SimDev_Find(int address);
+
+/* device playing script, talkOnly for a talker which is never addressed
+   (printer output), script has to stay valid while device is used. Other
+   scripted talkers send a message only after SimDev_Offer(), when the
+   controller reads it, so that a listener which takes everything (converter
+   in listen mode) doesn't get it early. */
+simDevice_t * SimDev_AddScript(int address, const simMessage_t * script, int count, int talkOnly);
+void SimDev_Offer(simDevice_t * d, simTime_t t);
+
+/* key=value, times in us: ready, accept, dav, cmd, reply, size, eos, eoi,
+   binary, srq, stall, after, pause, at. Returns 0 for unknown key. */
+int SimDev_Set(simDevice_t * d, const char * key, const char * value);
+
+/* reply number index of device, returns length */
+int SimDev_Reply(const simDevice_t * d, unsigned long index, unsigned char * buf);
+
+/* one step of all devices at simNow, returns nonzero if a device changed
+   its lines */
+int SimDev_Step(unsigned char lines, unsigned char data);
+unsigned char SimDev_Lines(void);
+unsigned char SimDev_Data(void);
+
+void SimDev_Report(FILE * f);
+
+#endif
@@ -0,0 +1,34 @@
+/* Included first in every firmware source of the host build (gcc -include),
+   takes the place of sw/usart.h and sends printf output through the
+   simulated UART. */
+#ifndef SIM_FIRMWARE_HEADER
+#define SIM_FIRMWARE_HEADER
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include "sim.h"
+#include "avr/io.h"
+
+#define USART_HEADER
+#define UART_RX_BUF_SIZE SIM_UART_RX_SIZE
+#define UART_TX_BUF_SIZE SIM_UART_TX_SIZE
+
+extern volatile unsigned char uartEscapes;
+
+#define UARTDataAvailable() Sim_UartAvailable()
+#define UARTTransmitBufferEmpty() 1
+
+int Sim_UartAvailable(void);
+void UART_init(void);
+void UART_transmit(unsigned char data);
+unsigned char UART_receive(void);
+unsigned char UART_peek(void);
+unsigned char UART_TxFree(void);
+
+int Sim_printf(const char * format, ...);
+#define printf Sim_printf
+static inline FILE * Sim_fdevopen(int (*put)(char, FILE *), int (*get)(FILE *)) { return stdout; }
+#define fdevopen Sim_fdevopen
+
+#endif
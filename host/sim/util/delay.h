@@ -0,0 +1,9 @@
+#ifndef SIM_UTIL_DELAY
+#define SIM_UTIL_DELAY
+
+#include "sim.h"
+
+#define _delay_us(us) Sim_Delay((simTime_t)((us)*1000))
+#define _delay_ms(ms) Sim_Delay((simTime_t)((ms)*1000000))
+
+#endif
@@ -0,0 +1,99 @@
+#include <inttypes.h>
+#include "encode.h"
+#include "usart.h"
+#include "avr/pgmspace.h"
+
+static const char hexDigits[16] PROGMEM = "0123456789abcdef";
+static const char base64Digits[64] PROGMEM =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base85Digits[85] PROGMEM =
+  "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#";
+
+static unsigned char encoding;
+static uint32_t group; // bytes of incomplete group, first one highest
+static unsigned char groupLen;
+
+
+static void PutBase64(unsigned char chars)
+{
+  signed char shift;
+
+  for (shift=18; chars; shift-=6, chars--)
+    UART_transmit(pgm_read_byte(&base64Digits[(group >> shift) & 0x3F]));
+}
+
+
+static void PutBase85(unsigned char chars)
+{
+  char digits[5];
+  unsigned char i;
+  uint32_t v = group;
+
+  for (i=5; i; i--)
+  {
+    digits[i-1] = pgm_read_byte(&base85Digits[v % 85]);
+    v /= 85;
+  }
+  for (i=0; i<chars; i++)
+    UART_transmit(digits[i]);
+}
+
+
+void Encode_Start(unsigned char e)
+{
+  encoding = e;
+  group = 0;
+  groupLen = 0;
+}
+
+
+void Encode_Put(unsigned char c)
+{
+  if (ENCODE_HEX == encoding)
+  {
+    UART_transmit(pgm_read_byte(&hexDigits[c >> 4]));
+    UART_transmit(pgm_read_byte(&hexDigits[c & 0x0F]));
+    return;
+  }
+
+  group = (group << 8) | c;
+  groupLen++;
+  if ((ENCODE_BASE64 == encoding) && (3 == groupLen))
+  {
+    PutBase64(4);
+    group = 0;
+    groupLen = 0;
+  }
+  else if (4 == groupLen)
+  {
+    PutBase85(5);
+    group = 0;
+    groupLen = 0;
+  }
+}
+
+
+/* incomplete group is padded with zero bytes */
+void Encode_End()
+{
+  unsigned char n = groupLen;
+
+  if (!n)
+    return;
+  if (ENCODE_BASE64 == encoding)
+  {
+    for (; groupLen < 3; groupLen++)
+      group <<= 8;
+    PutBase64(n+1);
+    for (; n < 3; n++)
+      UART_transmit('=');
+  }
+  else
+  {
+    for (; groupLen < 4; groupLen++)
+      group <<= 8;
+    PutBase85(n+1);
+  }
+  group = 0;
+  groupLen = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef ENCODE_HEADER
+#define ENCODE_HEADER
+
+/* 7 bit clean encodings of binary data, bytes are encoded as they come and
+   characters go straight to UART:
+     ENCODE_HEX     two lower case hex digits per byte (Z)
+     ENCODE_BASE64  RFC 4648 alphabet, '=' padded (Z6), 4 chars per 3 bytes
+     ENCODE_BASE85  Z85 alphabet (no quotes or backslash, Z8), 5 chars per
+                    4 bytes big endian, last group of n bytes gives n+1
+                    chars like Ascii85 */
+
+#define ENCODE_HEX 0
+#define ENCODE_BASE64 1
+#define ENCODE_BASE85 2
+
+void Encode_Start(unsigned char encoding);
+void Encode_Put(unsigned char c);
+void Encode_End();
+
+#endif
@@ -0,0 +1,853 @@
+#include <string.h>
+#include "gpib.h"
+#include "usart.h" // uartEscapes, ESC from PC ends waiting for bus
+
+#define F_CPU 12000000UL  
+#include <util/delay.h>
+#include <avr/wdt.h>
+
+unsigned char remoteState = 0;
+unsigned char gpibEOI = 0;
+gpibAddressing_t gpibAddressing = {0, GPIB_ADDR_NONE, 0};
+unsigned char gpibProfiling = 0;
+gpibTiming_t gpibTiming[GPIB_MAX_ADDRESS+1];
+gpibRecovery_t gpibRecovery;
+
+static gpibProfile_t profiles[GPIB_PROFILE_SLOTS];
+static unsigned char profileNext = 0;
+
+
+/* GPIB_TIMER ticks since start, TOV1 is cleared when start is taken. Time is
+   only measured up to timeouts, so one overflow is fine, saturates if the
+   timer went around. Flag is read before the count, otherwise an overflow
+   between the two reads looks like a full turn. Difference is taken modulo
+   16 bits of the timer also where int is wider (host build). */
+static unsigned int Elapsed(unsigned int start)
+{
+  unsigned char overflow = TIFR & _BV(TOV1);
+  unsigned int now = TCNT1;
+
+  if (overflow && (now >= start))
+    return 0xFFFF;
+  return (uint16_t)(now - start);
+}
+
+
+static unsigned int TimerStart()
+{
+  unsigned int start = TCNT1;
+
+  TIFR = _BV(TOV1);
+  return start;
+}
+
+
+/* slot of device, oldest slot is taken over if add is set */
+static gpibProfile_t * ProfileSlot(unsigned char address, unsigned char add)
+{
+  unsigned char i;
+  gpibProfile_t * p;
+
+  for (i=0; i<GPIB_PROFILE_SLOTS; i++)
+    if (profiles[i].address == address)
+      return &profiles[i];
+
+  if (!add)
+    return 0;
+
+  p = &profiles[profileNext];
+  profileNext = (profileNext + 1) % GPIB_PROFILE_SLOTS;
+  memset(p, 0, sizeof(gpibProfile_t));
+  p->address = address;
+  return p;
+}
+
+
+static void ProfileAdd(gpibProfile_t * p, unsigned char metric, unsigned int ticks)
+{
+  unsigned char bin = 0;
+  unsigned int t = ticks >> 2;
+
+  while (t && (bin < GPIB_PROFILE_BINS-1))
+  {
+    t >>= 2;
+    bin++;
+  }
+  if (p->bins[metric][bin] != 0xFFFF)
+    p->bins[metric][bin]++;
+  if (ticks > p->max[metric])
+    p->max[metric] = ticks;
+}
+
+
+/* tuned timing may be too tight for a device which became slower, next
+   transfers use default again. Bus is checked by GPIB_Recover(). */
+static void HandshakeError(unsigned char address, gpibProfile_t * p, unsigned char cause)
+{
+  GPIB_Stalled(cause);
+  if (p && (p->errors != 0xFF))
+    p->errors++;
+  if (address <= GPIB_MAX_ADDRESS)
+  {
+    gpibTiming[address].settle = GPIB_DEFAULT_SETTLE_US;
+    gpibTiming[address].timeout = GPIB_DEFAULT_TIMEOUT;
+  }
+}
+
+
+/* Timing of data transfer to addressed listeners, slowest of them if there
+   are more. Returns listener address if there is exactly one. */
+static unsigned char ListenerTiming(unsigned char * settle, unsigned int * timeout)
+{
+  unsigned char address = GPIB_ADDR_NONE;
+  unsigned char count = 0;
+  unsigned char i;
+
+  *settle = GPIB_DEFAULT_SETTLE_US;
+  *timeout = GPIB_DEFAULT_TIMEOUT;
+  if (!gpibAddressing.valid || (0 == gpibAddressing.listeners))
+    return GPIB_ADDR_NONE;
+
+  *settle = 0;
+  *timeout = 0;
+  for (i=0; i<=GPIB_MAX_ADDRESS; i++)
+  {
+    if (!(gpibAddressing.listeners & (1UL << i)))
+      continue;
+    if (gpibTiming[i].settle > *settle)
+      *settle = gpibTiming[i].settle;
+    if (gpibTiming[i].timeout > *timeout)
+      *timeout = gpibTiming[i].timeout;
+    address = i;
+    count++;
+  }
+  return (1 == count)?address:GPIB_ADDR_NONE;
+}
+
+
+void ReconfigureGPIO_GPIBReceiveMode()
+{
+  DDRA = 0x00; // PA0-PA7 inputs
+  PORTA = 0xff; // pullup on
+  
+  DDRC = IFC | ATN | REN | NRFD | NDAC; // these lines are outputs, other as inputs
+  PORTC = IFC | ATN | (remoteState?0:REN) | EOI | DAV | SRQ; // pullup on
+}
+
+
+void ReconfigureGPIO_GPIBNormalMode()
+{
+  DDRA = 0xff; // data lines are outputs
+  PORTA = 0x00; // output level 0
+  
+  DDRC = IFC | ATN | REN | EOI | DAV; // these lines are outputs
+  PORTC = IFC | ATN | (remoteState?0:REN) | EOI | DAV | SRQ | NRFD | NDAC; // pullup on
+}
+
+
+/* Converter is a device controlled by external controller, all controller
+   lines are inputs. Handshake lines are enabled by GPIB_DeviceAcceptor() */
+void ReconfigureGPIO_GPIBDeviceMode()
+{
+  DDRA = 0x00; // PA0-PA7 inputs
+  PORTA = 0xff; // pullup on
+
+  DDRC = 0x00; // all lines inputs
+  PORTC = IFC | ATN | REN | EOI | DAV | SRQ | NRFD | NDAC; // pullup on
+}
+
+
+int GPIB_Receive(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength)
+{
+  unsigned int index = 0;
+  unsigned char c;
+  unsigned int timeout;
+
+  do
+  {
+    SetNRFD(1); //ready for receiving data
+    //-1 & 5
+    
+    timeout = 0;
+    while (PINC & DAV) // waiting for falling edge
+    {
+      //_delay_ms(1);
+      timeout++;
+      if ((timeout > GPIB_MAX_RECEIVE_TIMEOUT) || uartEscapes) // ESC from PC aborts
+      {
+        *receivedLength = index;
+        SetNRFD(0);
+        return 0;
+      }
+    }
+    // 0
+    
+    SetNRFD(0); //not ready for receiving data
+    // 1
+    
+    c = ~PINA; //read data
+
+    buf[index++] = c;
+
+    SetNDAC(1); //data accepted
+    //2
+    
+    while (!(PINC & DAV)) // waiting for rising edge
+    {
+      //_delay_ms(1);
+      timeout++;
+      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
+      {
+        *receivedLength = index;
+        SetNDAC(0);
+        return 0;
+      }
+    }
+    //3
+    
+    SetNDAC(0);
+    //4
+  } while ((index < bufLength) /*&& (c != 13)*/);
+  *receivedLength = index;
+  return 255;
+}
+
+
+/* Waits for first byte GPIB_DEFAULT_TIMEOUT, instrument may be busy with
+   the measurement, following bytes use timing of addressed talker. */
+/* Without wait only bytes the talker offers at once are taken, a pause is
+   not a handshake error and NRFD stays ready when nothing came. Releasing
+   DAV of a taken byte is given the talker's timeout either way, or the
+   default one for a talker that isn't tracked (talk-only, after serial
+   poll). Pause of an untracked talker (printer mode) isn't recorded as
+   stall. */
+static int ReceiveEoi(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength, unsigned char wait)
+{
+  unsigned int index = 0;
+  unsigned char c;
+  unsigned char eoi = 0;
+  unsigned int timeout = wait?GPIB_DEFAULT_TIMEOUT:0;
+  unsigned int release = GPIB_DEFAULT_TIMEOUT; // for talker to release DAV
+  unsigned char talker = GPIB_ADDR_NONE;
+  gpibProfile_t * profile = 0;
+  unsigned int start;
+
+  if (gpibAddressing.valid && (gpibAddressing.talker <= GPIB_MAX_ADDRESS))
+  {
+    talker = gpibAddressing.talker;
+    if (gpibProfiling)
+      profile = ProfileSlot(talker, 1);
+  }
+
+  gpibEOI = 0;
+  do
+  {
+    wdt_reset(); // slow talker may take long for whole buffer
+    SetNRFD(1); //ready for receiving data
+    //-1 & 5
+    
+    start = TimerStart();
+    while (PINC & DAV) // waiting for falling edge
+    {
+      if ((Elapsed(start) > timeout) || uartEscapes)
+      {
+        *receivedLength = index;
+        if (!wait)
+          return 255;
+        SetNRFD(0);
+        if (index && !uartEscapes && (talker != GPIB_ADDR_NONE))
+          HandshakeError(talker, profile, GPIB_CAUSE_DAV);
+        return 0;
+      }
+    }
+    // 0
+    
+    if ((PINC & EOI) == 0)
+      eoi = 1;
+    
+    SetNRFD(0); //not ready for receiving data
+    // 1
+    
+    c = ~PINA; //read data
+
+    buf[index++] = c;
+
+    SetNDAC(1); //data accepted
+    //2
+    
+    if (profile && (index > 1))
+      ProfileAdd(profile, GPIB_PROFILE_DAV, Elapsed(start));
+    if (talker != GPIB_ADDR_NONE)
+      timeout = release = gpibTiming[talker].timeout;
+
+    start = TimerStart();
+    while (!(PINC & DAV)) // waiting for rising edge
+    {
+      if (Elapsed(start) > release)
+      {
+        *receivedLength = index;
+        SetNDAC(0);
+        HandshakeError(talker, profile, GPIB_CAUSE_DAV_HELD);
+        return 0;
+      }
+    }
+    //3
+    
+    SetNDAC(0);
+    //4
+  } while ((index < bufLength) && (eoi == 0));
+  *receivedLength = index;
+  gpibEOI = eoi;
+  return 255;
+}
+
+
+int GPIB_Receive_till_eoi(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength)
+{
+  return ReceiveEoi(buf, bufLength, receivedLength, 1);
+}
+
+
+int GPIB_Receive_pending(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength)
+{
+  return ReceiveEoi(buf, bufLength, receivedLength, 0);
+}
+
+
+int GPIB_Receive_till_lf(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength)
+{
+  unsigned int index = 0;
+  unsigned char c;
+  unsigned int timeout;
+
+  //SetNDAC(0);
+  //SetNRFD(0);
+
+  do
+  {
+    SetNRFD(1); //ready for receiving data
+    //-1 & 5
+    
+    timeout = 0;
+    while (PINC & DAV) // waiting for falling edge
+    {
+      timeout++;
+      if ((timeout > GPIB_MAX_RECEIVE_TIMEOUT) || uartEscapes) // ESC from PC aborts
+      {
+        *receivedLength = index;
+        SetNRFD(0);
+        return 0;
+      }
+    }
+    // 0
+       
+    SetNRFD(0); //not ready for receiving data
+    // 1
+    
+    c = ~PINA; //read data
+
+    buf[index++] = c;
+
+    SetNDAC(1); //data accepted
+    //2
+    
+    while (!(PINC & DAV)) // waiting for rising edge
+    {
+      timeout++;
+      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
+      {
+        *receivedLength = index;
+        SetNDAC(0);
+        return 0;
+      }
+    }
+    //3
+    
+    SetNDAC(0);
+    //4
+  } while ((index < bufLength) && (c != 10));
+  *receivedLength = index;
+  return 255;
+}
+
+
+/* Data settling and DAV hold run while waiting for listeners, so they only
+   cost time when listeners are faster than settle time. */
+int GPIB_Transmit(unsigned char * buf, unsigned char bufLength, unsigned char eoi)
+{
+  unsigned char index = 0;
+  unsigned char listener = GPIB_ADDR_NONE;
+  unsigned char settleUs = GPIB_DEFAULT_SETTLE_US;
+  unsigned int settle;
+  unsigned int timeout = GPIB_DEFAULT_TIMEOUT;
+  gpibProfile_t * profile = 0;
+  unsigned int start;
+  unsigned int nrfd;
+  
+  if ((0 == bufLength) || ((PINC & NRFD) && (PINC & NDAC)))
+    return 0;
+
+  if (PINC & ATN) // data, commands are for all devices and use default timing
+  {
+    listener = ListenerTiming(&settleUs, &timeout);
+    if (gpibProfiling && (listener != GPIB_ADDR_NONE))
+      profile = ProfileSlot(listener, 1);
+  }
+  settle = GPIB_TICKS(settleUs);
+  
+  do
+  {
+    if ((index+1 == bufLength) && eoi)
+      SetEOI(0); // last byte
+    
+    //transmit debug    
+    //printf("%02x ", buf[index]);
+    
+    PORTA = ~buf[index];
+    index++;
+    wdt_reset(); // slow listener may take long for whole buffer
+    
+    start = TimerStart();
+    while (!(PINC & NRFD)) // waiting for high on NRFD
+    {
+      if ((Elapsed(start) > timeout) || uartEscapes)
+      {
+        SetEOI(1);
+        if (!uartEscapes)
+          HandshakeError(listener, profile, GPIB_CAUSE_NRFD);
+        return 0;
+      }
+    }
+    nrfd = Elapsed(start);
+    while (Elapsed(start) < settle); // data settling
+    
+    SetDAV(0);
+    start = TimerStart();
+   
+    while (!(PINC & NDAC)) // waiting for high on NDAC
+    {
+      if ((Elapsed(start) > timeout) || uartEscapes)
+      {
+        SetEOI(1);
+        SetDAV(1);
+        if (!uartEscapes)
+          HandshakeError(listener, profile, GPIB_CAUSE_NDAC);
+        return 0;
+      }
+    }
+    if (profile)
+    {
+      ProfileAdd(profile, GPIB_PROFILE_NDAC, Elapsed(start));
+      ProfileAdd(profile, GPIB_PROFILE_NRFD, nrfd);
+    }
+    while (Elapsed(start) < settle); // DAV hold
+    
+    SetEOI(1);
+    SetDAV(1);
+    //4
+  } while ((index < bufLength));
+
+  //printf("\r\n");
+  return 255;
+}
+
+
+/* IFC unaddresses all talkers and listeners */
+void GPIB_ResetAddressing()
+{
+  gpibAddressing.valid = 1;
+  gpibAddressing.talker = GPIB_ADDR_NONE;
+  gpibAddressing.listeners = 0;
+}
+
+
+/* IFC pulse, instruments give up talker and listener state */
+void GPIB_InterfaceClear()
+{
+  SetIFC(0);
+  _delay_ms(GPIB_IFC_MS);
+  SetIFC(1);
+  GPIB_ResetAddressing();
+}
+
+
+/* Records stall for GPIB_Recover(). Addressing is taken before a failed
+   GPIB_Command() marks it invalid. */
+void GPIB_Stalled(unsigned char cause)
+{
+  gpibRecovery.cause = cause;
+  gpibRecovery.lines = ~PINC;
+  gpibRecovery.result = GPIB_RECOVERY_PENDING;
+  gpibRecovery.ms = 0;
+  gpibRecovery.addressing = gpibAddressing;
+}
+
+
+/* ms waited for listeners to release NRFD, at most max */
+static unsigned char WaitReady(unsigned char max)
+{
+  unsigned char ms;
+  unsigned int start;
+
+  for (ms=0; (ms < max) && !(PINC & NRFD); ms++)
+  {
+    start = TimerStart();
+    while (!(PINC & NRFD) && (Elapsed(start) < GPIB_TICKS(1000)));
+  }
+  return ms;
+}
+
+
+/* Slow listener gets GPIB_STUCK_MS to take the byte. Talker which only
+   paused holds no line, the bus is free as well. IFC is left for lines
+   which are still held. */
+unsigned char GPIB_Recover()
+{
+  gpibAddressing_t * a = &gpibRecovery.addressing;
+  unsigned char cause = gpibRecovery.cause;
+  unsigned char lines = gpibRecovery.lines;
+  unsigned char cmd[GPIB_MAX_ADDRESS+3];
+  unsigned char len = 0;
+  unsigned char i;
+  unsigned int start;
+  int result = 255;
+
+  if (GPIB_RECOVERY_PENDING != gpibRecovery.result)
+    return gpibRecovery.result;
+
+  ReconfigureGPIO_GPIBNormalMode(); // handshake released, REN as set by R/L
+  gpibRecovery.ms = WaitReady(GPIB_STUCK_MS);
+  if (((GPIB_CAUSE_NRFD == cause) || (GPIB_CAUSE_NDAC == cause) || (GPIB_CAUSE_DAV == cause)) &&
+      (PINC & NRFD))
+    return gpibRecovery.result = GPIB_RECOVERY_FREE;
+
+  GPIB_InterfaceClear();
+  gpibRecovery.count++;
+  gpibRecovery.ms += GPIB_IFC_MS;
+  if (a->valid && ((a->talker != GPIB_ADDR_NONE) || a->listeners))
+  {
+    cmd[len++] = GPIB_CMD_UNL;
+    for (i=0; i<=GPIB_MAX_ADDRESS; i++)
+      if (a->listeners & (1UL << i))
+        cmd[len++] = GPIB_CMD_MLA + i;
+    if (a->talker <= GPIB_MAX_ADDRESS)
+      cmd[len++] = GPIB_CMD_MTA + a->talker;
+    start = TimerStart();
+    result = GPIB_Command(cmd, len, 0);
+    gpibRecovery.ms += GPIB_US(Elapsed(start))/1000;
+    gpibRecovery.cause = cause; // failed command doesn't replace first stall
+    gpibRecovery.lines = lines;
+  }
+  gpibRecovery.ms += WaitReady(GPIB_STUCK_MS);
+  gpibRecovery.result = ((255 == result) && (PINC & NRFD))?GPIB_RECOVERY_CLEARED:GPIB_RECOVERY_STUCK;
+  return gpibRecovery.result;
+}
+
+
+void GPIB_TrackCommand(unsigned char c)
+{
+  unsigned char addr = c & 0x1F;
+
+  c &= 0x7F;
+  if (c < GPIB_CMD_MLA) // universal and addressed commands, no change
+    return;
+  
+  if (c == GPIB_CMD_UNL)
+    gpibAddressing.listeners = 0;
+  else if (c < GPIB_CMD_UNL)
+  {
+    gpibAddressing.listeners |= (1UL << addr);
+    if (gpibAddressing.talker == addr) // be pessimistic, device may drop talker state
+      gpibAddressing.talker = GPIB_ADDR_NONE;
+  }
+  else if (c == GPIB_CMD_UNT)
+    gpibAddressing.talker = GPIB_ADDR_NONE;
+  else if (c < GPIB_CMD_UNT)
+  {
+    gpibAddressing.talker = addr;
+    gpibAddressing.listeners &= ~(1UL << addr); // talker stops listening
+  }
+  else // secondary address, not followed
+    gpibAddressing.valid = 0;
+}
+
+
+unsigned char GPIB_IsListener(unsigned char address)
+{
+  return (gpibAddressing.listeners & (1UL << address))?1:0;
+}
+
+
+/* Sends command bytes with ATN true, bus is left in normal (talker) mode */
+int GPIB_Command(unsigned char * buf, unsigned char bufLength, unsigned char eoi)
+{
+  unsigned char i;
+  int result;
+
+  for (i=0; i<bufLength; i++)
+    GPIB_TrackCommand(buf[i]);
+
+  ReconfigureGPIO_GPIBNormalMode();
+
+  SetATN(0);
+  _delay_us(100);
+  result = GPIB_Transmit(buf, bufLength, eoi);
+  SetATN(1);
+
+  if (result != 255)
+    gpibAddressing.valid = 0; // not known which bytes were accepted
+
+  return result;
+}
+
+
+/* Makes talker the only talker and listener the only listener. Command bytes
+   are sent only for the part of addressing which actually changes, when the
+   bus is already addressed this way nothing is sent at all. */
+int GPIB_Address(unsigned char talker, unsigned char listener)
+{
+  unsigned char cmd[3];
+  unsigned char len = 0;
+
+  if (!gpibAddressing.valid || (gpibAddressing.listeners != (1UL << listener)))
+  {
+    cmd[len++] = GPIB_CMD_UNL;
+    cmd[len++] = GPIB_CMD_MLA + listener;
+  }
+
+  if (!gpibAddressing.valid || (gpibAddressing.talker != talker))
+    cmd[len++] = GPIB_CMD_MTA + talker;
+
+  if (0 == len)
+    return 255;
+
+  gpibAddressing.valid = 1;
+  return GPIB_Command(cmd, len, 0);
+}
+
+
+/* Each address in turn is made the only listener. An instrument at that
+   address keeps NDAC asserted after ATN is released, waiting for data,
+   while at an empty address all acceptors release it. Lines are sampled
+   after GPIB_PROBE_US, so 31 addresses take a few ms instead of a transfer
+   timeout each. skip (converter's own address) is not probed, bus is left
+   with no listener. */
+int GPIB_Enumerate(unsigned char skip, uint32_t * found)
+{
+  unsigned char cmd[2];
+  unsigned char addr;
+  unsigned int start;
+
+  *found = 0;
+  cmd[0] = GPIB_CMD_UNL;
+  for (addr=0; addr<=GPIB_MAX_ADDRESS; addr++)
+  {
+    if (addr == skip)
+      continue;
+    cmd[1] = GPIB_CMD_MLA + addr;
+    if (GPIB_Command(cmd, 2, 0) != 255)
+      return 0;
+
+    start = TimerStart();
+    while (Elapsed(start) < GPIB_TICKS(GPIB_PROBE_US));
+    if (!(PINC & NDAC))
+      *found |= 1UL << addr;
+  }
+  return GPIB_Command(cmd, 1, 0);
+}
+
+
+/* Instrument which doesn't answer the poll costs the first byte timeout of
+   a receive. Bus is left with converter as only listener. */
+unsigned char GPIB_SerialPoll(unsigned char listener, uint32_t map, unsigned char * status)
+{
+  unsigned char cmd[3] = {GPIB_CMD_UNL, GPIB_CMD_MLA+listener, GPIB_CMD_SPE};
+  unsigned char found = GPIB_ADDR_NONE;
+  unsigned char addr;
+  unsigned int len;
+
+  if (255 != GPIB_Command(cmd, 3, 0))
+    return GPIB_ADDR_NONE;
+  for (addr=0; (addr<=GPIB_MAX_ADDRESS) && (GPIB_ADDR_NONE == found); addr++)
+  {
+    if (!(map & (1UL << addr)) || (addr == listener))
+      continue;
+    cmd[0] = GPIB_CMD_MTA + addr;
+    if (255 != GPIB_Command(cmd, 1, 0))
+      break;
+    ReconfigureGPIO_GPIBReceiveMode();
+    if ((255 == ReceiveEoi(status, 1, &len, 1)) && (1 == len) && (*status & GPIB_STB_RQS))
+      found = addr;
+  }
+  cmd[0] = GPIB_CMD_SPD;
+  cmd[1] = GPIB_CMD_UNT;
+  GPIB_Command(cmd, 2, 0);
+  return found;
+}
+
+
+/* default timing for device, GPIB_ADDR_NONE for all devices, profile of
+   the device is dropped */
+void GPIB_ResetTiming(unsigned char address)
+{
+  unsigned char i;
+
+  for (i=0; i<=GPIB_MAX_ADDRESS; i++)
+  {
+    if ((address != GPIB_ADDR_NONE) && (address != i))
+      continue;
+    gpibTiming[i].settle = GPIB_DEFAULT_SETTLE_US;
+    gpibTiming[i].timeout = GPIB_DEFAULT_TIMEOUT;
+  }
+
+  for (i=0; i<GPIB_PROFILE_SLOTS; i++)
+    if ((GPIB_ADDR_NONE == address) || (profiles[i].address == address))
+      profiles[i].address = GPIB_ADDR_NONE;
+}
+
+
+/* profile of device, 0 if device was not profiled */
+gpibProfile_t * GPIB_Profile(unsigned char address)
+{
+  return ProfileSlot(address, 0);
+}
+
+
+/* Sets minimum settle time and timeout of GPIB_TUNE_MARGIN times the slowest
+   latency seen. Needs GPIB_TUNE_MIN_SAMPLES transfers without timeout,
+   returns 0 otherwise. */
+unsigned char GPIB_Tune(unsigned char address)
+{
+  gpibProfile_t * p = ProfileSlot(address, 0);
+  unsigned int samples = 0;
+  unsigned int slowest = 0;
+  unsigned char m, b;
+
+  if ((0 == p) || p->errors)
+    return 0;
+
+  for (m=0; m<GPIB_PROFILE_METRICS; m++)
+  {
+    for (b=0; b<GPIB_PROFILE_BINS; b++)
+      samples += p->bins[m][b];
+    if (p->max[m] > slowest)
+      slowest = p->max[m];
+  }
+  if (samples < GPIB_TUNE_MIN_SAMPLES)
+    return 0;
+
+  gpibTiming[address].settle = GPIB_MIN_SETTLE_US;
+  if (slowest >= GPIB_DEFAULT_TIMEOUT/GPIB_TUNE_MARGIN)
+    gpibTiming[address].timeout = GPIB_DEFAULT_TIMEOUT;
+  else if (slowest*GPIB_TUNE_MARGIN < GPIB_MIN_TIMEOUT)
+    gpibTiming[address].timeout = GPIB_MIN_TIMEOUT;
+  else
+    gpibTiming[address].timeout = slowest*GPIB_TUNE_MARGIN;
+  return 255;
+}
+
+
+/* Device mode acceptor on (NRFD and NDAC held low) or off (released) */
+void GPIB_DeviceAcceptor(unsigned char on)
+{
+  if (on)
+  {
+    PORTC &= ~(NRFD | NDAC);
+    DDRC |= NRFD | NDAC;
+  }
+  else
+  {
+    DDRC &= ~(NRFD | NDAC);
+    PORTC |= NRFD | NDAC;
+  }
+}
+
+
+/* Device mode acceptor handshake for one byte. Returns 0 if DAV was not
+   asserted within GPIB_DEVICE_POLL loops or ATN changed meanwhile, so the
+   caller can look at the bus state again. */
+int GPIB_DeviceAccept(unsigned char * c, unsigned char * eoi)
+{
+  unsigned char atn = PINC & ATN;
+  unsigned int timeout = 0;
+
+  SetNRFD(1); //ready for receiving data
+  while (PINC & DAV) // waiting for falling edge
+  {
+    timeout++;
+    if ((timeout > GPIB_DEVICE_POLL) || ((PINC & ATN) != atn))
+    {
+      SetNRFD(0);
+      return 0;
+    }
+  }
+
+  *eoi = (PINC & EOI)?0:1;
+  SetNRFD(0); //not ready for receiving data
+  *c = ~PINA; //read data
+  SetNDAC(1); //data accepted
+
+  timeout = 0;
+  while (!(PINC & DAV)) // waiting for rising edge
+  {
+    timeout++;
+    if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
+      break; // byte is already accepted
+  }
+
+  SetNDAC(0);
+  return 255;
+}
+
+
+/* Device mode talker, sources bytes until all are sent, controller asserts
+   ATN or listeners time out. EOI is sent with the last byte if eoi is set.
+   Returns number of bytes accepted by listeners. */
+unsigned char GPIB_DeviceTalk(unsigned char * buf, unsigned char bufLength, unsigned char eoi)
+{
+  unsigned char index = 0;
+  unsigned int timeout;
+
+  GPIB_DeviceAcceptor(0);
+  PORTC |= EOI | DAV;
+  DDRC |= EOI | DAV;
+  DDRA = 0xff;
+
+  while ((index < bufLength) && (PINC & ATN))
+  {
+    PORTA = ~buf[index];
+    if ((index+1 == bufLength) && eoi)
+      SetEOI(0); // last byte
+
+    _delay_us(GPIB_DEVICE_SETTLE_US);
+
+    timeout = 0;
+    while (!(PINC & NRFD)) // waiting for high on NRFD
+    {
+      timeout++;
+      if ((timeout > GPIB_MAX_TRANSMIT_TIMEOUT) || !(PINC & ATN))
+        goto release;
+    }
+
+    SetDAV(0);
+
+    while (!(PINC & NDAC)) // waiting for high on NDAC
+    {
+      timeout++;
+      if ((timeout > GPIB_MAX_TRANSMIT_TIMEOUT) || !(PINC & ATN))
+        goto release;
+    }
+
+    index++;
+    SetDAV(1);
+    SetEOI(1);
+  }
+
+release:
+  SetDAV(1);
+  SetEOI(1);
+  DDRC &= ~(EOI | DAV);
+  DDRA = 0x00;
+  PORTA = 0xff;
+  return index;
+}
@@ -0,0 +1,199 @@
+#ifndef GPIB_HEADER
+#define GPIB_HEADER
+
+#include <inttypes.h>
+#include <avr/io.h>
+
+/*
+GPIB Connector pinout
+
+Pin | Nazwa | Opis               | Source            | Atmega pin |	
+----+-------+--------------------+-------------------+------------+--------
+1   | DIO1  | Data bit 1 (LSB)   | Talker            | PA0	37    | X3-4
+2   | DIO2  | Data bit 2         | Talker            | PA1	36    | X3-3
+3   | DIO3  | Data bit 3         | Talker            | PA2	35    | X3-2
+4   | DIO4  | Data bit 4         | Talker            | PA3	34    | X3-1
+5   | EOI   | End Or Indentity   | Talker/Controller | PC7	26    | X4-1
+6   | DAV   | Data Valid         | Controller        | PC6	25    | X4-2
+7   | NRFD  | Not Ready For Data | Listener          | PC5	24    | X4-3
+8   | NDAC  | No Data Accepted   | Listener          | PC4	23    | X4-4
+9   | IFC   | Interface Clear    | Controller        | PC3	22    | X5-1
+10  | SRQ   | Service Request    | Talker            | PC2	21    | X5-2
+11  | ATN   | Attention          | Controller        | PC1	20    | X5-3
+12  |       | Ekran              |                   |            |
+13  | DIO5  | Data bit 5         | Talker            | PA4	33    | X2-4
+14  | DIO6  | Data bit 6         | Talker            | PA5	32    | X2-3
+15  | DIO7  | Data Bit 7         | Talker            | PA6	31    | X2-2
+16  | DIO8  | Data bit 8 (MSB)   | Talker            | PA7	30    | X2-1
+17  | REN   | Remote Enabled     | Controller        | PC0	19    | X5-4
+18  |       | GND DAV            |                   |            |
+19  |       | GND NRFD           |                   |            |
+20  |      | GND NDAC           |                   |            |
+21  |       | GND IFC	         |                   |            |
+22  |       | GND SRQ	         |                   |            |
+23  |       | GND ATN	         |                   |	          |
+24  |       | GND data           |                   |	          | X3-5
+*/
+
+#define EOI (_BV(PC7))  //pin 26 ATmega, pin 5 GPIB
+#define DAV (_BV(PC6))  //pin 25 ATmega, pin 6 GPIB
+#define NRFD (_BV(PC5)) //pin 24 ATmega, pin 7 GPIB, output
+#define NDAC (_BV(PC4)) //pin 23 ATmega, pin 8 GPIB, output
+#define IFC (_BV(PC3))  //pin 22 ATmega, pin 9 GPIB
+#define SRQ (_BV(PC2))  //pin 21 ATmega, pin 10 GPIB
+#define ATN (_BV(PC1))  //pin 20 ATmega, pin 11 GPIB
+#define REN (_BV(PC0))  //pin 19 ATmega, pin 17 GPIB
+
+#define SetEOI(x) ( PORTC = (x)? (PORTC | EOI) : (PORTC & ~EOI) )
+#define SetDAV(x) ( PORTC = (x)? (PORTC | DAV) : (PORTC & ~DAV) )
+#define SetNRFD(x) ( PORTC = (x)? (PORTC | NRFD) : (PORTC & ~NRFD) )
+#define SetNDAC(x) ( PORTC = (x)? (PORTC | NDAC) : (PORTC & ~NDAC) )
+#define SetIFC(x) ( PORTC = (x)? (PORTC | IFC) : (PORTC & ~IFC) )
+#define SetSRQ(x) ( PORTC = (x)? (PORTC | SRQ) : (PORTC & ~SRQ) )
+#define SetATN(x) ( PORTC = (x)? (PORTC | ATN) : (PORTC & ~ATN) )
+#define SetREN(x) ( PORTC = (x)? (PORTC | REN) : (PORTC & ~REN) )
+
+#define GPIB_MAX_RECEIVE_TIMEOUT 50000
+#define GPIB_MAX_TRANSMIT_TIMEOUT 50000
+#define GPIB_DEVICE_POLL 1000 // device mode, loops waiting for DAV before bus state is checked again
+#define GPIB_DEVICE_SETTLE_US 2 // device mode, data settling time before DAV
+
+/* Bus timebase for analyzer and profiler, Timer1 at F_CPU/8, 1.5 MHz */
+#define GPIB_TIMER_HZ 1500000UL
+#define GPIB_TICKS(us) ((unsigned int)(us)*3/2)
+#define GPIB_US(ticks) ((unsigned long)(ticks)*2/3)
+#define GPIB_TimerStart() ( TCCR1A = 0, TCNT1 = 0, TIFR = _BV(TOV1), TCCR1B = _BV(CS11) )
+
+/* Handshake timing of GPIB_Transmit and GPIB_Receive_till_eoi, per device.
+   Default is conservative, GPIB_Tune() sets the fastest values which are
+   safe for latencies seen by profiler. */
+#define GPIB_DEFAULT_SETTLE_US 100
+#define GPIB_MIN_SETTLE_US 2     // IEEE 488.1 T1
+#define GPIB_DEFAULT_TIMEOUT 50000 // GPIB_TIMER ticks, 33 ms
+#define GPIB_MIN_TIMEOUT 1500    // 1 ms
+#define GPIB_TUNE_MARGIN 4       // timeout is this times slowest latency seen
+#define GPIB_TUNE_MIN_SAMPLES 16
+
+/* Command bytes sent with ATN true */
+#define GPIB_CMD_MLA 0x20 // listen address base, 0x20+addr
+#define GPIB_CMD_UNL 0x3F // unlisten
+#define GPIB_CMD_MTA 0x40 // talk address base, 0x40+addr
+#define GPIB_CMD_UNT 0x5F // untalk
+#define GPIB_CMD_MSA 0x60 // secondary address base
+#define GPIB_CMD_SDC 0x04 // selected device clear
+#define GPIB_CMD_DCL 0x14 // device clear
+#define GPIB_CMD_SPE 0x18 // serial poll enable
+#define GPIB_CMD_SPD 0x19 // serial poll disable
+
+#define GPIB_STB_RQS 0x40 // status byte, instrument requested service
+
+#define GPIB_MAX_ADDRESS 30
+#define GPIB_ADDR_NONE 0xFF
+#define GPIB_PROBE_US 100 // GPIB_Enumerate, instruments settle their acceptors after ATN
+
+/* Bus addressing as seen by the controller. Every command byte the converter
+   sends goes through GPIB_TrackCommand(), so the state stays exact as long as
+   valid is set. Anything we cannot follow (secondary addresses, failed
+   command transfers) clears valid and forces full re-addressing. */
+typedef struct {
+  unsigned char valid;
+  unsigned char talker;     // addressed talker or GPIB_ADDR_NONE
+  uint32_t listeners;       // bit n set if device n is addressed to listen
+} gpibAddressing_t;
+
+/* Recovery from a wedged handshake. A transfer which times out in the middle
+   of a message records what it waited for, GPIB_Recover() then gives the
+   bus GPIB_STUCK_MS to come free by itself (NRFD released) and otherwise
+   clears it: outputs and REN restored, IFC pulse, addressing of the failed
+   transfer sent again, then listeners get GPIB_STUCK_MS again to become
+   ready. Bounded by twice GPIB_STUCK_MS, the IFC pulse and one command
+   timeout. */
+#define GPIB_STUCK_MS 100
+#define GPIB_IFC_MS 1 // IEEE 488.1 wants at least 100 us
+
+#define GPIB_CAUSE_NONE 0
+#define GPIB_CAUSE_NRFD 1     // listener not ready for next byte
+#define GPIB_CAUSE_NDAC 2     // listener didn't accept byte
+#define GPIB_CAUSE_DAV 3      // talker paused or stopped in the middle of message
+#define GPIB_CAUSE_DAV_HELD 4 // talker didn't release DAV after byte was accepted
+#define GPIB_CAUSE_REQUEST 5  // recovery asked for by PC
+#define GPIB_CAUSE_WATCHDOG 6 // firmware hung, converter was reset by watchdog
+
+#define GPIB_RECOVERY_NONE 0    // nothing stalled since power up
+#define GPIB_RECOVERY_PENDING 1 // stall recorded, GPIB_Recover() not run yet
+#define GPIB_RECOVERY_FREE 2    // bus came free without intervention
+#define GPIB_RECOVERY_CLEARED 3 // bus cleared with IFC and addressed again
+#define GPIB_RECOVERY_STUCK 4   // lines still held, instrument needs power cycle
+
+typedef struct {
+  unsigned char cause;
+  unsigned char lines;   // asserted lines when transfer stopped, bits of PINC
+  unsigned char result;
+  unsigned char ms;      // duration of recovery
+  unsigned int count;    // recoveries with IFC since power up
+  gpibAddressing_t addressing; // of failed transfer
+} gpibRecovery_t;
+
+typedef struct {
+  unsigned char settle;  // us, data settling before DAV and DAV hold time
+  unsigned int timeout;  // GPIB_TIMER ticks, handshake wait (not first byte of receive)
+} gpibTiming_t;
+
+/* Latency histograms of most recently profiled devices */
+#define GPIB_PROFILE_SLOTS 4
+#define GPIB_PROFILE_BINS 8   // bin n counts latencies below 4^(n+1) ticks, last one the rest
+#define GPIB_PROFILE_NRFD 0   // transmit, data placed until listener ready
+#define GPIB_PROFILE_NDAC 1   // transmit, DAV until listener accepted
+#define GPIB_PROFILE_DAV 2    // receive, ready until talker sets DAV (after first byte)
+#define GPIB_PROFILE_METRICS 3
+
+typedef struct {
+  unsigned char address; // GPIB_ADDR_NONE if slot is free
+  unsigned char errors;  // handshake timeouts
+  unsigned int bins[GPIB_PROFILE_METRICS][GPIB_PROFILE_BINS];
+  unsigned int max[GPIB_PROFILE_METRICS]; // GPIB_TIMER ticks
+} gpibProfile_t;
+
+extern unsigned char remoteState;
+extern unsigned char gpibEOI; // last GPIB_Receive_till_eoi ended with EOI
+extern gpibAddressing_t gpibAddressing;
+extern unsigned char gpibProfiling; // collect latency histograms
+extern gpibTiming_t gpibTiming[GPIB_MAX_ADDRESS+1];
+extern gpibRecovery_t gpibRecovery;
+
+void ReconfigureGPIO_GPIBReceiveMode();
+void ReconfigureGPIO_GPIBNormalMode();
+void ReconfigureGPIO_GPIBDeviceMode();
+
+int GPIB_Receive(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength);
+int GPIB_Receive_till_eoi(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength);
+/* returns at once when talker has no data ready, for background capture */
+int GPIB_Receive_pending(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength);
+int GPIB_Receive_till_lf(unsigned char * buf, unsigned int bufLength, unsigned int * receivedLength);
+int GPIB_Transmit(unsigned char * buf, unsigned char bufLength, unsigned char eoi);
+
+void GPIB_ResetAddressing();
+void GPIB_InterfaceClear();
+void GPIB_Stalled(unsigned char cause);
+unsigned char GPIB_Recover(); // returns result, bus is left in normal mode
+void GPIB_TrackCommand(unsigned char c);
+unsigned char GPIB_IsListener(unsigned char address);
+int GPIB_Command(unsigned char * buf, unsigned char bufLength, unsigned char eoi);
+int GPIB_Address(unsigned char talker, unsigned char listener);
+/* Finds instruments without talking to them, see gpib.c. Returns 255 and
+   bit n of found set for instrument at address n, 0 if a command timed out. */
+int GPIB_Enumerate(unsigned char skip, uint32_t * found);
+/* Serial poll of instruments in map by converter at listener address, stops
+   at first one requesting service. Returns its address and status byte,
+   GPIB_ADDR_NONE if none. */
+unsigned char GPIB_SerialPoll(unsigned char listener, uint32_t map, unsigned char * status);
+
+void GPIB_ResetTiming(unsigned char address);
+gpibProfile_t * GPIB_Profile(unsigned char address);
+unsigned char GPIB_Tune(unsigned char address);
+
+void GPIB_DeviceAcceptor(unsigned char on);
+int GPIB_DeviceAccept(unsigned char * c, unsigned char * eoi);
+unsigned char GPIB_DeviceTalk(unsigned char * buf, unsigned char bufLength, unsigned char eoi);
+
+#endif
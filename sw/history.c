@@ -0,0 +1,125 @@
+#include "history.h"
+#include <string.h>
+
+#if HISTORY_SIZE > 0
+
+static char history[HISTORY_SIZE];
+static unsigned int historyHead = 0; // start of oldest entry
+static unsigned int historyUsed = 0;
+static unsigned char historyCount = 0;
+static unsigned int historyLast = 0; // start of newest entry
+
+#define Wrap(x) (((x) >= HISTORY_SIZE)?(x)-HISTORY_SIZE:(x))
+
+
+static void DropOldest()
+{
+  while (history[historyHead])
+  {
+    historyHead = Wrap(historyHead+1);
+    historyUsed--;
+  }
+  historyHead = Wrap(historyHead+1);
+  historyUsed--;
+  historyCount--;
+}
+
+
+void History_Add(const char * cmd)
+{
+  unsigned int len = strlen(cmd) + 1;
+  unsigned int pos;
+
+  if (len > HISTORY_SIZE)
+    return;
+
+  while (historyUsed + len > HISTORY_SIZE)
+    DropOldest();
+
+  pos = Wrap(historyHead + historyUsed);
+  historyLast = pos;
+  do
+  {
+    history[pos] = *cmd;
+    pos = Wrap(pos+1);
+  } while (*cmd++);
+
+  historyUsed += len;
+  historyCount++;
+}
+
+
+unsigned char History_Count()
+{
+  return historyCount;
+}
+
+
+/* n = 0 is the oldest entry */
+void History_Get(unsigned char n, char * dst, unsigned char size)
+{
+  unsigned int pos = historyHead;
+  unsigned char i = 0;
+
+  if (n >= historyCount)
+  {
+    dst[0] = 0;
+    return;
+  }
+
+  while (n)
+  {
+    if (0 == history[pos])
+      n--;
+    pos = Wrap(pos+1);
+  }
+
+  while (history[pos] && (i < size-1))
+  {
+    dst[i++] = history[pos];
+    pos = Wrap(pos+1);
+  }
+  dst[i] = 0;
+}
+
+
+unsigned char History_IsLast(const char * cmd)
+{
+  unsigned int pos = historyLast;
+
+  if (0 == historyCount)
+    return 0;
+
+  while (*cmd && (history[pos] == *cmd))
+  {
+    cmd++;
+    pos = Wrap(pos+1);
+  }
+  return (0 == *cmd) && (0 == history[pos]);
+}
+
+#else
+
+void History_Add(const char * cmd)
+{
+}
+
+
+unsigned char History_Count()
+{
+  return 0;
+}
+
+
+void History_Get(unsigned char n, char * dst, unsigned char size)
+{
+  dst[0] = 0;
+}
+
+
+unsigned char History_IsLast(const char * cmd)
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef HISTORY_HEADER
+#define HISTORY_HEADER
+
+/* Commands history kept as a ring of NUL terminated entries, the oldest
+   entries are dropped to make room. HISTORY_SIZE 0 removes history. */
+
+#ifndef HISTORY_SIZE
+#define HISTORY_SIZE 256
+#endif
+
+void History_Add(const char * cmd);
+unsigned char History_Count();
+void History_Get(unsigned char n, char * dst, unsigned char size);
+unsigned char History_IsLast(const char * cmd);
+
+#endif
@@ -0,0 +1,133 @@
+#include "listen.h"
+#include "gpib.h"
+#include "usart.h"
+#include "pool.h"
+
+#define Wrap(x) (((x) >= LISTEN_RING_SIZE)?(x)-LISTEN_RING_SIZE:(x))
+
+static unsigned char * listenRing;
+static unsigned int listenTail;
+static unsigned int listenUsed;
+static unsigned int listenEnds[LISTEN_ENDS]; // bytes from tail to end of message, oldest first
+static unsigned char listenEndCount;
+static unsigned char listenActive;
+static unsigned char listenTalker; // bytes in ring came from this address
+
+
+unsigned char Listen_Start(unsigned char talker)
+{
+  listenActive = 1;
+  if (!listenRing)
+    listenRing = Pool_Alloc(LISTEN_RING_SIZE);
+  else if (talker == listenTalker)
+    return 1;
+  listenTalker = talker;
+  listenTail = 0;
+  listenUsed = 0;
+  listenEndCount = 0;
+  return (listenRing != 0);
+}
+
+
+void Listen_Stop()
+{
+  listenActive = 0;
+  if (listenRing && !listenUsed)
+  {
+    Pool_Free(listenRing);
+    listenRing = 0;
+  }
+}
+
+
+/* takes bytes already offered by talker into free space after head */
+void Listen_Task()
+{
+  unsigned int head;
+  unsigned int free;
+  unsigned int len = 0;
+
+  if (!listenActive || !listenRing || (LISTEN_ENDS == listenEndCount))
+    return;
+
+  head = Wrap(listenTail + listenUsed);
+  free = LISTEN_RING_SIZE - listenUsed;
+  if (free > LISTEN_RING_SIZE - head)
+    free = LISTEN_RING_SIZE - head;
+  if (!free)
+    return;
+
+  GPIB_Receive_pending(&listenRing[head], free, &len);
+  listenUsed += len;
+  if (len && gpibEOI)
+    listenEnds[listenEndCount++] = listenUsed;
+}
+
+
+unsigned int Listen_Used()
+{
+  return listenUsed;
+}
+
+
+/* bytes to read at most, up to end of oldest message */
+static unsigned int Available(unsigned int max, unsigned char * eoi)
+{
+  *eoi = 0;
+  if (max > listenUsed)
+    max = listenUsed;
+  if (listenEndCount && (listenEnds[0] <= max))
+  {
+    max = listenEnds[0];
+    *eoi = 1;
+  }
+  return max;
+}
+
+
+/* n bytes from tail into buf, or to PC without buf */
+static void Take(unsigned char * buf, unsigned int n, unsigned char eoi)
+{
+  unsigned int i;
+
+  for (i=0; i<n; i++)
+  {
+    if (buf)
+      buf[i] = listenRing[listenTail];
+    else
+      UART_transmit(listenRing[listenTail]);
+    listenTail = Wrap(listenTail+1);
+  }
+  listenUsed -= n;
+
+  for (i=0; i<listenEndCount; i++)
+    listenEnds[i] -= n;
+  if (eoi)
+  {
+    listenEndCount--;
+    for (i=0; i<listenEndCount; i++)
+      listenEnds[i] = listenEnds[i+1];
+  }
+  if (!listenActive)
+    Listen_Stop(); // ring read empty is given back
+}
+
+
+unsigned int Listen_Read(unsigned char * buf, unsigned int max, unsigned char * eoi)
+{
+  unsigned int n = Available(max, eoi);
+
+  Take(buf, n, *eoi);
+  return n;
+}
+
+
+void Listen_Send()
+{
+  unsigned char eoi;
+  unsigned int n = Available(255, &eoi);
+
+  UART_transmit(n);
+  UART_transmit((eoi?LISTEN_EOI:0) | ((listenUsed > n)?LISTEN_MORE:0));
+  Take(0, n, eoi);
+}
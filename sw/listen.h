@@ -0,0 +1,29 @@
+#ifndef LISTEN_HEADER
+#define LISTEN_HEADER
+
+/* Background capture in listen mode. While converter is addressed as
+   listener, main loop takes whatever the talker offers into a ring from
+   pool, so the talker is not held off between commands. NRFD is kept ready
+   while the ring has room. Reads stop at ends of messages (EOI), which are
+   kept for LISTEN_ENDS messages, capture pauses when more are waiting.
+
+   U command reply: <length><flags><payload>, length up to 255. */
+
+#define LISTEN_RING_SIZE 256
+#define LISTEN_ENDS 4
+
+#define LISTEN_EOI 0x01  // payload ends with byte sent with EOI
+#define LISTEN_MORE 0x02 // ring holds more data
+
+/* Start takes ring from pool (0 if not possible), after Stop ring is given
+   back as soon as it is read empty. Ring holds bytes of one talker, what
+   is left from another one is dropped when it is started again. */
+unsigned char Listen_Start(unsigned char talker);
+void Listen_Stop();
+void Listen_Task();
+
+unsigned int Listen_Used();
+unsigned int Listen_Read(unsigned char * buf, unsigned int max, unsigned char * eoi);
+void Listen_Send(); // U reply
+
+#endif
@@ -0,0 +1,70 @@
+#include "macro.h"
+#include <string.h>
+#include <avr/eeprom.h>
+
+static unsigned char EEMEM eeMacros[MACRO_COUNT][MACRO_SIZE];
+
+
+static unsigned char End(unsigned char c)
+{
+  return (0 == c) || (0xFF == c); // 0xFF erased
+}
+
+
+/* start of empty step ending macro n */
+static unsigned int Used(unsigned char n)
+{
+  unsigned int pos = 0;
+
+  while ((pos < MACRO_SIZE) && !End(eeprom_read_byte(&eeMacros[n][pos])))
+  {
+    while ((pos < MACRO_SIZE) && eeprom_read_byte(&eeMacros[n][pos]))
+      pos++;
+    pos++;
+  }
+  return pos;
+}
+
+
+unsigned char Macro_Add(unsigned char n, const char * step)
+{
+  unsigned int len = strlen(step);
+  unsigned int pos = Used(n);
+  unsigned int i;
+
+  if ((n >= MACRO_COUNT) || !len || (pos + len + 2 > MACRO_SIZE))
+    return 0;
+
+  // new end first and old end last, macro stays valid if power fails
+  eeprom_update_byte(&eeMacros[n][pos+len+1], 0);
+  eeprom_update_byte(&eeMacros[n][pos+len], 0);
+  for (i=len-1; i>0; i--)
+    eeprom_update_byte(&eeMacros[n][pos+i], step[i]);
+  eeprom_update_byte(&eeMacros[n][pos], step[0]);
+  return 1;
+}
+
+
+void Macro_Clear(unsigned char n)
+{
+  if (n < MACRO_COUNT)
+    eeprom_update_byte(&eeMacros[n][0], 0);
+}
+
+
+unsigned char Macro_Next(unsigned char n, unsigned int * pos, char * dst, unsigned char size)
+{
+  unsigned char i = 0;
+  unsigned char c;
+
+  if ((n >= MACRO_COUNT) || (*pos >= MACRO_SIZE) || End(eeprom_read_byte(&eeMacros[n][*pos])))
+  {
+    dst[0] = 0;
+    return 0;
+  }
+  while ((*pos < MACRO_SIZE) && (c = eeprom_read_byte(&eeMacros[n][(*pos)++])))
+    if (i+1 < size)
+      dst[i++] = c;
+  dst[i] = 0;
+  return i;
+}
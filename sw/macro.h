@@ -0,0 +1,19 @@
+#ifndef MACRO_HEADER
+#define MACRO_HEADER
+
+/* Command macros kept in EEPROM, MACRO_COUNT of them with MACRO_SIZE bytes
+   each. A macro is a list of NUL terminated command lines ended by an empty
+   one (or erased EEPROM), main loop runs them as if they came from PC. */
+
+#define MACRO_COUNT 8
+#define MACRO_SIZE 112 // EEPROM of ATmega32 is 1024 bytes
+
+/* Add returns 0 if macro has no room for step */
+unsigned char Macro_Add(unsigned char n, const char * step);
+void Macro_Clear(unsigned char n);
+
+/* Copies step of macro n at *pos to dst and moves *pos to the next one,
+   returns step length, 0 after last step */
+unsigned char Macro_Next(unsigned char n, unsigned int * pos, char * dst, unsigned char size);
+
+#endif
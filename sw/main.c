@@ -11,6 +11,23 @@
     - printer mode, red led 
     - listen mode
     - M command for sending data without EOI
+    - W/V device read/write, addressing sent only when it changes
+    - device mode, converter talks queued data to external controller
+    - optional run length coding of printer/device mode data
+    - ring history and buffer pool, Y/Z up to 255 bytes
+    - bus analyzer mode with timestamped records
+    - handshake latency profiler, per device timing
+    - burst acquisition, replies packed in RAM and sent at once
+    - main loop doesn't block on PC input, printer mode runs as its task,
+      ESC aborts bus transfers, interrupt driven UART transmit
+    - numeric replies converted to binary floats/integers while received
+    - polled readings summarized on converter (count, mean, min, max)
+    - listen mode captures in background, U reads what arrived
+    - Z replies also in base64 (Z6) and base85 (Z8)
+    - bus enumeration from handshake lines, optionally with *IDN?
+    - command macros in EEPROM, run by converter back-to-back
+    - wedged handshakes cleared automatically, cause reported, watchdog
+    - SRQ event mode, requester serial polled and read out unsolicited
 */
 
 
@@ -21,79 +38,49 @@
 #include <avr/io.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <math.h>
 #include "usart.h"
+#include "gpib.h"
+#include "rle.h"
+#include "pool.h"
+#include "history.h"
+#include "sniff.h"
+#include "num.h"
+#include "listen.h"
+#include "encode.h"
+#include "macro.h"
 #include "avr/pgmspace.h"
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
 
 #define F_CPU 12000000UL  
 #include <util/delay.h>
 
 #define DEFAULT_ADDRESS 21
 
-/*
-GPIB Connector pinout
-
-Pin | Nazwa | Opis               | Source            | Atmega pin |	
-----+-------+--------------------+-------------------+------------+--------
-1   | DIO1  | Data bit 1 (LSB)   | Talker            | PA0	37    | X3-4
-2   | DIO2  | Data bit 2         | Talker            | PA1	36    | X3-3
-3   | DIO3  | Data bit 3         | Talker            | PA2	35    | X3-2
-4   | DIO4  | Data bit 4         | Talker            | PA3	34    | X3-1
-5   | EOI   | End Or Indentity   | Talker/Controller | PC7	26    | X4-1
-6   | DAV   | Data Valid         | Controller        | PC6	25    | X4-2
-7   | NRFD  | Not Ready For Data | Listener          | PC5	24    | X4-3
-8   | NDAC  | No Data Accepted   | Listener          | PC4	23    | X4-4
-9   | IFC   | Interface Clear    | Controller        | PC3	22    | X5-1
-10  | SRQ   | Service Request    | Talker            | PC2	21    | X5-2
-11  | ATN   | Attention          | Controller        | PC1	20    | X5-3
-12  |       | Ekran              |                   |            |
-13  | DIO5  | Data bit 5         | Talker            | PA4	33    | X2-4
-14  | DIO6  | Data bit 6         | Talker            | PA5	32    | X2-3
-15  | DIO7  | Data Bit 7         | Talker            | PA6	31    | X2-2
-16  | DIO8  | Data bit 8 (MSB)   | Talker            | PA7	30    | X2-1
-17  | REN   | Remote Enabled     | Controller        | PC0	19    | X5-4
-18  |       | GND DAV            |                   |            |
-19  |       | GND NRFD           |                   |            |
-20  |      | GND NDAC           |                   |            |
-21  |       | GND IFC	         |                   |            |
-22  |       | GND SRQ	         |                   |            |
-23  |       | GND ATN	         |                   |	          |
-24  |       | GND data           |                   |	          | X3-5
-*/
-
-#define EOI (_BV(PC7))  //pin 26 ATmega, pin 5 GPIB
-#define DAV (_BV(PC6))  //pin 25 ATmega, pin 6 GPIB
-#define NRFD (_BV(PC5)) //pin 24 ATmega, pin 7 GPIB, output
-#define NDAC (_BV(PC4)) //pin 23 ATmega, pin 8 GPIB, output
-#define IFC (_BV(PC3))  //pin 22 ATmega, pin 9 GPIB
-#define SRQ (_BV(PC2))  //pin 21 ATmega, pin 10 GPIB
-#define ATN (_BV(PC1))  //pin 20 ATmega, pin 11 GPIB
-#define REN (_BV(PC0))  //pin 19 ATmega, pin 17 GPIB
-
 #define SetLed(x) ( PORTD = ((x==0)?(PORTD | _BV(PD2)) : (PORTD & ~_BV(PD2)) ))
 
-#define SetEOI(x) ( PORTC = (x)? (PORTC | EOI) : (PORTC & ~EOI) )
-#define SetDAV(x) ( PORTC = (x)? (PORTC | DAV) : (PORTC & ~DAV) )
-#define SetNRFD(x) ( PORTC = (x)? (PORTC | NRFD) : (PORTC & ~NRFD) )
-#define SetNDAC(x) ( PORTC = (x)? (PORTC | NDAC) : (PORTC & ~NDAC) )
-#define SetIFC(x) ( PORTC = (x)? (PORTC | IFC) : (PORTC & ~IFC) )
-#define SetSRQ(x) ( PORTC = (x)? (PORTC | SRQ) : (PORTC & ~SRQ) )
-#define SetATN(x) ( PORTC = (x)? (PORTC | ATN) : (PORTC & ~ATN) )
-#define SetREN(x) ( PORTC = (x)? (PORTC | REN) : (PORTC & ~REN) )
-
 #define ESC_KEY_UP 0x41
 #define ESC_KEY_DOWN 0x42
 #define ESC_KEY_RIGHT 0x43
 #define ESC_KEY_LEFT 0x44
 
-#define MAX_COMMANDS 15
 #define BUF_SIZE 64
-#define GPIB_BUF_SIZE 128
-#define GPIB_MAX_RECEIVE_TIMEOUT 50000
-#define GPIB_MAX_TRANSMIT_TIMEOUT 50000
+#define GPIB_BLOCK_MAX 255 // Y and Z replies carry one byte length
+#define TALK_QUEUE_SIZE 128
+#define NUM_CHUNK 64 // F command, reply is converted in chunks of this size
+#define T0_TICK_US 10923 // timer 0 overflow period, 128 counts of 12 MHz/1024
+#define AGG_INTERVAL_MAX 715000UL // ms, 65535 timer 0 ticks
+#define AGG_LAST 0x01 // J record flags, partial window after ESC
+#define IDN_MAX 72 // A?I, *IDN? reply kept per instrument
 #define EMPTY_LINE 1
 
-#define HELP_LINES 18
+#define MACRO_NONE 0xFF
+// about 100 ms before polling again for SRQ no polled instrument admits
+// to, a poll round costs a timeout per instrument which doesn't answer
+#define SRQ_RETRY_TICKS 9
+#define HELP_LINES 31
 #define HELP_STRING_LEN 64
 const char helpStrings[HELP_LINES][HELP_STRING_LEN] PROGMEM = {
   "GPIB to USB converter v4\r\n\r\n",
@@ -101,19 +88,32 @@ const char helpStrings[HELP_LINES][HELP_STRING_LEN] PROGMEM = {
   "  <D> Data (ATN false), <M> Data without EOI\r\n",
   "  <C> Command (ATN true)\r\n",
   "  <T> Hex transmit (0C - command, 0D - data)\r\n",
-  "Receive commands (receives until EOI,max 127 bytes)\r\n",
+  "  <W> Data to device, W<addr><data>\r\n",
+  "Receive commands (receives until EOI,Y/Z max 255 bytes)\r\n",
   "  <X> ASCII, <payload> or TIMEOUT\r\n",
   "  <Y> BINARY, <length><payload>\r\n",
-  "  <Z> HEX, <length><payload>\r\n",
+  "  <Z> HEX, <length><payload>, Z6 base64, Z8 base85\r\n",
+  "  <V> From device, V<addr>[X|Y|Z|Z6|Z8], format as X/Y/Z\r\n",
+  "  <U> Listen mode capture, <length><flags><payload>\r\n",
+  "  <F> Numbers from device, F<addr>[decimals], {<n><values>}\r\n",
   "  <P> Continous read (plotter mode)\r\n",
+  "  <B> Burst, B<addr><count>,<query>, <n>{<dt><len><reply>}\r\n",
+  "  <J> Statistics, J<addr><n>[/<ms>],<query>, ESC ends\r\n",
+  "  <N> Bus analyzer, N0 observer, N1 acceptor, ESC ends\r\n",
+  "Device mode (converter is talker/listener at its address)\r\n",
+  "  <O> Queue size, OD<data>/OH<hex> add, OC clear, OG go\r\n",
   "General commands\r\n",
-  "  <A> Set/get converter talk address\r\n",
-  "  <S> Get REQ/SRQ/LISTEN state (1 if true)\r\n",
+  "  <A> Set/get converter address, A? bus map, A?I with *IDN?\r\n",
+  "  <S> REQ/SRQ/LISTEN state (1 if true), S1/S0 SRQ events\r\n",
   "  <R> Set REMOTE mode (REN true)\r\n",
   "  <L> Set LOCAL mode (REN false)\r\n",
   "  <I> Generate IFC pulse\r\n",
   "  <E> Get/set echo on(E1)/off(E0)\r\n",
-  "  <H> Commands history\r\n"
+  "  <K> Get/set P/O mode data compression on(K1)/off(K0)\r\n",
+  "  <G> Profiler G0/G1, G<a> show, G<a>T tune, G<a>D default\r\n",
+  "  <H> Commands history\r\n",
+  "  <@> Macro @<n> run, @<n>+<cmd> add, @<n>- clear, @<n>? list\r\n",
+  "  <!> Bus recovery, ! last one, !0/!1 auto off/on, !R now\r\n"
 };
 
 
@@ -121,7 +121,8 @@ typedef enum {OFF = 0, SLOW, FAST} ledBlinking_t;
 ledBlinking_t ledBlinking = OFF;
 unsigned char listenAddress = DEFAULT_ADDRESS;
 unsigned char msgEndSeq = 0;
-unsigned char remoteState = 0;
+unsigned char streamCompression = 0;
+unsigned char EEMEM eeStreamCompression = 0;
 
 /* ======================================================= */
 
@@ -143,250 +144,28 @@ int uart_putchar(char ch, FILE* file)
 }
 
 
-void ReconfigureGPIO_GPIBReceiveMode()
-{
-  DDRA = 0x00; // PA0-PA7 inputs
-  PORTA = 0xff; // pullup on
-  
-  DDRC = IFC | ATN | REN | NRFD | NDAC; // these lines are outputs, other as inputs
-  PORTC = IFC | ATN | (remoteState?0:REN) | EOI | DAV | SRQ; // pullup on
-}
-
-
-void ReconfigureGPIO_GPIBNormalMode()
+/* printer and device mode data to PC, run length coded if enabled */
+void StreamPut(unsigned char c)
 {
-  DDRA = 0xff; // data lines are outputs
-  PORTA = 0x00; // output level 0
-  
-  DDRC = IFC | ATN | REN | EOI | DAV; // these lines are outputs
-  PORTC = IFC | ATN | (remoteState?0:REN) | EOI | DAV | SRQ | NRFD | NDAC; // pullup on
+  if (streamCompression)
+    RLE_Put(c);
+  else
+    UART_transmit(c);
 }
 
 
-int GPIB_Receive(unsigned char * buf, unsigned char bufLength, unsigned char * receivedLength)
+void StreamFlush()
 {
-  unsigned char index = 0;
-  unsigned char c;
-  unsigned int timeout;
-
-  do
-  {
-    SetNRFD(1); //ready for receiving data
-    //-1 & 5
-    
-    timeout = 0;
-    while (PINC & DAV) // waiting for falling edge
-    {
-      //_delay_ms(1);
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNRFD(0);
-        return 0;
-      }
-    }
-    // 0
-    
-    SetNRFD(0); //not ready for receiving data
-    // 1
-    
-    c = ~PINA; //read data
-
-    buf[index++] = c;
-
-    SetNDAC(1); //data accepted
-    //2
-    
-    while (!(PINC & DAV)) // waiting for rising edge
-    {
-      //_delay_ms(1);
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNDAC(0);
-        return 0;
-      }
-    }
-    //3
-    
-    SetNDAC(0);
-    //4
-  } while ((index < bufLength) /*&& (c != 13)*/);
-  *receivedLength = index;
-  return 255;
+  if (streamCompression)
+    RLE_Flush();
 }
 
 
-int GPIB_Receive_till_eoi(unsigned char * buf, unsigned char bufLength, unsigned char * receivedLength)
+/* end of message marker, only possible in coded stream */
+void StreamEOI()
 {
-  unsigned char index = 0;
-  unsigned char c;
-  unsigned char eoi = 0;
-  unsigned int timeout;
-
-  do
-  {
-    SetNRFD(1); //ready for receiving data
-    //-1 & 5
-    
-    timeout = 0;
-    while (PINC & DAV) // waiting for falling edge
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNRFD(0);
-        return 0;
-      }
-    }
-    // 0
-    
-    if ((PINC & EOI) == 0)
-      eoi = 1;
-    
-    SetNRFD(0); //not ready for receiving data
-    // 1
-    
-    c = ~PINA; //read data
-
-    buf[index++] = c;
-
-    SetNDAC(1); //data accepted
-    //2
-    
-    while (!(PINC & DAV)) // waiting for rising edge
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNDAC(0);
-        return 0;
-      }
-    }
-    //3
-    
-    SetNDAC(0);
-    //4
-  } while ((index < bufLength) && (eoi == 0));
-  *receivedLength = index;
-  return 255;
-}
-
-
-int GPIB_Receive_till_lf(unsigned char * buf, unsigned char bufLength, unsigned char * receivedLength)
-{
-  unsigned char index = 0;
-  unsigned char c;
-  unsigned int timeout;
-
-  //SetNDAC(0);
-  //SetNRFD(0);
-
-  do
-  {
-    SetNRFD(1); //ready for receiving data
-    //-1 & 5
-    
-    timeout = 0;
-    while (PINC & DAV) // waiting for falling edge
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNRFD(0);
-        return 0;
-      }
-    }
-    // 0
-       
-    SetNRFD(0); //not ready for receiving data
-    // 1
-    
-    c = ~PINA; //read data
-
-    buf[index++] = c;
-
-    SetNDAC(1); //data accepted
-    //2
-    
-    while (!(PINC & DAV)) // waiting for rising edge
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_RECEIVE_TIMEOUT)
-      {
-        *receivedLength = index;
-        SetNDAC(0);
-        return 0;
-      }
-    }
-    //3
-    
-    SetNDAC(0);
-    //4
-  } while ((index < bufLength) && (c != 10));
-  *receivedLength = index;
-  return 255;
-}
-
-
-int GPIB_Transmit(unsigned char * buf, unsigned char bufLength, unsigned char eoi)
-{
-  unsigned char index = 0;
-  unsigned int timeout;
-  
-  if ((0 == bufLength) || ((PINC & NRFD) && (PINC & NDAC)))
-    return 0;
-  
-  do
-  {
-    if ((index+1 == bufLength) && eoi)
-      SetEOI(0); // last byte
-    
-    //transmit debug    
-    //printf("%02x ", buf[index]);
-    
-    PORTA = ~buf[index];
-    index++;
-    
-    _delay_us(100);
-     
-    timeout = 0;
-    while (!(PINC & NRFD)) // waiting for high on NRFD
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_TRANSMIT_TIMEOUT)
-      {
-        SetEOI(1);
-        return 0;
-      }
-    }
-    
-    SetDAV(0);
-    _delay_us(100);
-   
-    while (!(PINC & NDAC)) // waiting for high on NDAC
-    {
-      timeout++;
-      if (timeout > GPIB_MAX_TRANSMIT_TIMEOUT)
-      {
-        SetEOI(1);
-        SetDAV(1);
-        return 0;
-      }
-    }
-    
-    SetEOI(1);
-    SetDAV(1);
-    //4
-  } while ((index < bufLength));
-
-  //printf("\r\n");
-  return 255;
+  if (streamCompression)
+    RLE_Control(RLE_CTRL_EOI);
 }
 
 
@@ -403,21 +182,15 @@ void ShowHelp()
 }
 
 
-char UART_RcvEscapeSeq()
-{
-  while (!UARTDataAvailable());
-  if (UART_receive() != 0x5B)
-    return 0;
-  while (!UARTDataAvailable());
-  return UART_receive();
-}
-
 #define T0_INIT 128 //177 = 255-78  daje 10ms dla 8MHz, 79=255-156 dla 16MHz
 
+volatile unsigned int timerTicks = 0; // timer 0 overflows, T0_TICK_US each
+
 SIGNAL (SIG_OVERFLOW0) {
   static unsigned char timCnt = 0;
   static unsigned char led = 0;
   TCNT0 = T0_INIT; 
+  timerTicks++;
   if (OFF == ledBlinking)
     return;
 	
@@ -482,259 +255,951 @@ unsigned char CheckHexMsg(unsigned char * buf, unsigned char len, unsigned char
   return 1;
 }
 
-char commandsHistory[BUF_SIZE*MAX_COMMANDS];
-char savedCommands = 0;
-char selectedCommand = 0;
+unsigned char selectedCommand = 0;
 
 unsigned char listenMode = 0;
 unsigned char listenMode_prev = 0;
+unsigned char printerMode = 0;
+unsigned char aggregateMode = 0;
 
 unsigned char buf[BUF_SIZE+4];
-unsigned char msgBuf[BUF_SIZE+4];
-unsigned char gpibBuf[GPIB_BUF_SIZE];
+unsigned char bufPos = 0;
+unsigned char cursorPos = 0;
+unsigned char localEcho = 1;
+unsigned char * gpibBuf = 0; // transfer buffer taken from pool for one command
+unsigned int gpibBufSize = 0;
+
+/* device mode talker data, messages stored as <length><payload> */
+unsigned char * talkQueue = 0; // taken from pool while messages are queued
+unsigned char talkQueueLen = 0;
+unsigned char talkQueueMsgs = 0;
+unsigned char talkQueueSent = 0; // bytes of first message already sent
+
+unsigned char recoveryAuto = 1; // wedged bus cleared after failed transfer
+unsigned char srqEvents = 0; // S1, SRQ answered by converter
+uint32_t srqPollMap = 0; // instruments found when S1 was given
+unsigned int srqRetry = 0; // timerTicks
+unsigned char macroNumber = MACRO_NONE; // macro being run
+unsigned int macroPos = 0; // its next step
+
+
+/* Takes transfer buffer of at most max bytes, receive functions are given
+   gpibBufSize-1 to leave room for string termination */
+unsigned char GpibBuf_Alloc(unsigned int max)
+{
+  gpibBuf = Pool_AllocLargest(max+1, &gpibBufSize);
+  return (gpibBufSize > 1);
+}
 
-void main(void) 
+
+void GpibBuf_Free()
 {
-  unsigned char bufPos = 0;
-  unsigned char cursorPos = 0;
-  unsigned char localEcho = 1;
-  unsigned char c;
-  int i;
-  unsigned char gpibIndex = 0;
-  unsigned char command = 0;
-  int result = 0;
-  unsigned char msgLen = 0;
-  unsigned char msgEOI = 1;
+  Pool_Free(gpibBuf);
+  gpibBuf = 0;
+  gpibBufSize = 0;
+}
 
-  GPIO_init();
-  
-/* timer & interrupt initialize */
-  TIMSK = _BV(TOIE0);        // wlacz obsluge przerwan T/C0
-  TCNT0 = T0_INIT;         // wartosc poczatkowa T/C0
-  TCCR0 = _BV(CS00)|_BV(CS02); // preskaler 1024
-  sei();
-  
-  ReconfigureGPIO_GPIBNormalMode();
-  UART_init();
-  fdevopen(uart_putchar, NULL);
-  
-#if 1 
-  if (0 == (PINB & _BV(PB5))) // printer mode
+
+/* Reply of addressed talker into buf, bytes captured in background come
+   first so that none is skipped or left for the next reader. gpibEOI as
+   after GPIB_Receive_till_eoi(). */
+int ReceiveTalker(unsigned char * buf, unsigned int max, unsigned int * len)
+{
+  unsigned int received = 0;
+  int result = 255;
+
+  *len = Listen_Read(buf, max, &gpibEOI);
+  if (!gpibEOI && (*len < max))
+    result = GPIB_Receive_till_eoi(&buf[*len], max-*len, &received);
+  *len += received;
+  return result;
+}
+
+
+/* received data to PC in X (ascii), Y (binary) or Z (hex) format */
+void SendReceived(unsigned char format, unsigned int len)
+{
+  unsigned int i;
+
+  if ('Y' == format)
   {
-    ledBlinking = SLOW;
+    UART_transmit(len);
+    for (i=0; i<len; i++)
+      UART_transmit(gpibBuf[i]);
+  }
+  else if (('Z' == format) || ('6' == format) || ('8' == format)) // length always hex
+  {
+    Encode_Start(ENCODE_HEX);
+    Encode_Put(len);
+    Encode_Start(('6' == format)?ENCODE_BASE64:('8' == format)?ENCODE_BASE85:ENCODE_HEX);
+    for (i=0; i<len; i++)
+      Encode_Put(gpibBuf[i]);
+    Encode_End();
+    UART_transmit(13);
+    UART_transmit(10);
+  }
+  else if (len != 0)
+  {
+    gpibBuf[len] = 0;
+    printf("%s",gpibBuf);
+  }
+  else
+    printf("TIMEOUT\r\n");
+}
+
+
+/* listen mode follows converter address in tracked bus addressing */
+void UpdateListenMode()
+{
+  listenMode = GPIB_IsListener(listenAddress);
+  if (listenMode)
+  {
+    ledBlinking = FAST;
     ReconfigureGPIO_GPIBReceiveMode();
-    _delay_ms(1);
+    Listen_Start(gpibAddressing.valid?gpibAddressing.talker:GPIB_ADDR_NONE);
+  }
+  else
+  {
+    Listen_Stop();
+    ledBlinking = OFF;
+    SetLed(1);
+    ReconfigureGPIO_GPIBNormalMode();
+  }
+  listenMode_prev = listenMode;
+}
+
+
+unsigned char TalkQueue_Add(unsigned char * data, unsigned char len)
+{
+  if ((0 == len) || ((talkQueueLen + len + 1) > TALK_QUEUE_SIZE))
+    return 0;
+
+  if ((0 == talkQueue) && (0 == (talkQueue = Pool_Alloc(TALK_QUEUE_SIZE))))
+    return 0;
+
+  talkQueue[talkQueueLen++] = len;
+  memcpy(&talkQueue[talkQueueLen], data, len);
+  talkQueueLen += len;
+  talkQueueMsgs++;
+  return 1;
+}
+
+
+/* Bus cleared after stalled transfer, listen mode follows addressing which
+   was sent again */
+void Recover()
+{
+  GPIB_Recover();
+  UpdateListenMode();
+}
+
+
+/* ! reply: cause,lines,result,ms,count, see gpib.h */
+void ShowRecovery()
+{
+  printf("%d,%02X,%d,%d,%u\r\n", gpibRecovery.cause, gpibRecovery.lines, gpibRecovery.result,
+         gpibRecovery.ms, gpibRecovery.count);
+}
+
 
-    while (1)
+void TalkQueue_Clear()
+{
+  Pool_Free(talkQueue);
+  talkQueue = 0;
+  talkQueueLen = 0;
+  talkQueueMsgs = 0;
+  talkQueueSent = 0;
+}
+
+
+/* sources first queued message, EOI is sent with its last byte */
+void TalkQueue_Talk()
+{
+  unsigned char len = talkQueue[0];
+
+  talkQueueSent += GPIB_DeviceTalk(&talkQueue[1+talkQueueSent], len-talkQueueSent, 1);
+  if (talkQueueSent == len)
+  {
+    talkQueueLen -= len+1;
+    memmove(&talkQueue[0], &talkQueue[len+1], talkQueueLen);
+    talkQueueMsgs--;
+    talkQueueSent = 0;
+    if (0 == talkQueueMsgs)
+      TalkQueue_Clear();
+  }
+}
+
+
+/* Converter acts as device at listenAddress for external controller.
+   Talker data come from talk queue, listener data are sent to PC.
+   Returns after ESC received from PC. */
+void DeviceMode()
+{
+  unsigned char c = 0;
+  unsigned char data;
+  unsigned char eoi;
+  unsigned char talker;
+  unsigned char listener;
+
+  listenMode = 0;
+  ledBlinking = SLOW;
+  GPIB_ResetAddressing();
+  ReconfigureGPIO_GPIBDeviceMode();
+
+  while (c != 27)
+  {
+    wdt_reset();
+    if (UARTDataAvailable())
+      c = UART_receive();
+
+    if (0 == (PINC & IFC))
     {
-      result = GPIB_Receive(gpibBuf, GPIB_BUF_SIZE-2, &gpibIndex);
-      if (gpibIndex != 0)
+      GPIB_ResetAddressing();
+      continue;
+    }
+
+    talker = (gpibAddressing.talker == listenAddress);
+    listener = GPIB_IsListener(listenAddress);
+
+    if (0 == (PINC & ATN)) // command bytes, all devices take part
+    {
+      GPIB_DeviceAcceptor(1);
+      if (GPIB_DeviceAccept(&data, &eoi))
       {
-        for (i=0; i<gpibIndex; i++)
-          UART_transmit(gpibBuf[i]);
+        GPIB_TrackCommand(data);
+        if ((GPIB_CMD_DCL == data) || ((GPIB_CMD_SDC == data) && listener))
+          TalkQueue_Clear();
       }
-      else
+    }
+    else if (talker && talkQueueMsgs)
+      TalkQueue_Talk();
+    else if (listener)
+    {
+      GPIB_DeviceAcceptor(1);
+      if (GPIB_DeviceAccept(&data, &eoi))
       {
-        _delay_ms(10);
+        StreamPut(data);
+        if (eoi)
+          StreamEOI();
       }
+      else
+        StreamFlush();
     }
+    else
+      GPIB_DeviceAcceptor(0);
   }
 
-  localEcho = (PINB & _BV(PB7))?1:0;
-#endif
+  StreamFlush();
+  gpibAddressing.valid = 0; // bus was addressed by other controller
+  gpibAddressing.listeners = 0;
+  ReconfigureGPIO_GPIBNormalMode();
+  UpdateListenMode();
+}
 
+
+/* Repeats query count times as fast as bus allows, replies are packed into
+   buffer from pool and sent together when done: <n> then n records
+   <dt low><dt high><length><reply>, dt is GPIB_TIMER ticks (modulo 65536)
+   between starts of this and previous query. Stops early at first timeout,
+   when reply doesn't fit into buffer or ESC is received. */
+void Burst(unsigned char device, unsigned char count, unsigned char * query, unsigned char len)
+{
+  unsigned int pos = 0;
+  unsigned int rxLen;
+  unsigned int max;
+  unsigned int start;
+  unsigned int prev = 0;
+  unsigned char n = 0;
+  int result;
+
+  if (!GpibBuf_Alloc(POOL_SIZE))
+  {
+    UART_transmit(0);
+    return;
+  }
+
+  while ((n < count) && (pos+4 <= gpibBufSize))
+  {
+    if (UARTDataAvailable() && (27 == UART_peek())) // other commands stay queued
+    {
+      UART_receive();
+      break;
+    }
+
+    start = TCNT1;
+    result = GPIB_Address(listenAddress, device);
+    UpdateListenMode();
+    if (result == 255)
+      result = GPIB_Transmit(query, len, 1);
+    if (result == 255)
+    {
+      result = GPIB_Address(device, listenAddress);
+      UpdateListenMode();
+    }
+
+    rxLen = 0;
+    max = gpibBufSize-pos-3;
+    if (result == 255)
+      result = ReceiveTalker(&gpibBuf[pos+3], (max > GPIB_BLOCK_MAX)?GPIB_BLOCK_MAX:max, &rxLen);
+    if (0 == rxLen)
+      break;
+
+    gpibBuf[pos] = n?(start-prev):0;
+    gpibBuf[pos+1] = n?((start-prev) >> 8):0;
+    gpibBuf[pos+2] = rxLen;
+    pos += 3+rxLen;
+    prev = start;
+    n++;
+    if ((result != 255) || !gpibEOI)
+      break; // part of reply, rest is left in device
+  }
+
+  UART_transmit(n);
+  for (rxLen=0; rxLen<pos; rxLen++)
+    UART_transmit(gpibBuf[rxLen]);
+  GpibBuf_Free();
+}
+
+
+/* A? reply, instruments on bus as 8 hex digits, bit n for address n. With
+   idn a line <aa>:<*IDN? reply> follows for each of them, empty reply when
+   instrument doesn't answer (no IEEE 488.2 support). */
+void Enumerate(unsigned char idn)
+{
+  unsigned char query[] = "*IDN?\n";
+  unsigned int len, i;
+  uint32_t found;
+  unsigned char addr;
+  int result;
+
+  result = GPIB_Enumerate(listenAddress, &found);
+  UpdateListenMode();
+  if (result != 255)
+  {
+    printf("TIMEOUT\r\n");
+    return;
+  }
+  printf("%08lX\r\n", (unsigned long)found);
+  if (!idn)
+    return;
+
+  GpibBuf_Alloc(IDN_MAX);
+  for (addr=0; addr<=GPIB_MAX_ADDRESS; addr++)
+  {
+    if (!(found & (1UL << addr)))
+      continue;
+    len = 0;
+    result = gpibBufSize?GPIB_Address(listenAddress, addr):0;
+    if (result == 255)
+      result = GPIB_Transmit(query, sizeof(query)-1, 1);
+    if (result == 255)
+    {
+      GPIB_Address(addr, listenAddress);
+      UpdateListenMode();
+      ReceiveTalker(gpibBuf, gpibBufSize-1, &len);
+    }
+    while (len && (('\n' == gpibBuf[len-1]) || ('\r' == gpibBuf[len-1])))
+      len--;
+    printf("%02d:", addr);
+    for (i=0; i<len; i++)
+      UART_transmit(gpibBuf[i]);
+    UART_transmit(13);
+    UART_transmit(10);
+  }
+  GpibBuf_Free();
+}
+
+
+/* NRFD/NDAC/DAV latency histograms (bin counts, max in us) and timing */
+void ShowProfile(unsigned char device)
+{
+  const char * names[GPIB_PROFILE_METRICS] = {"NRFD", "NDAC", "DAV"};
+  gpibProfile_t * p = GPIB_Profile(device);
+  unsigned char m, b;
+
+  if (p)
+  {
+    for (m=0; m<GPIB_PROFILE_METRICS; m++)
+    {
+      printf("%s", names[m]);
+      for (b=0; b<GPIB_PROFILE_BINS; b++)
+        printf(" %u", p->bins[m][b]);
+      printf(" %lu\r\n", GPIB_US(p->max[m]));
+    }
+    printf("ERRORS %d\r\n", p->errors);
+  }
+  printf("SETTLE %d TIMEOUT %lu\r\n", gpibTiming[device].settle, GPIB_US(gpibTiming[device].timeout));
+}
+
+
+/* J command, device is polled with query and first number of each reply
+   is summarized over windows of polls. Only summary records are sent:
+   <flags><count low><count high><failed low><failed high><mean><min><max>,
+   values are 4 byte little endian floats (NaN when count is 0). */
+typedef struct {
+  unsigned char device;
+  unsigned char * query; // from pool
+  unsigned char queryLen;
+  unsigned int window;
+  unsigned int interval; // timer 0 ticks between polls
+  unsigned int lastPoll;
+  unsigned int count;
+  unsigned int failed;   // timeouts and replies without number
+  float mean;
+  float min;
+  float max;
+} aggregate_t;
+aggregate_t aggregate;
+
+
+void SendFloat(float f)
+{
+  unsigned char * p = (unsigned char *)&f;
+  unsigned char i;
+
+  for (i=0; i<4; i++)
+    UART_transmit(p[i]);
+}
+
+
+void Aggregate_Send(unsigned char flags)
+{
+  UART_transmit(flags);
+  UART_transmit(aggregate.count);
+  UART_transmit(aggregate.count >> 8);
+  UART_transmit(aggregate.failed);
+  UART_transmit(aggregate.failed >> 8);
+  SendFloat(aggregate.count?aggregate.mean:NAN);
+  SendFloat(aggregate.count?aggregate.min:NAN);
+  SendFloat(aggregate.count?aggregate.max:NAN);
+  aggregate.count = 0;
+  aggregate.failed = 0;
+}
+
+
+/* query gets end sequence, runs as task of main loop until ESC */
+void Aggregate_Start(unsigned char device, unsigned int window, unsigned long ms, unsigned char * query, unsigned char len)
+{
+  aggregate.query = Pool_Alloc(len+2);
+  if (!aggregate.query || !GpibBuf_Alloc(NUM_CHUNK))
+  {
+    GpibBuf_Free();
+    Pool_Free(aggregate.query);
+    printf("ERROR\r\n");
+    return;
+  }
+  memcpy(aggregate.query, query, len);
+  if ((1 == msgEndSeq) || (3 == msgEndSeq))
+    aggregate.query[len++] = 13; //CR
+  if ((2 == msgEndSeq) || (3 == msgEndSeq))
+    aggregate.query[len++] = 10; //LF
+
+  aggregate.device = device;
+  aggregate.queryLen = len;
+  aggregate.window = window;
+  aggregate.interval = (ms*1000 + T0_TICK_US/2)/T0_TICK_US;
+  aggregate.count = 0;
+  aggregate.failed = 0;
+  cli();
+  aggregate.lastPoll = timerTicks - aggregate.interval; // first poll at once
+  sei();
+  ledBlinking = SLOW;
+  aggregateMode = 1;
+}
+
+
+void Aggregate_Stop()
+{
+  Aggregate_Send(AGG_LAST);
+  aggregateMode = 0;
+  GpibBuf_Free();
+  Pool_Free(aggregate.query);
+  ledBlinking = OFF;
   SetLed(1);
-  
-  while (1) //main loop
+}
+
+
+/* one poll when interval elapsed */
+void Aggregate_Task()
+{
+  unsigned int now;
+  unsigned int len;
+  unsigned int i;
+  uint32_t v;
+  float x;
+  int result;
+
+  cli();
+  now = timerTicks;
+  sei();
+  if (now - aggregate.lastPoll < aggregate.interval)
+    return;
+  aggregate.lastPoll = now;
+
+  result = GPIB_Address(listenAddress, aggregate.device);
+  UpdateListenMode();
+  if (result == 255)
+    result = GPIB_Transmit(aggregate.query, aggregate.queryLen, 1);
+  if (result == 255)
   {
-    selectedCommand = savedCommands;
-    
-    if (localEcho && !bufPos)
-      printf("<GPIB> ");
-      
-    do
+    result = GPIB_Address(aggregate.device, listenAddress);
+    UpdateListenMode();
+  }
+
+  Num_Start(NUM_FLOAT, 0, 0);
+  while (result == 255)
+  {
+    len = 0;
+    result = ReceiveTalker(gpibBuf, gpibBufSize-1, &len);
+    for (i=0; i<len; i++)
+      Num_Put(gpibBuf[i]);
+    if (gpibEOI)
+      break;
+  }
+  Num_End();
+  if (uartEscapes)
+    return; // poll aborted by ESC, not counted
+
+  if ((result == 255) && Num_First(&v))
+  {
+    memcpy(&x, &v, 4);
+    if (isnan(x))
+      aggregate.failed++;
+    else if (!aggregate.count++)
+      aggregate.mean = aggregate.min = aggregate.max = x;
+    else
     {
-      while (!UARTDataAvailable());
-      c = UART_receive();
+      aggregate.mean += (x - aggregate.mean)/aggregate.count; // running mean, no large sums
+      if (x < aggregate.min)
+        aggregate.min = x;
+      if (x > aggregate.max)
+        aggregate.max = x;
+    }
+  }
+  else
+    aggregate.failed++;
+
+  if (aggregate.count + aggregate.failed >= aggregate.window)
+    Aggregate_Send(0);
+}
+
+
+/* Printer mode, everything sent on the bus goes to PC. Runs as task of main
+   loop until ESC is received. */
+void PrinterMode_Start()
+{
+  listenMode_prev = 0; //cancel listen mode
+  listenMode = 0; //cancel listen mode
+  Listen_Stop();
+  ledBlinking = SLOW;
+  ReconfigureGPIO_GPIBReceiveMode();
+  GpibBuf_Alloc(POOL_SIZE);
+  gpibAddressing.valid = 0; // talk-only device, pauses aren't stalls
+  printerMode = 1;
+  _delay_ms(1);
+}
+
+
+void PrinterMode_Stop()
+{
+  printerMode = 0;
+  GpibBuf_Free();
+  ReconfigureGPIO_GPIBNormalMode();
+  ledBlinking = OFF;
+  SetLed(1);
+}
+
+
+/* one block from bus, receive returns early when ESC is waiting */
+void PrinterMode_Task()
+{
+  unsigned int len = 0;
+  unsigned int i;
 
-      if (0x08 == c) //backspace
+  if (gpibBufSize > 1)
+    GPIB_Receive_till_eoi(gpibBuf, gpibBufSize-1, &len);
+  if (0 == len)
+    return;
+
+  for (i=0; i<len; i++)
+    StreamPut(gpibBuf[i]);
+  if (gpibEOI)
+    StreamEOI();
+  else
+    StreamFlush();
+}
+
+
+/* Next step of running macro into line buffer, returns its command letter
+   or 0 when macro is done. Input from PC waits until then, ESC stops it. */
+unsigned char MacroStep()
+{
+  if (UARTDataAvailable() && (27 == UART_peek()))
+  {
+    UART_receive();
+    macroNumber = MACRO_NONE;
+    return 0;
+  }
+  bufPos = Macro_Next(macroNumber, &macroPos, (char*)buf, BUF_SIZE);
+  cursorPos = bufPos;
+  if (!bufPos)
+  {
+    macroNumber = MACRO_NONE;
+    return 0;
+  }
+  if (localEcho)
+    printf("%s\r\n", buf);
+  return toupper(buf[0]);
+}
+
+
+/* SRQ event mode, requester is found by serial poll and its output read
+   until EOI, then sent unsolicited between replies:
+   SRQ<addr>,<status hex>,<length>:<payload> CR LF */
+void SrqEvent_Task()
+{
+  unsigned char addr;
+  unsigned char status;
+  unsigned int len = 0;
+  unsigned int now;
+  unsigned int i;
+  int result;
+
+  if (PINC & SRQ)
+    return;
+  cli();
+  now = timerTicks;
+  sei();
+  if ((int)(now - srqRetry) < 0)
+    return;
+
+  addr = GPIB_SerialPoll(listenAddress, srqPollMap, &status);
+  if (GPIB_ADDR_NONE == addr)
+  {
+    UpdateListenMode();
+    srqRetry = now + SRQ_RETRY_TICKS;
+    return;
+  }
+
+  result = GPIB_Address(addr, listenAddress);
+  UpdateListenMode();
+  if ((result == 255) && GpibBuf_Alloc(POOL_SIZE))
+  {
+    ReceiveTalker(gpibBuf, gpibBufSize-1, &len);
+  }
+  printf("SRQ%02d,%02X,%u:", addr, status, len);
+  for (i=0; i<len; i++)
+    UART_transmit(gpibBuf[i]);
+  UART_transmit(13);
+  UART_transmit(10);
+  GpibBuf_Free();
+}
+
+
+/* two digit device address 00..30, GPIB_ADDR_NONE if invalid */
+unsigned char ParseDeviceAddress(unsigned char * s)
+{
+  unsigned char addr;
+
+  if (!isdigit(s[0]) || !isdigit(s[1]))
+    return GPIB_ADDR_NONE;
+
+  addr = (s[0]-'0')*10 + (s[1]-'0');
+  return (addr <= GPIB_MAX_ADDRESS)?addr:GPIB_ADDR_NONE;
+}
+
+
+/* cursor keys, sent by terminal as ESC [ <key> */
+void EditorKey(unsigned char key)
+{
+  switch (key)
+  {
+    case ESC_KEY_UP:
+      selectedCommand = selectedCommand?selectedCommand-1:0;
+      History_Get(selectedCommand, (char*)&buf[0], BUF_SIZE);
+      if (localEcho)
       {
-        if ((bufPos > 0) && (cursorPos == bufPos))
+        while (cursorPos < bufPos)
         {
-          --bufPos;
-          --cursorPos;
-          if (localEcho)
+          UART_transmit(' ');
+          cursorPos++;
+        }
+        while (bufPos--)
+        {
+          UART_transmit(0x08);
+          UART_transmit(' ');
+          UART_transmit(0x08);
+        }
+        printf("%s", &buf[0]);
+      }
+      bufPos = strlen((char*)&buf[0]);
+      cursorPos = bufPos;
+      break;
+      
+    case ESC_KEY_DOWN:
+      if ((selectedCommand+1) == History_Count()) //current command is last command in buffer
+      {
+        selectedCommand = History_Count();
+        if (localEcho)
+        {
+          while (cursorPos < bufPos)
+          {
+            UART_transmit(' ');
+            cursorPos++;
+          }
+          while (bufPos--)
           {
             UART_transmit(0x08);
             UART_transmit(' ');
             UART_transmit(0x08);
           }
         }
-        else if ((bufPos > 0) && (cursorPos > 0))
+        bufPos = 0;
+        cursorPos = 0;
+      }
+      else if ((selectedCommand+1) < History_Count())
+      {
+        selectedCommand++;
+        History_Get(selectedCommand, (char*)&buf[0], BUF_SIZE);
+        if (localEcho)
         {
-          --bufPos;
-          --cursorPos;
-          memmove(&buf[cursorPos], &buf[cursorPos+1], bufPos-cursorPos);
-          if (localEcho)
+          while (cursorPos < bufPos)
+          {
+            UART_transmit(' ');
+            cursorPos++;
+          }
+          while (bufPos--)
           {
             UART_transmit(0x08);
-            buf[bufPos] = 0;
-            printf("%s ", &buf[cursorPos]);
-            for (i=cursorPos; i<(bufPos+1); i++)
-              UART_transmit(0x08);
+            UART_transmit(' ');
+            UART_transmit(0x08);
           }
+          printf("%s", &buf[0]);
         }
+        bufPos = strlen((char*)&buf[0]);
+        cursorPos = bufPos;
       }
-      else if (10 == c) //ignore LF
-      {
-      }
-/*      else if (9 == c) //tab key
-      {
-        printf("<bufPos=%d cursorPos=%d>", bufPos, cursorPos);
-      }
-*/      else if (0x1b == c) //escape character
+      break;
+      
+    case ESC_KEY_LEFT:
+      if (cursorPos)
       {
-        switch (UART_RcvEscapeSeq())
+        --cursorPos;
+        if (localEcho)
         {
-          case ESC_KEY_UP:
-            selectedCommand = selectedCommand?selectedCommand-1:0;
-            memmove(&buf[0], &commandsHistory[selectedCommand*BUF_SIZE], BUF_SIZE);
-            if (localEcho)
-            {
-              while (cursorPos < bufPos)
-              {
-                UART_transmit(' ');
-                cursorPos++;
-              }
-              while (bufPos--)
-              {
-                UART_transmit(0x08);
-                UART_transmit(' ');
-                UART_transmit(0x08);
-              }
-              printf("%s", &buf[0]);
-            }
-            bufPos = strlen((char*)&buf[0]);
-            cursorPos = bufPos;
-            break;
-            
-          case ESC_KEY_DOWN:
-            if ((selectedCommand+1) == savedCommands) //current command is last command in buffer
-            {
-              selectedCommand = savedCommands;
-              if (localEcho)
-              {
-                while (cursorPos < bufPos)
-                {
-                  UART_transmit(' ');
-                  cursorPos++;
-                }
-                while (bufPos--)
-                {
-                  UART_transmit(0x08);
-                  UART_transmit(' ');
-                  UART_transmit(0x08);
-                }
-              }
-              bufPos = 0;
-              cursorPos = 0;
-            }
-            else if ((selectedCommand+1) < savedCommands) // <MAX_COMMANDS
-            {
-              selectedCommand++;
-              memmove(&buf[0], &commandsHistory[selectedCommand*BUF_SIZE], BUF_SIZE);
-              if (localEcho)
-              {
-                while (cursorPos < bufPos)
-                {
-                  UART_transmit(' ');
-                  cursorPos++;
-                }
-                while (bufPos--)
-                {
-                  UART_transmit(0x08);
-                  UART_transmit(' ');
-                  UART_transmit(0x08);
-                }
-                printf("%s", &buf[0]);
-              }
-              bufPos = strlen((char*)&buf[0]);
-              cursorPos = bufPos;
-            }
-            break;
-            
-          case ESC_KEY_LEFT:
-            if (cursorPos)
-            {
-              --cursorPos;
-              if (localEcho)
-              {
-                UART_transmit(0x1B);
-                UART_transmit(0x5B);
-                UART_transmit('D');
-              }
-            }
-            break;
-            
-          case ESC_KEY_RIGHT:
-            if (cursorPos < bufPos)
-            {
-              cursorPos++;
-              if (localEcho)
-              {
-                UART_transmit(0x1B);
-                UART_transmit(0x5B);
-                UART_transmit('C');
-              }
-            }
-            break;
-            
-          default:
-            break;
+          UART_transmit(0x1B);
+          UART_transmit(0x5B);
+          UART_transmit('D');
         }
       }
-      else if (13 == c)
+      break;
+      
+    case ESC_KEY_RIGHT:
+      if (cursorPos < bufPos)
       {
+        cursorPos++;
         if (localEcho)
         {
-          UART_transmit(13); //CR
-          UART_transmit(10); //LF
+          UART_transmit(0x1B);
+          UART_transmit(0x5B);
+          UART_transmit('C');
         }
+      }
+      break;
+      
+    default:
+      break;
+  }
+}
+
+
+/* Line editor, takes one byte from PC. Returns command letter when line is
+   complete (EMPTY_LINE for empty line), 0 otherwise. */
+unsigned char Editor_Put(unsigned char c)
+{
+  static unsigned char escState = 0;
+  unsigned char command = 0;
+  int i;
+
+  if (1 == escState)
+  {
+    escState = (0x5B == c)?2:0; // anything else is dropped
+    return 0;
+  }
+  if (2 == escState)
+  {
+    escState = 0;
+    EditorKey(c);
+    return 0;
+  }
+
+  if (0x08 == c) //backspace
+  {
+    if ((bufPos > 0) && (cursorPos == bufPos))
+    {
+      --bufPos;
+      --cursorPos;
+      if (localEcho)
+      {
+        UART_transmit(0x08);
+        UART_transmit(' ');
+        UART_transmit(0x08);
+      }
+    }
+    else if ((bufPos > 0) && (cursorPos > 0))
+    {
+      --bufPos;
+      --cursorPos;
+      memmove(&buf[cursorPos], &buf[cursorPos+1], bufPos-cursorPos);
+      if (localEcho)
+      {
+        UART_transmit(0x08);
+        buf[bufPos] = 0;
+        printf("%s ", &buf[cursorPos]);
+        for (i=cursorPos; i<(bufPos+1); i++)
+          UART_transmit(0x08);
+      }
+    }
+  }
+  else if (10 == c) //ignore LF
+  {
+  }
+/*else if (9 == c) //tab key
+  {
+    printf("<bufPos=%d cursorPos=%d>", bufPos, cursorPos);
+  }
+*/else if (0x1b == c) //escape character
+  {
+    escState = 1;
+  }
+  else if (13 == c)
+  {
+    if (localEcho)
+    {
+      UART_transmit(13); //CR
+      UART_transmit(10); //LF
+    }
 		
-        if (bufPos)
-          command = toupper(buf[0]);
-        else
-          command = EMPTY_LINE;
+    if (bufPos)
+      command = toupper(buf[0]);
+    else
+      command = EMPTY_LINE;
+  }
+  else
+  {
+    if (bufPos < BUF_SIZE-1)
+    {
+      if (cursorPos == bufPos)
+      {
+        buf[bufPos++] = c;
+        cursorPos++;
+        if (localEcho)
+          UART_transmit(c); //local echo
       }
       else
       {
-        if (bufPos < BUF_SIZE-1)
+        memmove(&buf[cursorPos+1], &buf[cursorPos], bufPos-cursorPos);
+        buf[cursorPos++] = c;
+        bufPos++;
+        buf[bufPos] = 0;
+        if (localEcho)
         {
-          if (cursorPos == bufPos)
-          {
-            buf[bufPos++] = c;
-            cursorPos++;
-            if (localEcho)
-              UART_transmit(c); //local echo
-          }
-          else
-          {
-            memmove(&buf[cursorPos+1], &buf[cursorPos], bufPos-cursorPos);
-            buf[cursorPos++] = c;
-            bufPos++;
-            buf[bufPos] = 0;
-            if (localEcho)
-            {
-              UART_transmit(c); //local echo
-              printf("%s", &buf[cursorPos]);
-              for (i=cursorPos; i<bufPos; i++)
-                UART_transmit(0x08);
-            }
-          }
+          UART_transmit(c); //local echo
+          printf("%s", &buf[cursorPos]);
+          for (i=cursorPos; i<bufPos; i++)
+            UART_transmit(0x08);
         }
       }
-    } while (!command);
-    
+    }
+  }
+  return command;
+}
+
+
+void main(void) 
+{
+  unsigned char prompt = 1;
+  unsigned char c;
+  int i;
+  unsigned int gpibIndex = 0;
+  unsigned int k;
+  unsigned char command = 0;
+  int result = 0;
+  unsigned char msgLen = 0;
+  unsigned char msgEOI = 1;
+  unsigned char device;
+  unsigned char * msgBlock;
+  unsigned long window;
+  unsigned long ms;
+  unsigned char fromMacro = 0;
+
+  GPIO_init();
+  
+/* timer & interrupt initialize */
+  TIMSK = _BV(TOIE0);        // wlacz obsluge przerwan T/C0
+  TCNT0 = T0_INIT;         // wartosc poczatkowa T/C0
+  TCCR0 = _BV(CS00)|_BV(CS02); // preskaler 1024
+  sei();
+  GPIB_TimerStart(); // handshake timebase
+  GPIB_ResetTiming(GPIB_ADDR_NONE);
+  
+  ReconfigureGPIO_GPIBNormalMode();
+  UART_init();
+  fdevopen(uart_putchar, NULL);
+  streamCompression = (1 == eeprom_read_byte(&eeStreamCompression));
+  
+#if 1 
+  if (0 == (PINB & _BV(PB5))) // printer mode
+    PrinterMode_Start();
+
+  localEcho = (PINB & _BV(PB7))?1:0;
+#endif
+
+  if (MCUCSR & _BV(WDRF)) // bus may be left in the middle of a transfer
+    GPIB_Stalled(GPIB_CAUSE_WATCHDOG);
+  MCUCSR = 0;
+  wdt_enable(WDTO_2S); // long transfers reset it for every byte
+
+  SetLed(1);
+  
+  while (1) //main loop
+  {
+    wdt_reset();
+    if (prompt && !printerMode && !aggregateMode)
+    {
+      selectedCommand = History_Count();
+      if (localEcho && !bufPos)
+        printf("<GPIB> ");
+      prompt = 0;
+    }
+
+    if ((MACRO_NONE != macroNumber) && !printerMode && !aggregateMode)
+      fromMacro = command = MacroStep();
+    else if (UARTDataAvailable())
+    {
+      c = UART_receive();
+      if (!printerMode && !aggregateMode)
+        command = Editor_Put(c);
+      else if ((27 == c) && printerMode)
+        PrinterMode_Stop();
+      else if (27 == c)
+        Aggregate_Stop();
+    }
+
+    if (printerMode)
+      PrinterMode_Task();
+    if (aggregateMode)
+      Aggregate_Task();
+    else if (listenMode && !printerMode)
+      Listen_Task();
+
+    if (recoveryAuto && !printerMode && (GPIB_RECOVERY_PENDING == gpibRecovery.result))
+      Recover();
+    if (srqEvents && !command && !bufPos && (MACRO_NONE == macroNumber) && !printerMode && !aggregateMode)
+      SrqEvent_Task();
+
+    if (!command)
+      continue;
 
     if ('D' == command) //send data
     {
@@ -794,21 +1259,6 @@ void main(void)
     }
     else if ('C' == command) //send command
     {
-      for (i=1; i<bufPos; i++)
-      {
-        if ((buf[i] == '?') || (buf[i] == (64+listenAddress)))//unlisten
-        {
-          listenMode = 0;
-          ledBlinking = OFF;
-          SetLed(1);
-        }
-        else if (buf[i] == (32+listenAddress))
-        {
-          listenMode = 1;
-          ledBlinking = FAST;
-        }
-      }
-
       if (1 == msgEndSeq)
         buf[bufPos++] = 13; //CR
       else if (2==msgEndSeq)
@@ -819,30 +1269,170 @@ void main(void)
         buf[bufPos++] = 10; //LF
       }
 
-      ReconfigureGPIO_GPIBNormalMode();
-
-      SetATN(0);
-      _delay_us(100);
-      result = GPIB_Transmit(buf+1, bufPos-1, 1);
+      result = GPIB_Command(buf+1, bufPos-1, 1);
      
       if (result == 255) // transmit ok
         printf("OK\r\n");
       else //timeout
         printf("TIMEOUT\r\n");
-
-      SetATN(1);
 	  
       if ((1==msgEndSeq) || (2==msgEndSeq))
         --bufPos;
       else if (3==msgEndSeq)
         bufPos -= 2;
       
-      if (listenMode)
-        ReconfigureGPIO_GPIBReceiveMode();
+      UpdateListenMode();
+    }
+    else if ('W' == command) //send data to device, addressing sent only if changed
+    {
+      device = (bufPos >= 3)?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      if ((GPIB_ADDR_NONE != device) && (device != listenAddress))
+      {
+        if (1 == msgEndSeq)
+          buf[bufPos++] = 13; //CR
+        else if (2==msgEndSeq)
+          buf[bufPos++] = 10; //LF
+        else if (3==msgEndSeq)
+        {
+          buf[bufPos++] = 13; //CR
+          buf[bufPos++] = 10; //LF
+        }
+
+        if (bufPos > 3)
+        {
+          result = GPIB_Address(listenAddress, device);
+          UpdateListenMode();
+          if (result == 255)
+            result = GPIB_Transmit(buf+3, bufPos-3, 1);
+
+          if (result == 255) // transmit ok
+            printf("OK\r\n");
+          else //timeout
+            printf("TIMEOUT\r\n");
+        }
+        else
+          printf("ERROR\r\n");
+
+        if ((1==msgEndSeq) || (2==msgEndSeq))
+          --bufPos;
+        else if (3==msgEndSeq)
+          bufPos -= 2;
+      }
       else
-        ReconfigureGPIO_GPIBNormalMode();
-		  
-      listenMode_prev = listenMode;
+        printf("ERROR\r\n");
+    }
+    else if ('B' == command) //burst of queries to device
+    {
+      device = (bufPos >= 3)?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      i = 0;
+      for (msgLen=3; (msgLen < bufPos) && isdigit(buf[msgLen]) && (i <= 255); msgLen++)
+        i = i*10 + buf[msgLen]-'0';
+      if ((GPIB_ADDR_NONE != device) && (device != listenAddress) && (i >= 1) && (i <= 255) &&
+          (msgLen+1 < bufPos) && (',' == buf[msgLen]))
+      {
+        msgLen++; // query starts here
+        if (1 == msgEndSeq)
+          buf[bufPos++] = 13; //CR
+        else if (2==msgEndSeq)
+          buf[bufPos++] = 10; //LF
+        else if (3==msgEndSeq)
+        {
+          buf[bufPos++] = 13; //CR
+          buf[bufPos++] = 10; //LF
+        }
+
+        Burst(device, i, &buf[msgLen], bufPos-msgLen);
+
+        if ((1==msgEndSeq) || (2==msgEndSeq))
+          --bufPos;
+        else if (3==msgEndSeq)
+          bufPos -= 2;
+      }
+      else
+        printf("ERROR\r\n");
+    }
+    else if ('V' == command) //receive from device, addressing sent only if changed
+    {
+      device = ((bufPos >= 3) && (bufPos <= 5))?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      // V<aa>, V<aa>X/Y/Z or V<aa>Z6/Z8, 6 and 8 only after Z
+      c = (bufPos >= 4)?toupper(buf[3]):'X';
+      if ((4 == bufPos) && ('X' != c) && ('Y' != c) && ('Z' != c))
+        c = 0;
+      else if ((5 == bufPos) && ('Z' == c) && (('6' == buf[4]) || ('8' == buf[4])))
+        c = buf[4];
+      else if (bufPos >= 5)
+        c = 0;
+      if (!c)
+        printf("WRONG COMMAND\r\n");
+      else if ((GPIB_ADDR_NONE != device) && (device != listenAddress))
+      {
+        result = GPIB_Address(device, listenAddress);
+        UpdateListenMode();
+        gpibIndex = 0;
+        if ((result == 255) && GpibBuf_Alloc(('X' == c)?POOL_SIZE:GPIB_BLOCK_MAX))
+        {
+          result = ReceiveTalker(gpibBuf, gpibBufSize-1, &gpibIndex); // bytes taken in background come first
+        }
+        SendReceived(c, gpibIndex);
+        GpibBuf_Free();
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
+    }
+    else if ('U' == command) //listen mode data captured in background
+    {
+      if (bufPos == 1)
+        Listen_Send();
+      else
+        printf("ERROR\r\n");
+    }
+    else if ('J' == command) //statistics of polled readings
+    {
+      device = (bufPos >= 3)?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      window = 0;
+      for (msgLen=3; (msgLen < bufPos) && isdigit(buf[msgLen]) && (window <= 65535); msgLen++)
+        window = window*10 + buf[msgLen]-'0';
+      ms = 0;
+      if ((msgLen < bufPos) && ('/' == buf[msgLen]))
+        for (msgLen++; (msgLen < bufPos) && isdigit(buf[msgLen]) && (ms <= AGG_INTERVAL_MAX); msgLen++)
+          ms = ms*10 + buf[msgLen]-'0';
+      if ((GPIB_ADDR_NONE != device) && (device != listenAddress) && (window >= 1) && (window <= 65535) &&
+          (ms <= AGG_INTERVAL_MAX) && (msgLen+1 < bufPos) && (',' == buf[msgLen]))
+        Aggregate_Start(device, window, ms, &buf[msgLen+1], bufPos-msgLen-1);
+      else
+        printf("ERROR\r\n");
+    }
+    else if ('F' == command) //numeric reply from device as binary values
+    {
+      device = ((bufPos == 3) || (bufPos == 4))?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      c = (bufPos == 4)?buf[3]:0;
+      if ((GPIB_ADDR_NONE != device) && (device != listenAddress) && (!c || isdigit(c)))
+      {
+        result = GPIB_Address(device, listenAddress);
+        UpdateListenMode();
+        msgBlock = Pool_Alloc(NUM_CHUNK);
+        if (msgBlock && GpibBuf_Alloc(NUM_CHUNK))
+        {
+          Num_Start(c?c-'0':NUM_FLOAT, msgBlock, NUM_CHUNK);
+          while (result == 255)
+          {
+            result = ReceiveTalker(gpibBuf, gpibBufSize-1, &gpibIndex);
+            for (k=0; k<gpibIndex; k++)
+              Num_Put(gpibBuf[k]);
+            if (gpibEOI)
+              break;
+          }
+          Num_End();
+        }
+        else
+          UART_transmit(0);
+        GpibBuf_Free();
+        Pool_Free(msgBlock);
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
     }
     else if ('R' == command)
     {
@@ -858,111 +1448,140 @@ void main(void)
     }
     else if ('I' == command)
     {
-      SetIFC(0);
-      _delay_ms(1);
-      SetIFC(1);
+      GPIB_InterfaceClear();
       if (listenMode)
-      {
-        listenMode = 0;
-        ledBlinking = OFF;
-        SetLed(1);
-        ReconfigureGPIO_GPIBNormalMode();
-      }
+        UpdateListenMode();
       printf("OK\r\n");
     }
     else if ('S' == command)
     {
-      UART_transmit(remoteState?'1':'0');
-      UART_transmit((0 == (PINC & SRQ))?'1':'0');
-      UART_transmit(listenMode?'1':'0');
-      UART_transmit(13);
-      UART_transmit(10);
+      if (1 == bufPos)
+      {
+        UART_transmit(remoteState?'1':'0');
+        UART_transmit((0 == (PINC & SRQ))?'1':'0');
+        UART_transmit(listenMode?'1':'0');
+        UART_transmit(13);
+        UART_transmit(10);
+      }
+      else if ((2 == bufPos) && ('1' == buf[1])) // instruments to poll are found first
+      {
+        result = GPIB_Enumerate(listenAddress, &srqPollMap);
+        UpdateListenMode();
+        srqEvents = (result == 255);
+        cli();
+        srqRetry = timerTicks;
+        sei();
+        printf(srqEvents?"OK\r\n":"TIMEOUT\r\n");
+      }
+      else if ((2 == bufPos) && ('0' == buf[1]))
+      {
+        srqEvents = 0;
+        printf("OK\r\n");
+      }
+      else
+        printf("ERROR\r\n");
     }
     else if ('P' == command)
     {
-      listenMode_prev = 0; //cancel listen mode
-      listenMode = 0; //cancel listen mode
-      ledBlinking = SLOW;
-      ReconfigureGPIO_GPIBReceiveMode();
+      PrinterMode_Start();
 //      if (localEcho)
 //        printf("PRINTER MODE, send <ESC> to return to normal mode\r\n");
-        
-      _delay_ms(1);
-      while (c != 27)
+    }
+    else if ('N' == command) //bus analyzer
+    {
+      c = (bufPos > 1)?buf[1]:'0';
+      if ((bufPos > 2) || (('0' != c) && ('1' != c)))
+        printf("ERROR\r\n");
+      else
       {
-        if (UARTDataAvailable())
-          c = UART_receive();
-          
-        result = GPIB_Receive(gpibBuf, GPIB_BUF_SIZE-2, &gpibIndex);
-        if (gpibIndex != 0)
-        {
-          for (i=0; i<gpibIndex; i++)
-            UART_transmit(gpibBuf[i]);
-        }
-        else
-        {
-          _delay_ms(10);
-        }
+        listenMode_prev = 0; //cancel listen mode
+        listenMode = 0;
+        ledBlinking = SLOW;
+        if (!Sniff_Run('1' == c))
+          printf("ERROR\r\n");
+        gpibAddressing.valid = 0; // bus was addressed by other controller
+        gpibAddressing.listeners = 0;
+        ReconfigureGPIO_GPIBNormalMode();
+        UpdateListenMode();
       }
       c = 0;
-      ReconfigureGPIO_GPIBNormalMode();
-      ledBlinking = OFF;
-      SetLed(1);
     }
-    else if ('X' == command) //ascii receive
+    else if (('X' == command) || ('Y' == command) || ('Z' == command)) //ascii/binary/hex receive
     {
+      if (('Z' == command) && (bufPos == 2) && (('6' == buf[1]) || ('8' == buf[1])))
+        command = buf[1]; // base64/base85
+
       if (!listenMode)
       {
         ReconfigureGPIO_GPIBReceiveMode();
         _delay_ms(1);
       }
-      result = GPIB_Receive_till_eoi(gpibBuf, GPIB_BUF_SIZE-2, &gpibIndex);
-      
-      if (gpibIndex != 0)
+      gpibIndex = 0;
+      if (GpibBuf_Alloc(('X' == command)?POOL_SIZE:GPIB_BLOCK_MAX))
       {
-        gpibBuf[gpibIndex] = 0;
-        printf("%s",gpibBuf);
+        result = ReceiveTalker(gpibBuf, gpibBufSize-1, &gpibIndex); // captured in background first
       }
-      else
-        printf("TIMEOUT\r\n");
+      SendReceived(command, gpibIndex);
+      GpibBuf_Free();
 
       if (!listenMode)
         ReconfigureGPIO_GPIBNormalMode();
     }
-    else if ('Y' == command) //binary receive
+    else if ('O' == command) //device mode talk queue
     {
-      if (!listenMode)
+      c = (bufPos > 1)?toupper(buf[1]):0;
+      if (1 == bufPos)
+        printf("%d\r\n", talkQueueMsgs);
+      else if (('C' == c) && (2 == bufPos))
       {
-        ReconfigureGPIO_GPIBReceiveMode();
-        _delay_ms(1);
+        TalkQueue_Clear();
+        printf("OK\r\n");
       }
-
-      result = GPIB_Receive_till_eoi(gpibBuf, GPIB_BUF_SIZE-2, &gpibIndex);
-      UART_transmit(gpibIndex);
-      for (i=0; i<gpibIndex; i++)
+      else if (('G' == c) && (2 == bufPos))
+        DeviceMode();
+      else if ('D' == c)
       {
-        UART_transmit(gpibBuf[i]);
+        if (1 == msgEndSeq)
+          buf[bufPos++] = 13; //CR
+        else if (2==msgEndSeq)
+          buf[bufPos++] = 10; //LF
+        else if (3==msgEndSeq)
+        {
+          buf[bufPos++] = 13; //CR
+          buf[bufPos++] = 10; //LF
+        }
+
+        if (TalkQueue_Add(&buf[2], bufPos-2))
+          printf("OK\r\n");
+        else
+          printf("ERROR\r\n");
+
+        if ((1==msgEndSeq) || (2==msgEndSeq))
+          --bufPos;
+        else if (3==msgEndSeq)
+          bufPos -= 2;
       }
-      
-      if (!listenMode)
-        ReconfigureGPIO_GPIBNormalMode();
-    }
-    else if ('Z' == command) //hex receive
-    {
-      if (!listenMode)
+      else if (('H' == c) && !(bufPos & 0x01) && GpibBuf_Alloc(BUF_SIZE/2))
       {
-        ReconfigureGPIO_GPIBReceiveMode();
-        _delay_ms(1);
-      }
-      result = GPIB_Receive_till_eoi(gpibBuf, GPIB_BUF_SIZE-2, &gpibIndex);
+        for (i=2; i<bufPos; i++)
+        {
+          if (!ishexdigit(toupper(buf[i])))
+            break;
+          if (i & 0x01)
+            gpibBuf[(i-2)/2] += hex2dec(toupper(buf[i]));
+          else
+            gpibBuf[(i-2)/2] = hex2dec(toupper(buf[i])) << 4;
+        }
 
-      printf("%02x", gpibIndex);
-      for (i=0; i<gpibIndex; i++)
-        printf("%02x",gpibBuf[i]);
-      printf("\r\n");
-	  
-      if (!listenMode)
-        ReconfigureGPIO_GPIBNormalMode();
+        if ((i == bufPos) && TalkQueue_Add(gpibBuf, (bufPos-2)/2))
+          printf("OK\r\n");
+        else
+          printf("ERROR\r\n");
+        GpibBuf_Free();
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
     }
     else if ('?' == command)
     {
@@ -985,13 +1604,109 @@ void main(void)
       else
         printf("ERROR\r\n");
     }
+    else if ('K' == command) //stream compression
+    {
+      if (bufPos == 1)
+        printf("%d\r\n", streamCompression);
+      else if ((bufPos==2) && (('0' == buf[1]) || ('1' == buf[1])))
+      {
+        streamCompression = buf[1]-'0';
+        eeprom_write_byte(&eeStreamCompression, streamCompression);
+        printf("OK\r\n");
+      }
+      else
+        printf("ERROR\r\n");
+    }
+    else if ('G' == command) //handshake profiler
+    {
+      device = (bufPos >= 3)?ParseDeviceAddress(&buf[1]):GPIB_ADDR_NONE;
+      c = (bufPos == 4)?toupper(buf[3]):0;
+      if (bufPos == 1)
+        printf("%d\r\n", gpibProfiling);
+      else if ((bufPos==2) && (('0' == buf[1]) || ('1' == buf[1])))
+      {
+        gpibProfiling = buf[1]-'0';
+        printf("OK\r\n");
+      }
+      else if ((GPIB_ADDR_NONE != device) && (bufPos == 3))
+        ShowProfile(device);
+      else if ((GPIB_ADDR_NONE != device) && ('T' == c))
+        printf(GPIB_Tune(device)?"OK\r\n":"ERROR\r\n");
+      else if ((GPIB_ADDR_NONE != device) && ('D' == c))
+      {
+        GPIB_ResetTiming(device);
+        printf("OK\r\n");
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
+    }
     else if ('H' == command) //show history
     {
-      for (i=0; i<savedCommands; i++)
-        printf("%d: %s\r\n", i, &commandsHistory[i*BUF_SIZE]);
+      for (i=0; i<History_Count(); i++)
+      {
+        History_Get(i, (char*)&buf[0], BUF_SIZE); // line is not saved, buffer is free
+        printf("%d: %s\r\n", i, &buf[0]);
+      }
         
       command = 0; //to avoid saving this command in history
     }
+    else if ('!' == command) //bus recovery
+    {
+      c = (2 == bufPos)?toupper(buf[1]):0;
+      if (1 == bufPos)
+        ShowRecovery();
+      else if (('0' == c) || ('1' == c))
+      {
+        recoveryAuto = c-'0';
+        printf("OK\r\n");
+      }
+      else if ('R' == c)
+      {
+        GPIB_Stalled(GPIB_CAUSE_REQUEST);
+        Recover();
+        ShowRecovery();
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
+    }
+    else if ('@' == command) //macros
+    {
+      i = (bufPos >= 2)?buf[1]-'0':MACRO_COUNT;
+      c = (bufPos >= 3)?buf[2]:0;
+      buf[bufPos] = 0;
+      if ((i < 0) || (i >= MACRO_COUNT) || fromMacro) // macros don't run macros
+        printf("ERROR\r\n");
+      else if (2 == bufPos)
+      {
+        macroPos = 0;
+        if (Macro_Next(i, &macroPos, (char*)&buf[3], BUF_SIZE-3)) // not empty, step goes after line
+        {
+          macroNumber = i;
+          macroPos = 0;
+        }
+        else
+          printf("ERROR\r\n");
+      }
+      else if (('+' == c) && (bufPos > 3) && ('@' != buf[3]))
+        printf(Macro_Add(i, (char*)&buf[3])?"OK\r\n":"ERROR\r\n");
+      else if (('-' == c) && (3 == bufPos))
+      {
+        Macro_Clear(i);
+        printf("OK\r\n");
+      }
+      else if (('?' == c) && (3 == bufPos))
+      {
+        macroPos = 0;
+        while (Macro_Next(i, &macroPos, (char*)&buf[0], BUF_SIZE)) // line is not saved, buffer is free
+          printf("%s\r\n", &buf[0]);
+        command = 0;
+      }
+      else
+        printf("ERROR\r\n");
+      c = 0;
+    }
     else if ('A' == command) //listen address
     {
       if (bufPos == 1)
@@ -1007,6 +1722,8 @@ void main(void)
         else
           printf("ERROR\r\n");
       }
+      else if ((bufPos >= 2) && ('?' == buf[1]) && ((bufPos == 2) || ((bufPos == 3) && ('I' == toupper(buf[2])))))
+        Enumerate(3 == bufPos);
       else
         printf("ERROR\r\n");
     }
@@ -1032,11 +1749,11 @@ void main(void)
     }
     else if ('T' == command) 
     {
-      if (CheckHexMsg(&buf[1], bufPos-1, msgBuf, &msgLen, &msgEOI))
+      if (GpibBuf_Alloc(BUF_SIZE/2) && CheckHexMsg(&buf[1], bufPos-1, gpibBuf, &msgLen, &msgEOI))
       {
         if ('D' == toupper(buf[2])) //send data
         {	
-          result = GPIB_Transmit(msgBuf, msgLen, msgEOI); 
+          result = GPIB_Transmit(gpibBuf, msgLen, msgEOI); 
           if (result == 255) // transmit ok
             printf("OK\r\n");
           else //timeout
@@ -1044,44 +1761,19 @@ void main(void)
         }
         else //send command
         {
-          for (i=0; i<msgLen; i++)
-          {
-            if ((msgBuf[i] == '?') || (msgBuf[i] == (64+listenAddress)))//unlisten
-            {
-              listenMode = 0;
-              ledBlinking = OFF;
-              SetLed(1);
-            }
-            else if (buf[i] == (32+listenAddress))
-            {
-              listenMode = 1;
-              ledBlinking = FAST;
-            }
-          }
-
-          ReconfigureGPIO_GPIBNormalMode();
-
-          SetATN(0);
-          _delay_us(100);
-          result = GPIB_Transmit(msgBuf, msgLen, 1);
+          result = GPIB_Command(gpibBuf, msgLen, 1);
      
           if (result == 255) // transmit ok
             printf("OK\r\n");
           else //timeout
             printf("TIMEOUT\r\n");
 
-          SetATN(1);
-	       
-          if (listenMode)
-            ReconfigureGPIO_GPIBReceiveMode();
-          else
-            ReconfigureGPIO_GPIBNormalMode();
-		  
-          listenMode_prev = listenMode;
+          UpdateListenMode();
         }      
       }
       else
         printf("ERROR\r\n");
+      GpibBuf_Free();
     }
     else
     {
@@ -1090,33 +1782,22 @@ void main(void)
       command = 0;
     }
 
-    if (command && bufPos)
+    if (command && bufPos && !fromMacro)
     {
       buf[bufPos] = 0; //add string termination
 
       //avoids saving same command twice    
-      if ((savedCommands > 0) && (0 == strcmp(&commandsHistory[(savedCommands-1)*BUF_SIZE], (char*)&buf[0])))
-      {
+      if (History_IsLast((char*)&buf[0]))
         command = 0;
-      }
       else //save command
-      {
-        if (savedCommands < MAX_COMMANDS)
-        {
-          memmove(&commandsHistory[savedCommands*BUF_SIZE], &buf[0], BUF_SIZE);
-          ++savedCommands;
-        }
-        else
-        {
-          memmove(&commandsHistory[0], &commandsHistory[BUF_SIZE], BUF_SIZE*(savedCommands-1));
-          memmove(&commandsHistory[(savedCommands-1)*BUF_SIZE], &buf[0], BUF_SIZE);
-        }
-      }
+        History_Add((char*)&buf[0]);
     }
 	
     command = 0;
+    fromMacro = 0;
     bufPos = 0;
     cursorPos = 0;
     buf[0] = 0;
+    prompt = 1;
   } //end of endless loop block
 }
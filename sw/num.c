@@ -0,0 +1,223 @@
+#include <inttypes.h>
+#include <string.h>
+#include "num.h"
+#include "usart.h"
+
+#define NUM_IDLE 0     // between tokens
+#define NUM_MANTISSA 1 // digits before point
+#define NUM_FRACTION 2 // digits after point
+#define NUM_EXPONENT 3
+#define NUM_SKIP 4     // rest of token is ignored
+
+static unsigned char numDecimals;
+static unsigned char * numOut;
+static unsigned char numOutMax; // values per block
+static unsigned char numCount;
+static uint32_t numFirst;        // without block buffer only first value is kept
+
+static unsigned char numState;
+static unsigned char numNumeric; // token is a number, is sent at its end
+static unsigned char numNeg;
+static unsigned char numDigits;  // any digit seen
+static unsigned char numSignificant;
+static uint32_t numMantissa;
+static signed char numScale;     // decimal exponent of mantissa
+static unsigned char numExpNeg;
+static unsigned char numExp;
+
+
+static void SendBlock()
+{
+  unsigned char i;
+
+  UART_transmit(numCount);
+  for (i=0; i<4*numCount; i++)
+    UART_transmit(numOut[i]);
+  numCount = 0;
+}
+
+
+static void PutValue(uint32_t v)
+{
+  unsigned char * p;
+
+  if (!numOut)
+  {
+    if (!numCount)
+      numFirst = v;
+    if (numCount < 255)
+      numCount++;
+    return;
+  }
+  p = &numOut[4*numCount];
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  if (++numCount == numOutMax)
+    SendBlock();
+}
+
+
+static uint32_t FixedValue(int e)
+{
+  uint32_t m = numMantissa;
+  uint32_t p = 1;
+
+  if (e < -NUM_MAX_DIGITS)
+    return 0;
+  if (e < 0)
+  {
+    while (e++)
+      p *= 10;
+    m = (m + p/2)/p;
+  }
+  else
+  {
+    while (e--)
+    {
+      if (m > 0x7FFFFFFFUL/10)
+      {
+        m = 0x7FFFFFFFUL;
+        break;
+      }
+      m *= 10;
+    }
+    if (m > 0x7FFFFFFFUL)
+      m = 0x7FFFFFFFUL;
+  }
+  return numNeg?(uint32_t)(-(int32_t)m):m;
+}
+
+
+static uint32_t FloatValue(int e)
+{
+  float f = numMantissa;
+  uint32_t v;
+
+  if (e > 38)
+    e = 39; // gives infinity
+  else if (e < -45)
+    e = f = 0;
+  for (; e > 0; e--)
+    f *= 10;
+  for (; e < 0; e++)
+    f /= 10;
+  if (numNeg)
+    f = -f;
+  memcpy(&v, &f, 4);
+  return v;
+}
+
+
+static void EndToken()
+{
+  int e = numScale + (numExpNeg?-(int)numExp:numExp);
+
+  if (!numNumeric)
+    return;
+  if (!numDigits)
+    PutValue((NUM_FLOAT == numDecimals)?0x7FC00000UL:NUM_INVALID); // NaN
+  else if (NUM_FLOAT == numDecimals)
+    PutValue(FloatValue(e));
+  else
+    PutValue(FixedValue(e + numDecimals));
+}
+
+
+void Num_Start(unsigned char decimals, unsigned char * out, unsigned char outSize)
+{
+  numDecimals = decimals;
+  numOut = out;
+  numOutMax = out?(outSize-1)/4:0;
+  numCount = 0;
+  numState = NUM_IDLE;
+}
+
+
+void Num_Put(unsigned char c)
+{
+  unsigned char d = c - '0';
+
+  if ((',' == c) || (';' == c) || (' ' == c) || ('\t' == c) || ('\r' == c) || ('\n' == c))
+  {
+    if (NUM_IDLE != numState)
+      EndToken();
+    numState = NUM_IDLE;
+    return;
+  }
+
+  if (NUM_IDLE == numState) // token starts
+  {
+    numNumeric = (d <= 9) || ('+' == c) || ('-' == c) || ('.' == c);
+    numNeg = ('-' == c);
+    numDigits = 0;
+    numSignificant = 0;
+    numMantissa = 0;
+    numScale = 0;
+    numExpNeg = 0;
+    numExp = 0;
+    numState = NUM_MANTISSA;
+    if (!numNumeric)
+      numState = NUM_SKIP;
+    if (('+' == c) || ('-' == c))
+      return;
+  }
+
+  if ((NUM_MANTISSA == numState) || (NUM_FRACTION == numState))
+  {
+    if (d <= 9)
+    {
+      numDigits = 1;
+      if (numSignificant < NUM_MAX_DIGITS)
+      {
+        numMantissa = numMantissa*10 + d;
+        if (numMantissa)
+          numSignificant++;
+        if ((NUM_FRACTION == numState) && (numScale > -100))
+          numScale--;
+      }
+      else if ((NUM_MANTISSA == numState) && (numScale < 100))
+        numScale++;
+    }
+    else if (('.' == c) && (NUM_MANTISSA == numState))
+      numState = NUM_FRACTION;
+    else if ((('E' == c) || ('e' == c)) && numDigits)
+      numState = NUM_EXPONENT;
+    else
+      numState = NUM_SKIP;
+  }
+  else if (NUM_EXPONENT == numState)
+  {
+    if (d <= 9)
+    {
+      if (numExp < 25)
+        numExp = numExp*10 + d;
+    }
+    else if (('-' == c) && !numExp)
+      numExpNeg = 1;
+    else if (('+' != c) || numExp)
+      numState = NUM_SKIP;
+  }
+}
+
+
+/* last number and end of reply */
+void Num_End()
+{
+  if (NUM_IDLE != numState)
+    EndToken();
+  numState = NUM_IDLE;
+  if (!numOut)
+    return;
+  if (numCount)
+    SendBlock();
+  SendBlock(); // empty block
+}
+
+
+unsigned char Num_First(uint32_t * value)
+{
+  *value = numFirst;
+  return (numOut || !numCount)?0:numCount;
+}
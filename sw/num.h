@@ -0,0 +1,32 @@
+#ifndef NUM_HEADER
+#define NUM_HEADER
+
+#include <inttypes.h>
+
+/* Numeric replies (e.g. "+1.23456789E-03,-2.5E+00\r\n") converted to binary
+   values while they are received. Values are sent to PC in blocks
+     <n> <value 1> ... <value n>
+   of 4 byte little endian values, block with n=0 ends the reply. Values are
+   IEEE 754 single floats or, with decimals 0..9 given, 32 bit integers of
+   value*10^decimals.
+
+   Numbers are separated by comma, semicolon or white space. Tokens not
+   starting with sign, digit or point (headers, units) are skipped, text
+   following a number in the same token (unit suffix) is ignored. Numeric
+   token without digits gives NaN or NUM_INVALID, integers saturate. */
+
+#define NUM_FLOAT 0xFF
+#define NUM_INVALID 0x80000000UL
+#define NUM_MAX_DIGITS 9 // significant digits kept, more only scale value
+
+/* out is block buffer, at least 5 bytes. With out NULL nothing is sent,
+   first value is kept for Num_First. */
+void Num_Start(unsigned char decimals, unsigned char * out, unsigned char outSize);
+void Num_Put(unsigned char c);
+void Num_End();
+
+/* number of values found (saturates at 255) and the first one, after
+   Num_End of reply started without block buffer */
+unsigned char Num_First(uint32_t * value);
+
+#endif
@@ -0,0 +1,113 @@
+#include "pool.h"
+
+#define POOL_CONT 0xFF // block continues run started before
+
+static unsigned char pool[POOL_SIZE];
+static unsigned char poolRun[POOL_BLOCKS]; // 0 free, n first block of n blocks run
+
+
+/* first free run of at least want blocks, or longest run if want is 0 */
+static unsigned char FindRun(unsigned char want, unsigned char * length)
+{
+  unsigned char i;
+  unsigned char start = 0;
+  unsigned char run = 0;
+  unsigned char best = 0;
+  unsigned char bestStart = 0;
+
+  for (i=0; i<=POOL_BLOCKS; i++)
+  {
+    if ((i < POOL_BLOCKS) && (0 == poolRun[i]))
+    {
+      if (0 == run)
+        start = i;
+      run++;
+      if (want && (run == want))
+      {
+        *length = run;
+        return start;
+      }
+    }
+    else
+    {
+      if (run > best)
+      {
+        best = run;
+        bestStart = start;
+      }
+      run = 0;
+    }
+  }
+
+  *length = want?0:best;
+  return bestStart;
+}
+
+
+static unsigned char * Take(unsigned char start, unsigned char blocks)
+{
+  unsigned char i;
+
+  poolRun[start] = blocks;
+  for (i=1; i<blocks; i++)
+    poolRun[start+i] = POOL_CONT;
+  return &pool[start*POOL_BLOCK_SIZE];
+}
+
+
+unsigned char * Pool_Alloc(unsigned int size)
+{
+  unsigned char blocks = (size + POOL_BLOCK_SIZE - 1)/POOL_BLOCK_SIZE;
+  unsigned char length;
+  unsigned char start;
+
+  if ((0 == size) || (size > POOL_SIZE))
+    return 0;
+
+  start = FindRun(blocks, &length);
+  return length?Take(start, blocks):0;
+}
+
+
+/* takes the longest free run, but no more than max bytes */
+unsigned char * Pool_AllocLargest(unsigned int max, unsigned int * size)
+{
+  unsigned char length;
+  unsigned char start = FindRun(0, &length);
+
+  if (0 == length)
+  {
+    *size = 0;
+    return 0;
+  }
+
+  if ((unsigned int)length*POOL_BLOCK_SIZE > max)
+    length = (max + POOL_BLOCK_SIZE - 1)/POOL_BLOCK_SIZE;
+  *size = (unsigned int)length*POOL_BLOCK_SIZE;
+  if (*size > max)
+    *size = max;
+  return Take(start, length);
+}
+
+
+void Pool_Free(unsigned char * p)
+{
+  unsigned char start;
+  unsigned char i;
+
+  if (0 == p)
+    return;
+
+  start = (p - pool)/POOL_BLOCK_SIZE;
+  for (i=poolRun[start]; i>0; i--)
+    poolRun[start+i-1] = 0;
+}
+
+
+unsigned int Pool_Largest()
+{
+  unsigned char length;
+
+  FindRun(0, &length);
+  return (unsigned int)length*POOL_BLOCK_SIZE;
+}
@@ -0,0 +1,17 @@
+#ifndef POOL_HEADER
+#define POOL_HEADER
+
+/* Buffer pool shared by receive, transmit and streaming paths. Memory is
+   handed out in runs of POOL_BLOCK_SIZE blocks, so transfer buffers can take
+   whatever is not held by long living users (device mode talk queue). */
+
+#define POOL_SIZE 1024
+#define POOL_BLOCK_SIZE 32
+#define POOL_BLOCKS (POOL_SIZE/POOL_BLOCK_SIZE)
+
+unsigned char * Pool_Alloc(unsigned int size);
+unsigned char * Pool_AllocLargest(unsigned int max, unsigned int * size);
+void Pool_Free(unsigned char * p);
+unsigned int Pool_Largest();
+
+#endif
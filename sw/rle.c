@@ -0,0 +1,44 @@
+#include "rle.h"
+#include "usart.h"
+
+static unsigned char rleByte;
+static unsigned char rleCount = 0;
+
+
+void RLE_Flush()
+{
+  if (0 == rleCount)
+    return;
+
+  if ((rleCount >= RLE_MIN_RUN) || (RLE_MARK == rleByte))
+  {
+    UART_transmit(RLE_MARK);
+    UART_transmit(rleCount);
+    UART_transmit(rleByte);
+  }
+  else
+  {
+    while (rleCount--)
+      UART_transmit(rleByte);
+  }
+  rleCount = 0;
+}
+
+
+void RLE_Put(unsigned char c)
+{
+  if (rleCount && ((c != rleByte) || (255 == rleCount)))
+    RLE_Flush();
+
+  rleByte = c;
+  rleCount++;
+}
+
+
+void RLE_Control(unsigned char code)
+{
+  RLE_Flush();
+  UART_transmit(RLE_MARK);
+  UART_transmit(0);
+  UART_transmit(code);
+}
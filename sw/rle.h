@@ -0,0 +1,19 @@
+#ifndef RLE_HEADER
+#define RLE_HEADER
+
+/* Run length coding of data streams sent to PC (printer mode, device mode
+   listener data). Bytes are sent as they are, except:
+     RLE_MARK <n> <byte>  - n (1..255) repetitions of byte, runs shorter than
+                            RLE_MIN_RUN and RLE_MARK itself use n=1..3
+     RLE_MARK 0 <code>    - stream control record, see RLE_CTRL_* */
+
+#define RLE_MARK 0xFE
+#define RLE_MIN_RUN 4
+
+#define RLE_CTRL_EOI 0x01 // previous byte was sent with EOI, end of plot
+
+void RLE_Put(unsigned char c);
+void RLE_Flush();
+void RLE_Control(unsigned char code);
+
+#endif
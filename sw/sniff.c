@@ -0,0 +1,161 @@
+#include "sniff.h"
+#include "gpib.h"
+#include "usart.h"
+#include "pool.h"
+#include <avr/wdt.h>
+
+#define SNIFF_LINES_WATCHED (SNIFF_ATN | SNIFF_SRQ | SNIFF_REN | SNIFF_IFC)
+
+static unsigned char * sniffRing;
+static unsigned int sniffSize;
+static unsigned int sniffHead;
+static unsigned int sniffTail;
+static unsigned int sniffUsed;
+static unsigned char sniffLost;
+
+
+/* control lines are active low */
+static unsigned char Lines(unsigned char pinc)
+{
+  unsigned char f = 0;
+
+  if (!(pinc & ATN)) f |= SNIFF_ATN;
+  if (!(pinc & EOI)) f |= SNIFF_EOI;
+  if (!(pinc & SRQ)) f |= SNIFF_SRQ;
+  if (!(pinc & REN)) f |= SNIFF_REN;
+  if (!(pinc & IFC)) f |= SNIFF_IFC;
+  return f;
+}
+
+
+static unsigned char Handshake(unsigned char pinc)
+{
+  unsigned char h = 0;
+
+  if (!(pinc & DAV)) h |= SNIFF_HS_DAV;
+  if (!(pinc & NRFD)) h |= SNIFF_HS_NRFD;
+  if (!(pinc & NDAC)) h |= SNIFF_HS_NDAC;
+  return h;
+}
+
+
+/* record is dropped if ring is full, next record carries SNIFF_LOST */
+static void Put(unsigned char flags, unsigned char data, unsigned int ts)
+{
+  unsigned char * p;
+
+  if (sniffUsed + SNIFF_RECORD_SIZE > sniffSize)
+  {
+    sniffLost = SNIFF_LOST;
+    return;
+  }
+
+  p = &sniffRing[sniffHead];
+  p[0] = flags | sniffLost;
+  p[1] = data;
+  p[2] = ts;
+  p[3] = ts >> 8;
+  sniffLost = 0;
+  sniffHead += SNIFF_RECORD_SIZE; // ring size is multiple of record size
+  if (sniffHead == sniffSize)
+    sniffHead = 0;
+  sniffUsed += SNIFF_RECORD_SIZE;
+}
+
+
+/* one byte to PC if UART buffer has room, capture loop never waits for link */
+static void Drain()
+{
+  if (sniffUsed && UART_TxFree())
+  {
+    UART_transmit(sniffRing[sniffTail]);
+    if (++sniffTail == sniffSize)
+      sniffTail = 0;
+    sniffUsed--;
+  }
+}
+
+
+static void Wrap(unsigned char pinc)
+{
+  TIFR = _BV(TOV1);
+  Put(Lines(pinc) | SNIFF_REC_WRAP, Handshake(pinc), 0);
+}
+
+
+unsigned char Sniff_Run(unsigned char acceptor)
+{
+  unsigned char c = 0;
+  unsigned char pinc;
+  unsigned char data;
+  unsigned char lines;
+  unsigned char prevLines;
+  unsigned char davSeen = 0;
+  unsigned int ts;
+
+  sniffRing = Pool_AllocLargest(POOL_SIZE, &sniffSize);
+  if (0 == sniffRing)
+    return 0;
+  sniffHead = sniffTail = sniffUsed = 0;
+  sniffLost = 0;
+
+  ReconfigureGPIO_GPIBDeviceMode();
+  if (acceptor)
+  {
+    GPIB_DeviceAcceptor(1);
+    SetNRFD(1); //ready for receiving data
+  }
+  GPIB_TimerStart();
+
+  pinc = PINC;
+  prevLines = Lines(pinc);
+  Put(prevLines | SNIFF_REC_LINES, Handshake(pinc), 0);
+
+  while (c != 27)
+  {
+    wdt_reset();
+    if (UARTDataAvailable())
+      c = UART_receive();
+
+    pinc = PINC;
+    if (!davSeen && !(pinc & DAV)) // data valid
+    {
+      ts = TCNT1;
+      data = ~PINA;
+      if (acceptor)
+      {
+        SetNRFD(0); //not ready for receiving data
+        SetNDAC(1); //data accepted
+      }
+      davSeen = 1;
+      if ((TIFR & _BV(TOV1)) && (ts < 0x8000)) // timer wrapped before DAV
+        Wrap(pinc);
+      Put(Lines(pinc), data, ts);
+    }
+    else if (davSeen && (pinc & DAV))
+    {
+      if (acceptor)
+      {
+        SetNDAC(0);
+        SetNRFD(1); //ready for receiving data
+      }
+      davSeen = 0;
+    }
+    else if (TIFR & _BV(TOV1))
+      Wrap(pinc);
+
+    lines = Lines(pinc);
+    if ((lines ^ prevLines) & SNIFF_LINES_WATCHED)
+      Put(lines | SNIFF_REC_LINES, Handshake(pinc), TCNT1);
+    prevLines = lines;
+
+    Drain();
+  }
+
+  while (sniffUsed)
+    Drain();
+
+  GPIB_DeviceAcceptor(0);
+  Pool_Free(sniffRing);
+  return 255;
+}
@@ -0,0 +1,42 @@
+#ifndef SNIFF_HEADER
+#define SNIFF_HEADER
+
+/* Passive bus analyzer. Every byte on the bus (commands and data) and every
+   change of ATN/SRQ/REN/IFC is sent to PC as a 4 byte record:
+
+     <flags> <data> <timestamp low> <timestamp high>
+
+   flags: bit 0 ATN, 1 EOI, 2 SRQ, 3 REN, 4 IFC (set if line is asserted),
+          bits 5-6 record type (SNIFF_REC_*), bit 7 records were lost before
+          this one because link to PC was too slow
+   data:  bus byte, or handshake state (SNIFF_HS_*) for line and wrap records
+   timestamp: GPIB_TIMER ticks when DAV was asserted or line changed
+
+   A wrap record is sent each time the 16 bit timer overflows, so PC can
+   extend timestamps, and shows handshake state of a hanging bus. */
+
+#define SNIFF_ATN 0x01
+#define SNIFF_EOI 0x02
+#define SNIFF_SRQ 0x04
+#define SNIFF_REN 0x08
+#define SNIFF_IFC 0x10
+#define SNIFF_LOST 0x80
+
+#define SNIFF_REC_MASK 0x60
+#define SNIFF_REC_DATA 0x00
+#define SNIFF_REC_LINES 0x20
+#define SNIFF_REC_WRAP 0x40
+
+#define SNIFF_HS_DAV 0x01
+#define SNIFF_HS_NRFD 0x02
+#define SNIFF_HS_NDAC 0x04
+
+#define SNIFF_RECORD_SIZE 4
+
+/* Runs until ESC is received from PC. Observer only watches the bus, with
+   acceptor set the converter also takes part in handshake as listener that
+   is always ready, so transfers complete without other listeners.
+   Returns 0 if no capture buffer could be taken from pool. */
+unsigned char Sniff_Run(unsigned char acceptor);
+
+#endif
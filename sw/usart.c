@@ -1,31 +1,85 @@
 #include "usart.h"
+#include <avr/interrupt.h>
 
 #define FOSC 12000000UL // Clock Speed
 #define BAUD 115200UL
 #define MYUBRR FOSC/8/BAUD-1 //U2X set to 1
 
+static unsigned char uartRxBuf[UART_RX_BUF_SIZE];
+volatile unsigned char uartRxHead = 0;
+volatile unsigned char uartRxTail = 0;
+volatile unsigned char uartEscapes = 0;
+
+static unsigned char uartTxBuf[UART_TX_BUF_SIZE];
+static volatile unsigned char uartTxHead = 0;
+static volatile unsigned char uartTxTail = 0;
+
 /* USART on */
 void UART_init (void) {
   unsigned int ubrr = MYUBRR;
   UBRRH = (unsigned char)(ubrr>>8);
   UBRRL = (unsigned char)ubrr;
   UCSRA = (1<<U2X);
-  /* Enable receiver and transmitter */
-  UCSRB = (1<<RXEN) | (1<<TXEN);
+  /* Enable receiver, receive interrupt and transmitter */
+  UCSRB = (1<<RXEN) | (1<<RXCIE) | (1<<TXEN);
   /* Set frame format: 8data, 1 stop bit, no parity */
   UCSRC = (1<<URSEL) | (3<<UCSZ0);
 }
 
 void UART_transmit( unsigned char data ) {
-  /* Wait for empty transmit buffer */
-  while ( !UARTTransmitBufferEmpty() );
-  /* Put data into buffer, sends the data */
-  UDR = data;
+  unsigned char next = (uartTxHead + 1) & (UART_TX_BUF_SIZE - 1);
+  /* Wait for free space in transmit buffer */
+  while ( next == uartTxTail );
+  /* Put data into buffer, UDRE interrupt sends it */
+  uartTxBuf[uartTxHead] = data;
+  uartTxHead = next;
+  UCSRB |= (1<<UDRIE);
+}
+
+/* bytes UART_transmit() takes without waiting */
+unsigned char UART_TxFree( void ) {
+  return (uartTxTail - uartTxHead - 1) & (UART_TX_BUF_SIZE - 1);
 }
 
 unsigned char UART_receive( void ) {
+  unsigned char data;
   /* Wait for data to be received */
   while ( !UARTDataAvailable() );
   /* Get and return received data from buffer */
-  return UDR;
+  data = uartRxBuf[uartRxTail];
+  uartRxTail = (uartRxTail + 1) & (UART_RX_BUF_SIZE - 1);
+  if (27 == data)
+  {
+    cli(); // counter is also changed by receive interrupt
+    uartEscapes--;
+    sei();
+  }
+  return data;
+}
+
+/* next received byte, left in buffer, UARTDataAvailable() must be true */
+unsigned char UART_peek( void ) {
+  return uartRxBuf[uartRxTail];
+}
+
+SIGNAL (SIG_UART_RECV) {
+  unsigned char data = UDR;
+  unsigned char next = (uartRxHead + 1) & (UART_RX_BUF_SIZE - 1);
+  if (next != uartRxTail) // byte is dropped when buffer is full
+  {
+    uartRxBuf[uartRxHead] = data;
+    uartRxHead = next;
+    if (27 == data)
+      uartEscapes++;
+  }
+}
+
+SIGNAL (SIG_UART_DATA) {
+  if (uartTxHead == uartTxTail)
+  {
+    UCSRB &= ~(1<<UDRIE); // nothing more to send
+    return;
+  }
+  UDR = uartTxBuf[uartTxTail];
+  uartTxTail = (uartTxTail + 1) & (UART_TX_BUF_SIZE - 1);
 }
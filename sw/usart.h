@@ -13,12 +13,25 @@
 // The UDRE Flag indicates if the transmit buffer (UDR) is ready to receive new data
 #define UARTTransmitBufferEmpty() ( UCSRA & (1<<UDRE))
 
-// This flag bit is set when there are unread data in the receive buffer and cleared after UDR read
-#define UARTDataAvailable() (UCSRA & (1<<RXC))
+// Received bytes are collected by RXC interrupt, so commands sent by PC while
+// a GPIB transfer is in progress are not lost
+#define UART_RX_BUF_SIZE 64 // power of 2
+
+// Transmitted bytes are sent by UDRE interrupt, so replies go out while the
+// next GPIB transfer is already running
+#define UART_TX_BUF_SIZE 64 // power of 2
+
+extern volatile unsigned char uartRxHead;
+extern volatile unsigned char uartRxTail;
+extern volatile unsigned char uartEscapes; // ESC bytes received and not read yet, aborts GPIB waits
+
+#define UARTDataAvailable() (uartRxHead != uartRxTail)
 
 void UART_init(void);
 
 void UART_transmit( unsigned char data );
 unsigned char UART_receive( void );
+unsigned char UART_peek( void );
+unsigned char UART_TxFree( void );
 
 #endif